@@ -0,0 +1,37 @@
+-- Times a grammar that runs a Cmt callback for every token over inputs of
+-- increasing size. The cost per callback should stay flat as the input
+-- grows: the callback is handed the subject string by reference, not a
+-- copy of it.
+local pgen = require "pgen"
+local P, R, S, Cmt = pgen.P, pgen.R, pgen.S, pgen.Cmt
+
+package.preload["cmt_benchmark_grammar"] = function()
+  return {
+    "tokens",
+    tokens = (Cmt(R"az"^1, [[
+      local subject, pos = ...
+      return pos
+    ]]) * S" \n"^0)^0 * -1,
+  }
+end
+
+local parser = pgen.require("cmt_benchmark_grammar", {
+  parser_name = "cmt_benchmark"
+})
+
+local SIZES = {1000, 10000, 100000, 1000000}
+local REPEAT = 5
+
+for _, count in ipairs(SIZES) do
+  local input = ("token "):rep(count)
+  assert(parser.parse(input), "parse failed")
+
+  local start = os.clock()
+  for _ = 1, REPEAT do
+    parser.parse(input)
+  end
+  local elapsed = os.clock() - start
+
+  print(string.format("%8d tokens (%8d bytes): %8.1f ns per Cmt call",
+    count, #input, elapsed / (REPEAT * count) * 1e9))
+end
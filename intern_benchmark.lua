@@ -0,0 +1,58 @@
+-- Times interned captures (C(patt, {intern = true})) against plain C
+-- captures, per token, for words of several lengths: a few distinct words
+-- repeated (cache hits) and every word distinct (cache misses). Interning
+-- only pays where lua_pushlstring would allocate a new string for a repeat,
+-- which on Lua 5.4 is the strings over 40 bytes.
+local pgen = require "pgen"
+local P, R, S, C, Ct = pgen.P, pgen.R, pgen.S, pgen.C, pgen.Ct
+
+local function grammar(intern)
+  return function()
+    return {
+      "tokens",
+      tokens = Ct((C(R("az", "09")^1, {intern = intern}) * S" \n"^0)^0) * -1,
+    }
+  end
+end
+
+package.preload["intern_benchmark_plain"] = grammar(false)
+package.preload["intern_benchmark_interned"] = grammar(true)
+
+local plain = pgen.require("intern_benchmark_plain", {
+  parser_name = "intern_benchmark_plain"
+})
+local interned = pgen.require("intern_benchmark_interned", {
+  parser_name = "intern_benchmark_interned"
+})
+
+local COUNT = 200000
+local REPEAT = 7
+
+-- best of REPEAT parses, in ns per token
+local function time(parser, input)
+  assert(parser.parse(input), "parse failed")
+  local best = math.huge
+  for _ = 1, REPEAT do
+    local start = os.clock()
+    parser.parse(input)
+    best = math.min(best, os.clock() - start)
+  end
+  return best / COUNT * 1e9
+end
+
+print(_VERSION)
+for _, len in ipairs({4, 16, 39, 48, 64}) do
+  for _, distinct in ipairs({16, COUNT}) do
+    local words = {}
+    for i = 1, COUNT do
+      -- the number repeated through the whole word: Lua 5.1 hashes long
+      -- strings from a sample of their bytes, which a constant filler
+      -- would make collide
+      local word = tostring(i % distinct) .. "x"
+      words[i] = word:rep(math.ceil(len / #word)):sub(1, len)
+    end
+    local input = table.concat(words, " ")
+    print(string.format("%3d byte words, %6d distinct: plain %6.1f ns, interned %6.1f ns per token",
+      len, distinct, time(plain, input), time(interned, input)))
+  end
+end
@@ -65,9 +65,46 @@ function pgen.V(name)
 end
 
 
--- Capture
-function pgen.C(patt)
-  return pattern(types.C, coerce_pattern(patt))
+-- Capture. opts.intern routes the captured string through the C target's
+-- intern cache (see the intern compile option)
+function pgen.C(patt, opts)
+  local node = pattern(types.C, coerce_pattern(patt))
+  if opts ~= nil then
+    assert(type(opts) == "table", "C options must be a table")
+    node.intern = opts.intern and true or nil
+  end
+  return node
+end
+
+-- Span capture: like C, but captures the start and stop positions of the
+-- match (subject:sub(start, stop) is the text) instead of copying it
+function pgen.Cspan(patt)
+  local node = pattern(types.C, coerce_pattern(patt))
+  node.span = true
+  return node
+end
+
+-- Number capture: like C, but captures the text converted to a number.
+-- Decimal integers and floats (optional sign, digits with an optional
+-- fraction, optional exponent) are converted, anything else captures nil.
+-- Integers that fit become Lua integers (Lua 5.3+), other numbers floats.
+function pgen.Cnum(patt)
+  local node = pattern(types.C, coerce_pattern(patt))
+  node.convert = "num"
+  return node
+end
+
+-- Unescaping capture: like C, but captures the text with its escape
+-- sequences decoded, by the rules of JSON strings (style "json", the
+-- default) or Lua short strings (style "lua"). The quotes are not part of
+-- the escapes: capture the string's contents. Malformed escapes are kept
+-- as they are.
+function pgen.Cunescape(patt, style)
+  style = style or "json"
+  assert(style == "json" or style == "lua", "Cunescape style must be \"json\" or \"lua\"")
+  local node = pattern(types.C, coerce_pattern(patt))
+  node.convert = style
+  return node
 end
 
 -- Capture table
@@ -124,6 +161,22 @@ function pgen.Cmt(patt, code)
   }
 end
 
+-- Native match-time capture: like Cmt, but the predicate is the body of a C
+-- function compiled into the parser, so no Lua call is made. The body sees
+--   const char *input; size_t len;   the subject, len the end of the window
+--   size_t start; size_t pos;        where patt's match starts and ends
+--   const PgenSpan *caps; int ncaps; start/len of patt's C and Cspan captures
+-- and returns the position to continue at (pos or later, at most len), or
+-- PGEN_CMT_FAIL. The inner captures are consumed. C targets only.
+function pgen.Cmt_c(patt, source)
+  assert(type(source) == "string", "Cmt_c requires a string of C code")
+  return make{
+    type = types.Cmt,
+    value = coerce_pattern(patt),
+    native = source
+  }
+end
+
 -- Transform capture: the captures of patt are passed to a Lua callback and
 -- its return values become the captures (lpeg `patt / fn` semantics,
 -- evaluated innermost-first after the whole parse succeeds, so transforms
@@ -141,6 +194,25 @@ function pgen.Cfn(patt, code)
   }
 end
 
+-- Committing repetition: matches like patt^n (n defaults to 0), and marks
+-- each completed iteration as a commit point. parse_stream hands the
+-- captures of an iteration to its consumer once it completes and drops
+-- them from the capture log, so a long run of records is never held in
+-- memory at once; parse and the other entry points keep them as patt^n
+-- would. The generators reject a Commit that a choice, predicate or
+-- enclosing repetition could backtrack over (see analyze.check_commits).
+function pgen.Commit(patt, n)
+  n = n or 0
+  assert(type(n) == "number" and n >= 0 and math.floor(n) == n,
+    "Commit count must be a non-negative integer")
+  return make{
+    type = "repeat",
+    commit = true,
+    coerce_pattern(patt),
+    n
+  }
+end
+
 -- Indenter: a match-time integer stack that lives alongside the parser, with
 -- indentation-flavored operations. Backed by a stack in the generated C
 -- parser; all operations are transactional (undone when the parser
@@ -214,6 +286,106 @@ function pgen.T(label)
   return pattern(types.T, label)
 end
 
+-- Binary operator expression by precedence climbing:
+--   pgen.prec{
+--     operand = V"Value",
+--     levels = {{"or"}, {"and"}, {"+", "-"}, {"*", "/"}, {"^", assoc = "right"}},
+--     assoc = "left",   -- default for levels without their own assoc
+--     space = V"ws",    -- optional, matched around each operator
+--   }
+-- Levels go from loosest to tightest binding; a level's operators are
+-- tried in order like a choice. Each operator application captures a table
+-- of the left operand's captures, the operator text, and the right
+-- operand's captures, nesting to the left for left associative levels
+-- ({{a, "-", b}, "-", c}) and to the right otherwise. Compiles to one
+-- loop instead of a rule per level, with the same matches as those rules.
+--
+-- The node keeps the operand, the optional space pattern and one operator
+-- choice per level as its children, so traversals see them all; `right`
+-- holds the associativity of each level.
+function pgen.prec(opts)
+  assert(type(opts) == "table" and getmetatable(opts) ~= mt, "prec requires an options table")
+  assert(opts.operand ~= nil, "prec requires an operand pattern")
+  assert(type(opts.levels) == "table" and #opts.levels > 0, "prec requires at least one operator level")
+
+  local default_assoc = opts.assoc or "left"
+  assert(default_assoc == "left" or default_assoc == "right", "prec assoc must be left or right")
+
+  local node = {
+    type = "prec",
+    space = opts.space ~= nil,
+    right = {},
+    coerce_pattern(opts.operand)
+  }
+
+  if opts.space ~= nil then
+    table.insert(node, coerce_pattern(opts.space))
+  end
+
+  for i, level in ipairs(opts.levels) do
+    -- a lone operator is shorthand for a level holding just that operator
+    if type(level) ~= "table" or getmetatable(level) == mt then
+      level = {level}
+    end
+    assert(#level > 0, "prec level must list at least one operator")
+
+    local ops
+    for _, op in ipairs(level) do
+      ops = ops and ops + op or coerce_pattern(op)
+    end
+
+    local assoc = level.assoc or default_assoc
+    assert(assoc == "left" or assoc == "right", "prec assoc must be left or right")
+    node.right[i] = assoc == "right"
+    table.insert(node, ops)
+  end
+
+  return make(node)
+end
+
+-- Identifier that isn't a reserved word:
+--   pgen.Ident{
+--     start = R("az", "AZ", "__"),
+--     rest = R("az", "AZ", "09", "__"),
+--     reserved = {"and", "break", "do", ...},
+--   }
+-- Matches a start byte and the longest run of rest bytes after it, then
+-- fails if the whole run is one of the reserved words. Equivalent to
+-- `-((P"and" + P"break" + ...) * -rest) * start * rest^0` for reserved
+-- words made of identifier bytes, but scans the identifier once and checks
+-- it with a perfect hash lookup instead of a keyword predicate. start and
+-- rest must each match one byte from a fixed set (S, R, single characters
+-- and choices of those). Captures nothing; wrap it in C to capture the name.
+function pgen.Ident(opts)
+  local analyze = require("pgen.analyze")
+  assert(type(opts) == "table" and getmetatable(opts) ~= mt, "Ident requires an options table")
+
+  local function class_key(field)
+    local class = analyze.byte_class(opts[field] ~= nil and coerce_pattern(opts[field]))
+    assert(class and not next(class.records) and not class.record_eof,
+      "Ident " .. field .. " must match one byte from a fixed set")
+    return analyze.class_key(class)
+  end
+
+  local reserved = {}
+  local seen = {}
+  for _, word in ipairs(opts.reserved or {}) do
+    assert(type(word) == "string" and #word > 0, "Ident reserved words must be non-empty strings")
+    if not seen[word] then
+      seen[word] = true
+      table.insert(reserved, word)
+    end
+  end
+  table.sort(reserved)
+
+  return make{
+    type = "ident",
+    start = class_key("start"),
+    rest = class_key("rest"),
+    reserved = reserved
+  }
+end
+
 function mt.__add(a, b)
   return make{
     type = "choice",
@@ -284,14 +456,15 @@ end
 
 
 -- Compile grammar to source code for the given target: "c" (default)
--- generates a C Lua module, "lua" generates a self-contained pure Lua module
+-- generates a C Lua module, "c-api" a standalone C parser with no Lua
+-- dependency, "lua" a self-contained pure Lua module
 function pgen.compile(grammar, options)
   options = options or {}
   local parser_name = options.parser_name or "parser"
   local target = options.target or "c"
 
   local generator
-  if target == "c" then
+  if target == "c" or target == "c-api" then
     generator = require("pgen.generator")
   elseif target == "lua" then
     generator = require("pgen.generator_lua")
@@ -308,7 +481,12 @@ function pgen.compile(grammar, options)
   return generator.generate(grammar, parser_name, {
     pgen_version = pgen.VERSION,
     pgen_errors = options.pgen_errors,
-    max_depth = options.max_depth
+    max_depth = options.max_depth,
+    memo = options.memo,
+    memo_limit = options.memo_limit,
+    memo_caps = options.memo_caps,
+    intern = options.intern,
+    c_api = target == "c-api"
   })
 end
 
@@ -342,6 +520,9 @@ function pgen.require(module_name, options)
   local show_timing = options.show_timing
   local parser_name = options.parser_name or "parser"
   local target = options.target or os.getenv("PGEN_TARGET") or "c"
+  if target == "c-api" then
+    error("The c-api target has no Lua interface; compile it with pgen.compile instead")
+  end
 
   local socket
   if show_timing then
@@ -379,6 +560,10 @@ function pgen.require(module_name, options)
     optimize = options.optimize,
     pgen_errors = options.pgen_errors,
     max_depth = options.max_depth,
+    memo = options.memo,
+    memo_limit = options.memo_limit,
+    memo_caps = options.memo_caps,
+    intern = options.intern,
     target = target
   })
   log_time("Compiled grammar to " .. target .. " code (" .. tostring(#output) .. " bytes)", start_time)
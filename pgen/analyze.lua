@@ -1,6 +1,14 @@
 local analyze = {}
 local types = require("pgen.types")
 
+-- Pattern tables overload __len for lookahead on Lua 5.2+, so use the raw
+-- array length when inspecting their children
+local raw_length = rawlen or function(value)
+  return #value
+end
+
+local unpack = table.unpack or unpack
+
 -- Determine whether matching a pattern may change state that must be rolled
 -- back with the input position (captures pushed onto the Lua stack, indenter
 -- stack operations). Rule references are resolved through rule_states, a
@@ -21,7 +29,8 @@ function analyze.changes_backtrack_state(pattern, rules, rule_states)
       t == types.Ind then
     return true
   elseif t == types.P or t == types.R or t == types.S or t == types.Cmb or
-      t == types.T or t == "literal_trie" then
+      t == types.T or t == "literal_trie" or t == "class_run" or
+      t == "char_class" or t == "keyword" or t == "ident" then
     return false
   elseif t == types.V then
     local name = pattern.value
@@ -60,7 +69,9 @@ function analyze.position_pure(pattern, rules, rule_purity)
 
   local t = pattern.type
 
-  if t == types.P or t == types.R or t == types.S or t == "literal_trie" then
+  if t == types.P or t == types.R or t == types.S or t == "literal_trie" or
+      t == "class_run" or t == "char_class" or t == "keyword" or
+      t == "ident" then
     return true
   elseif t == types.V then
     local name = pattern.value
@@ -106,6 +117,69 @@ function analyze.pure_rules(rules)
   return purity
 end
 
+-- Determine whether a rule's match can be memoized by replaying its capture
+-- log segment: like position_pure, but captures that only append log
+-- entries (C, Ct, Cp, Cc, Cg, Cn, Cfn) are allowed, since matching at the
+-- same position appends the same entries. Cmt (runs Lua code mid-parse),
+-- Cmb (reads entries from before the rule), indenter operations and T stay
+-- excluded. rule_replay is a precomputed name -> boolean table from
+-- analyze.replayable_rules.
+function analyze.replayable(pattern, rules, rule_replay)
+  if type(pattern) ~= "table" then
+    return false
+  end
+
+  local t = pattern.type
+
+  if t == types.P or t == types.R or t == types.S or t == "literal_trie" or
+      t == "class_run" or t == "char_class" or t == "keyword" or
+      t == "ident" or t == types.Cp or t == types.Cc then
+    return true
+  elseif t == types.V then
+    local name = pattern.value
+    if type(rules[name]) ~= "table" then
+      return false
+    end
+    return rule_replay[name] or false
+  elseif t == types.L or t == types.C or t == types.Ct or t == types.Cg or
+      t == types.Cn or t == types.Cfn then
+    return analyze.replayable(pattern.value, rules, rule_replay)
+  elseif t == "repeat" or t == "negate" then
+    return analyze.replayable(pattern[1], rules, rule_replay)
+  elseif t == "sequence" or t == "choice" or t == "dispatch_choice" or
+      t == "prec" then
+    for _, child in ipairs(pattern) do
+      if not analyze.replayable(child, rules, rule_replay) then
+        return false
+      end
+    end
+    return true
+  end
+
+  -- Cmt, Cmb, indenter ops, T, and unknown types
+  return false
+end
+
+-- Compute analyze.replayable for every rule as a greatest fixed point, like
+-- pure_rules
+function analyze.replayable_rules(rules)
+  local replay = {}
+  for name in pairs(rules) do
+    replay[name] = true
+  end
+  local changed = true
+  while changed do
+    changed = false
+    for name, pattern in pairs(rules) do
+      if replay[name] and not analyze.replayable(pattern, rules, replay) then
+        replay[name] = false
+        changed = true
+      end
+    end
+  end
+  return replay
+end
+
 -- Compute changes_backtrack_state for every rule in the grammar as a least
 -- fixed point: rules start assumed state-free and are flipped to stateful
 -- until stable, so cycles of state-free rules correctly resolve to false.
@@ -209,6 +283,13 @@ function analyze.is_nullable(pattern, rules, rule_memo, visiting)
     return analyze.is_nullable(pattern[1], rules, rule_memo, visiting)
   elseif t == "literal_trie" then
     return false -- tries are only built from non-empty literals
+  elseif t == "class_run" then
+    return pattern.min == 0
+  elseif t == "char_class" or t == "keyword" or t == "ident" then
+    return false
+  elseif t == "prec" then
+    -- operators only ever extend a matched operand
+    return analyze.is_nullable(pattern[1], rules, rule_memo, visiting)
   else
     -- unknown pattern type: conservative
     return true
@@ -258,6 +339,11 @@ function analyze.first_set(pattern, rules, rule_first, nullable_memo)
     for char in pairs(pattern.trie.children) do
       result.bytes[char:byte(1)] = true
     end
+  elseif t == "class_run" or t == "char_class" or t == "ident" then
+    local class = t == "ident" and pattern.start or pattern.class
+    for byte = 0, 255 do
+      if class:byte(byte + 1) == 1 then result.bytes[byte] = true end
+    end
   elseif t == types.V then
     local summary = rule_first[pattern.value]
     if type(rules[pattern.value]) ~= "table" or not summary then
@@ -286,7 +372,7 @@ function analyze.first_set(pattern, rules, rule_first, nullable_memo)
       add_bytes(result.bytes, child_first.bytes)
       result.unknown = result.unknown or child_first.unknown
     end
-  elseif t == "repeat" then
+  elseif t == "repeat" or t == "prec" or t == "keyword" then
     local child_first = analyze.first_set(pattern[1], rules, rule_first, nullable_memo)
     add_bytes(result.bytes, child_first.bytes)
     result.unknown = child_first.unknown
@@ -342,9 +428,116 @@ function analyze.first_sets(rules, nullable_memo)
   return summaries
 end
 
+-- Determine whether a pattern matches exactly one byte from a fixed set,
+-- for matching runs of it without stepping through the pattern per byte.
+-- Returns nil, or {bytes, records, record_eof}: the member bytes, the
+-- non-member bytes whose rejection records the furthest failure position
+-- (a negated class or a trie rejecting them), and whether failing at the
+-- end of input records it (P(1), tries). Forms: S, R, single-byte P
+-- literals, P(1), single-byte tries, choices of classes that don't record
+-- on bytes, and `-c1 * -c2 * ... * class` sequences (P(1) - S"\r\n").
+-- Classes are only built where failing never records at a member byte, so
+-- a run records at most at the byte that ends it.
+function analyze.byte_class(pattern)
+  if type(pattern) ~= "table" then
+    return nil
+  end
+
+  local t = pattern.type
+  local class = {bytes = {}, records = {}, record_eof = false}
+
+  if t == types.S then
+    for i = 1, #pattern.value do
+      class.bytes[pattern.value:byte(i)] = true
+    end
+  elseif t == types.R then
+    for _, range in ipairs(pattern.value) do
+      local low, high = range:byte(1, 2)
+      for byte = low, high do class.bytes[byte] = true end
+    end
+  elseif t == types.P then
+    local value = pattern.value
+    if value == 1 then
+      for byte = 0, 255 do class.bytes[byte] = true end
+      class.record_eof = true
+    elseif type(value) == "string" and #value == 1 then
+      class.bytes[value:byte()] = true
+    else
+      return nil
+    end
+  elseif t == "char_class" then
+    for byte = 0, 255 do
+      if pattern.class:byte(byte + 1) == 1 then class.bytes[byte] = true end
+    end
+  elseif t == "literal_trie" then
+    for _, str in ipairs(pattern.strings) do
+      if #str ~= 1 then
+        return nil
+      end
+      class.bytes[str:byte()] = true
+    end
+    for byte = 0, 255 do
+      class.records[byte] = not class.bytes[byte] or nil
+    end
+    class.record_eof = true
+  elseif t == "choice" or t == "dispatch_choice" then
+    for _, child in ipairs(pattern) do
+      local child_class = analyze.byte_class(child)
+      if not child_class or next(child_class.records) then
+        return nil
+      end
+      add_bytes(class.bytes, child_class.bytes)
+      class.record_eof = class.record_eof or child_class.record_eof
+    end
+  elseif t == "sequence" then
+    local count = raw_length(pattern)
+    local last = analyze.byte_class(pattern[count])
+    if not last then
+      return nil
+    end
+    local excluded = {}
+    for i = 1, count - 1 do
+      local child = pattern[i]
+      local negated = child.type == "negate" and analyze.byte_class(child[1])
+      if not negated or next(negated.records) or negated.record_eof then
+        return nil
+      end
+      add_bytes(excluded, negated.bytes)
+    end
+    for byte in pairs(last.bytes) do
+      if not excluded[byte] then class.bytes[byte] = true end
+    end
+    for byte = 0, 255 do
+      if excluded[byte] or last.records[byte] then
+        class.records[byte] = true
+      end
+    end
+    class.record_eof = last.record_eof
+  else
+    return nil
+  end
+
+  return class
+end
+
+-- Encode a byte_class result as a string usable as a table key, so equal
+-- classes compare equal: byte i + 1 is 1 for members, 2 for non-members
+-- whose rejection records the furthest failure and 0 otherwise, and byte
+-- 257 is 1 when failing at the end of input records it
+function analyze.class_key(class)
+  local codes = {}
+  for byte = 0, 255 do
+    codes[byte + 1] = class.bytes[byte] and 1 or class.records[byte] and 2 or 0
+  end
+  codes[257] = class.record_eof and 1 or 0
+  return string.char(unpack(codes))
+end
+
 -- Error if any unbounded repetition (patt^n for n >= 0) has a body that may
 -- match the empty string: such a loop never advances and hangs the parser.
 -- Equivalent to LPeg's "loop body may accept empty string" compile error.
+-- The operator loop of a pgen.prec is held to the same rule: every
+-- operator must consume input.
 function analyze.check_loops(rules)
   local visitor = require("pgen.visitor")
   local rule_memo = {}
@@ -366,10 +559,64 @@ function analyze.check_loops(rules)
           if analyze.is_nullable(node[1], rules, rule_memo, {}) then
             error(("Rule '%s': loop body may accept empty string (would loop forever)"):format(tostring(name)), 0)
           end
+        elseif node.type == "prec" then
+          local first_op = node.space and 3 or 2
+          for i, child in ipairs(node) do
+            if i >= first_op and analyze.is_nullable(child, rules, rule_memo, {}) then
+              error(("Rule '%s': prec operator may accept empty string (would loop forever)"):format(tostring(name)), 0)
+            end
+          end
         end
       end)
     end
   end
 end
 
+-- Error if a committing repetition (pgen.Commit) is reachable from the
+-- start rule through anything but sequences, Ct and rule references: under
+-- a choice, predicate, repetition or other capture a later failure could
+-- backtrack over iterations parse_stream has already handed out. A rule is
+-- walked once per kind of position it is referenced from.
+function analyze.check_commits(rules, start_rule)
+  local seen = {[true] = {}, [false] = {}}
+
+  local function walk(pattern, committed, rule_name)
+    if type(pattern) ~= "table" then
+      return
+    end
+
+    local t = pattern.type
+    if t == "repeat" and pattern.commit then
+      if not committed then
+        error(("Rule '%s': Commit may be backtracked over (it must only be reached through sequences, Ct and rule references)"):format(tostring(rule_name)), 0)
+      end
+      -- a failed iteration rewinds to the start of that iteration
+      walk(pattern[1], false, rule_name)
+    elseif t == types.V then
+      local name = pattern.value
+      if type(rules[name]) == "table" and not seen[committed][name] then
+        seen[committed][name] = true
+        walk(rules[name], committed, name)
+      end
+    elseif t == "sequence" then
+      for _, child in ipairs(pattern) do
+        walk(child, committed, rule_name)
+      end
+    elseif t == types.Ct then
+      walk(pattern.value, committed, rule_name)
+    elseif t == types.C or t == types.L or t == types.Cg or t == types.Cn or
+        t == types.Cmt or t == types.Cfn then
+      walk(pattern.value, false, rule_name)
+    elseif t == "choice" or t == "dispatch_choice" or t == "prec" or
+        t == "repeat" or t == "negate" or t == "keyword" then
+      for _, child in ipairs(pattern) do
+        walk(child, false, rule_name)
+      end
+    end
+  end
+
+  seen[true][start_rule] = true
+  walk(rules[start_rule], true, start_rule)
+end
+
 return analyze
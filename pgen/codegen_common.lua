@@ -83,6 +83,18 @@ function common.collect_cg_names(grammar)
   return result
 end
 
+-- Whether any rule holds a committing repetition (pgen.Commit): the commit
+-- support is only generated when used
+function common.has_commits(rules)
+  local visitor = require("pgen.visitor")
+  local _, found = visitor.visit_grammar(rules, function(node)
+    if node.type == "repeat" and node.commit then
+      return visitor.STOP
+    end
+  end)
+  return found
+end
+
 -- Collect all unique non-nil values from Cc nodes in a grammar. These are
 -- interned into the Lua registry once at module load; capture-log CONST
 -- entries reference them by registry ref, so matching never constructs
@@ -143,7 +155,8 @@ function common.collect_cmt_codes(grammar)
   local next_id = 0
 
   local new_grammar = visitor.visit_grammar(grammar, function(node, replace)
-    if (node.type == types.Cmt or node.type == types.Cfn) and node.cmt_id == nil then
+    if (node.type == types.Cmt or node.type == types.Cfn) and node.cmt_id == nil and
+        not node.native then
       local kind = node.type == types.Cmt and "cmt" or "cfn"
       local code = node.code
       local key = kind .. "\0" .. code
@@ -225,4 +238,158 @@ function common.collect_indenters(grammar)
   return descriptors, changed and new_grammar or grammar
 end
 
+-- Validate the memoization compile options. memo = "packrat" gives every
+-- position-pure rule a memo slot per input position instead of a single
+-- slot, with memo_limit capping the tables' size in bytes. memo_caps caps
+-- the capture log entries a capture-replay memo entry may hold (0 disables
+-- memoizing capture-producing rules). Returns whether packrat memoization
+-- is enabled, and the memo_caps cap.
+function common.check_memo_options(options)
+  local memo = options.memo
+  assert(memo == nil or memo == "slot" or memo == "packrat",
+    "memo must be \"slot\" or \"packrat\"")
+  if options.memo_limit ~= nil then
+    assert(type(options.memo_limit) == "number" and options.memo_limit >= 1,
+      "memo_limit must be a positive number of bytes")
+  end
+  local memo_caps = 64
+  if options.memo_caps ~= nil then
+    assert(type(options.memo_caps) == "number" and options.memo_caps >= 0,
+      "memo_caps must be a non-negative number of capture entries")
+    memo_caps = math.floor(options.memo_caps)
+  end
+  return memo == "packrat", memo_caps
+end
+
+-- Assign memo ids to the rules of the grammar that a memo can serve:
+-- position-pure rules (analyze.pure_rules) get ids into the memo slots,
+-- and, unless memo_caps is 0, the other rules whose captures can be
+-- replayed (analyze.replayable_rules) get ids into the capture-replay
+-- slots. Ids are assigned in sorted order, counting from base. Returns the
+-- two name -> id tables and their counts.
+function common.assign_memo_ids(rules, memo_caps, base)
+  local analyze = require("pgen.analyze")
+  local purity = analyze.pure_rules(rules)
+  local replay = memo_caps > 0 and analyze.replayable_rules(rules) or {}
+
+  local pure_names, replay_names = {}, {}
+  for name in pairs(rules) do
+    if purity[name] then
+      table.insert(pure_names, name)
+    elseif replay[name] then
+      table.insert(replay_names, name)
+    end
+  end
+  local function by_name(a, b)
+    return tostring(a) < tostring(b)
+  end
+  table.sort(pure_names, by_name)
+  table.sort(replay_names, by_name)
+
+  local memo_ids, replay_ids = {}, {}
+  for i, name in ipairs(pure_names) do
+    memo_ids[name] = i - 1 + base
+  end
+  for i, name in ipairs(replay_names) do
+    replay_ids[name] = i - 1 + base
+  end
+  return memo_ids, #pure_names, replay_ids, #replay_names
+end
+
+-- The byte ranges of a class (analyze.class_key encoding) whose members
+-- (negated = false) or non-members (negated = true) they cover, as a list
+-- of {low, high} pairs
+function common.class_ranges(class, negated)
+  local ranges = {}
+  local low
+  for byte = 0, 256 do
+    local inside = byte < 256 and (class:byte(byte + 1) == 1) ~= negated
+    if inside and not low then
+      low = byte
+    elseif not inside and low then
+      table.insert(ranges, {low, byte - 1})
+      low = nil
+    end
+  end
+  return ranges
+end
+
+-- Short bracket-expression description of a class for generated comments,
+-- e.g. [\x09\x20] or [^\x0a]. Bytes outside printable ASCII, and the ones
+-- that could end a comment, are shown as hex escapes.
+function common.describe_class(class)
+  local negated = #common.class_ranges(class, true) < #common.class_ranges(class, false)
+  local parts = {}
+  for _, range in ipairs(common.class_ranges(class, negated)) do
+    local function show(byte)
+      if byte > 32 and byte < 127 and byte ~= 92 and byte ~= 42 and byte ~= 47 then
+        return string.char(byte)
+      end
+      return string.format("\\x%02x", byte)
+    end
+    local low, high = range[1], range[2]
+    table.insert(parts, low == high and show(low) or show(low) .. "-" .. show(high))
+  end
+  return "[" .. (negated and "^" or "") .. table.concat(parts) .. "]"
+end
+
+-- The hash used for reserved word lookups (pgen.Ident), computed the same
+-- way by the generated C: h = 0, then h = (h * mult + byte) mod 2^32 for
+-- each byte. The seed picks the multiplier, an odd number: two words of
+-- the same length collide for a multiplier that is a root of the
+-- polynomial their byte differences make, so a collision under one seed
+-- rarely survives another.
+function common.reserved_multiplier(seed)
+  return (33 + seed * 2654435762) % 4294967296
+end
+
+function common.reserved_hash(word, seed)
+  local mult = common.reserved_multiplier(seed)
+  local mult_lo, mult_hi = mult % 65536, math.floor(mult / 65536)
+  local h = 0
+  for i = 1, #word do
+    -- h * mult mod 2^32, split so every product stays exact in a double
+    h = (h * mult_lo + (h * mult_hi) % 65536 * 65536 + word:byte(i)) % 4294967296
+  end
+  return h
+end
+
+-- Find a perfect hash for a list of distinct reserved words: a seed and a
+-- table size where every word lands in its own slot (hash % size), trying
+-- the smallest sizes first. Returns {seed, size, mult, slots}, slots
+-- mapping 0-based slot numbers to words. The search is bounded: a list no
+-- seed separates raises an error.
+function common.reserved_perfect_hash(words)
+  local size = math.max(#words, 1)
+  -- a random assignment of n words is collision-free with probability
+  -- about exp(-n^2 / 2size), so n^2 slots leave room for every seed to
+  -- have been tried many times over
+  local max_size = size * size + 64
+
+  while size <= max_size do
+    for seed = 0, 1023 do
+      local slots = {}
+      local ok = true
+      for _, word in ipairs(words) do
+        local slot = common.reserved_hash(word, seed) % size
+        if slots[slot] then
+          ok = false
+          break
+        end
+        slots[slot] = word
+      end
+      if ok then
+        return {
+          seed = seed,
+          size = size,
+          mult = common.reserved_multiplier(seed),
+          slots = slots
+        }
+      end
+    end
+    size = size + math.ceil(size / 16)
+  end
+  error("Ident: no perfect hash found for the " .. #words .. " reserved words")
+end
+
 return common
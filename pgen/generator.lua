@@ -26,7 +26,7 @@ local function escape_c_literal(str, delim)
 
   -- Mapping for characters with standard C escape sequences or requiring escaping
   local escapes = {
-    [string.char(0)]  = "\\0",  -- Null
+    [string.char(0)]  = "\\000", -- Null (full octal form: a following digit can't extend it)
     [string.char(7)]  = "\\a",  -- Bell (Alert)
     [string.char(8)]  = "\\b",  -- Backspace
     [string.char(9)]  = "\\t",  -- Horizontal Tab
@@ -61,12 +61,63 @@ local function escape_c_literal(str, delim)
   return delim .. escaped .. delim
 end
 
+generator.escape_c_literal = escape_c_literal
+
 local function assert_valid_c_identifier(name)
   if not name:match("^[A-Za-z_][A-Za-z0-9_]*$") then
     error("Invalid capture name for C identifier: " .. escape_string(name))
   end
 end
 
+-- Apply the intern compile option to every C capture, and report whether
+-- any capture is interned: the intern cache is only generated when used
+local function collect_interned(grammar, intern_all)
+  local visitor = require("pgen.visitor")
+  local found = false
+  local new_grammar = visitor.visit_grammar(grammar, function(node, replace)
+    if node.type == types.C and not node.span and not node.convert then
+      if intern_all and not node.intern then
+        replace(visitor.copy_node(node, {intern = true}))
+      end
+      found = found or intern_all or node.intern == true
+    end
+  end)
+  return new_grammar, found
+end
+
+-- The conversions (Cnum, Cunescape) the grammar's captures use, as a set
+-- of their convert values: each one's evaluator is only generated when used
+local function collect_conversions(grammar)
+  local visitor = require("pgen.visitor")
+  local used = {}
+  visitor.visit_grammar(grammar, function(node)
+    if node.type == types.C and node.convert then
+      used[node.convert] = true
+    end
+  end)
+  return used
+end
+
+-- Assign native_id to Cmt_c nodes, sharing an id between identical
+-- sources. Returns the sources by id (0-based) and the new grammar.
+local function collect_native_cmts(grammar)
+  local visitor = require("pgen.visitor")
+  local sources = {}
+  local source_to_id = {}
+  local new_grammar = visitor.visit_grammar(grammar, function(node, replace)
+    if node.type == types.Cmt and node.native and node.native_id == nil then
+      local id = source_to_id[node.native]
+      if id == nil then
+        id = #sources
+        source_to_id[node.native] = id
+        table.insert(sources, node.native)
+      end
+      replace(visitor.copy_node(node, {native_id = id}))
+    end
+  end)
+  return sources, new_grammar
+end
+
 local function position_operations(pattern, context)
   local needs_state = context.analyze.changes_backtrack_state(
     pattern, context.rules, context.stateful_rules)
@@ -76,18 +127,37 @@ local function position_operations(pattern, context)
   return "REMEMBER_INPUT_POSITION(parser, pos);", "RESTORE_INPUT_POSITION(parser, pos);"
 end
 
--- Compile a grammar definition to C code
+-- Compile a grammar definition to C code. With options.c_api the output is
+-- a standalone C parser with no Lua dependency (see pgen/generator_c_api.lua)
 function generator.generate(grammar, parser_name, options)
   options = options or {}
   local pgen_version = options.pgen_version or "unknown"
+  local c_api = options.c_api
+  local packrat, memo_caps = common.check_memo_options(options)
 
   -- Collect Cmt codes and get transformed grammar with cmt_id assigned
   local cmt_codes, transformed_grammar = collect_cmt_codes(grammar)
+  if c_api and #cmt_codes > 0 then
+    error("The c-api target does not support Cmt or Cfn: their callbacks are Lua code", 0)
+  end
+
+  -- Collect the C sources of native match-time captures (Cmt_c)
+  local natives
+  natives, transformed_grammar = collect_native_cmts(transformed_grammar)
 
   -- Collect indenter descriptors and assign stack ids to Ind nodes
   local indenters
   indenters, transformed_grammar = collect_indenters(transformed_grammar)
 
+  -- Interning and conversions only matter when building Lua values: the
+  -- c-api target logs those captures as plain STR entries
+  local has_intern = false
+  local conversions = {}
+  if not c_api then
+    transformed_grammar, has_intern = collect_interned(transformed_grammar, options.intern)
+    conversions = collect_conversions(transformed_grammar)
+  end
+
   -- Extract rules from transformed grammar (which has cmt_id on Cmt nodes)
   local rules, start_rule = common.extract_rules(transformed_grammar)
 
@@ -95,6 +165,7 @@ function generator.generate(grammar, parser_name, options)
   -- which would loop forever at parse time
   local analyze = require("pgen.analyze")
   analyze.check_loops(rules)
+  analyze.check_commits(rules, start_rule)
 
   -- Collect all Cg (capture group) names for sentinel generation
   local cg_names = collect_cg_names(transformed_grammar)
@@ -106,35 +177,43 @@ function generator.generate(grammar, parser_name, options)
   local const_pool, const_index = collect_constants(transformed_grammar)
   local has_consts = #const_pool > 0 or #cg_names > 0
 
-  -- Assign single-slot memo ids to position-pure rules (sorted for
-  -- deterministic output); see generate_rule_function
-  local memo_ids = {}
-  local memo_count = 0
-  do
-    local purity = analyze.pure_rules(rules)
-    local pure_names = {}
-    for name, pure in pairs(purity) do
-      if pure then
-        table.insert(pure_names, name)
-      end
-    end
-    table.sort(pure_names)
-    for i, name in ipairs(pure_names) do
-      memo_ids[name] = i - 1
-    end
-    memo_count = #pure_names
-  end
+  -- Assign memo ids to position-pure rules and capture-replay ids to the
+  -- other memoizable rules; see generate_rule_function
+  local memo_ids, memo_count, replay_ids, replay_count =
+    common.assign_memo_ids(rules, memo_caps, 0)
+  local memo = {
+    ids = memo_ids,
+    count = memo_count,
+    packrat = packrat,
+    replay_ids = replay_ids,
+    replay_count = replay_count
+  }
 
   -- Generate the C code
-  local c_chunks = {
-    template_code([[// Generated by pgen $PGEN_VERSION$
+  local c_chunks
+  if c_api then
+    local c_api_generator = require("pgen.generator_c_api")
+    c_chunks = {
+      template_code([[// Generated by pgen $PGEN_VERSION$ (c-api target)
 ]], {PGEN_VERSION = pgen_version}),
-    generator.generate_parser_header(parser_name, cg_names, cmt_codes, indenters, const_pool, memo_count),
-    generator.generate_forward_declarations(rules, start_rule),
-    generator.generate_rule_functions(rules, start_rule, const_index, cg_names, memo_ids),
-    generator.generate_parser_main(parser_name, start_rule, cmt_codes, indenters, has_consts, memo_count),
-    -- Add compilation instructions as a comment
-    template_code([[/*
+      c_api_generator.generate_public_declarations(parser_name),
+      generator.generate_parser_header(parser_name, cg_names, cmt_codes, indenters, const_pool, memo, true),
+      generator.generate_forward_declarations(rules, start_rule),
+      generator.generate_native_cmt_functions(natives),
+      generator.generate_rule_functions(rules, start_rule, const_index, cg_names, memo, true),
+      c_api_generator.generate_main(parser_name, start_rule, indenters, memo)
+    }
+  else
+    c_chunks = {
+      template_code([[// Generated by pgen $PGEN_VERSION$
+]], {PGEN_VERSION = pgen_version}),
+      generator.generate_parser_header(parser_name, cg_names, cmt_codes, indenters, const_pool, memo),
+      generator.generate_forward_declarations(rules, start_rule),
+      generator.generate_native_cmt_functions(natives),
+      generator.generate_rule_functions(rules, start_rule, const_index, cg_names, memo),
+      generator.generate_parser_main(parser_name, start_rule, cmt_codes, indenters, has_consts, memo),
+      -- Add compilation instructions as a comment
+      template_code([[/*
 To compile as a Lua module:
 gcc -shared -o $PARSER_NAME$.so -fPIC $PARSER_NAME$.c `pkg-config --cflags --libs lua5.1`
 
@@ -143,7 +222,8 @@ local $PARSER_NAME$ = require "$PARSER_NAME$"
 local result = $PARSER_NAME$.parse("your input string")
 */
 ]], {PARSER_NAME = parser_name})
-  }
+    }
+  end
 
   if options.pgen_debug then
     table.insert(c_chunks, 2, "#define PGEN_DEBUG 1")
@@ -153,12 +233,36 @@ local result = $PARSER_NAME$.parse("your input string")
     table.insert(c_chunks, 2, "#define PGEN_ERRORS 1")
   end
 
+  if has_intern then
+    table.insert(c_chunks, 2, "#define PGEN_INTERN 1")
+  end
+
+  if conversions.num then
+    table.insert(c_chunks, 2, "#define PGEN_NUM 1")
+  end
+
+  if conversions.json or conversions.lua then
+    table.insert(c_chunks, 2, "#define PGEN_UNESCAPE 1")
+  end
+
+  if not c_api and common.has_commits(rules) then
+    table.insert(c_chunks, 2, "#define PGEN_COMMIT 1")
+  end
+
   if options.max_depth then
     assert(type(options.max_depth) == "number" and options.max_depth >= 1,
       "max_depth must be a positive number")
     table.insert(c_chunks, 2, "#define PGEN_MAX_DEPTH " .. math.floor(options.max_depth))
   end
 
+  if packrat and options.memo_limit then
+    table.insert(c_chunks, 2, "#define PGEN_MEMO_LIMIT " .. math.floor(options.memo_limit))
+  end
+
+  if replay_count > 0 then
+    table.insert(c_chunks, 2, "#define PGEN_MEMO_CAPS " .. memo_caps)
+  end
+
   return table.concat(c_chunks, "\n")
 end
 
@@ -196,6 +300,393 @@ local function generate_cap_evaluator()
 
 static int pgen_cap_eval(Parser *parser, size_t *i);
 
+#ifdef PGEN_INTERN
+// Interned captures (C(patt, {intern = true}), or every C with the intern
+// compile option) look strings up in a cache of recently pushed ones before
+// lua_pushlstring, so a repeated string reuses one Lua string instead of
+// allocating it again. Lua already interns short strings itself (all of
+// them on 5.1 and LuaJIT, up to 40 bytes on 5.2+), with one hash and one
+// compare, so only longer ones go through the cache; see
+// intern_benchmark.lua. The cache is a direct-mapped table of strings in
+// the registry that persists across parses; the slot hashes are kept on
+// the C side so misses don't touch it.
+#ifndef PGEN_INTERN_SLOTS
+#define PGEN_INTERN_SLOTS 1024
+#endif
+#ifndef PGEN_INTERN_MIN_LEN
+#if LUA_VERSION_NUM >= 502
+#define PGEN_INTERN_MIN_LEN 41
+#else
+#define PGEN_INTERN_MIN_LEN ((size_t)-1)
+#endif
+#endif
+#ifndef PGEN_INTERN_MAX_LEN
+#define PGEN_INTERN_MAX_LEN 64
+#endif
+
+static int __intern_ref = LUA_NOREF;
+// The cached strings' bytes, so a lookup is decided without touching Lua:
+// the registry table keeps the strings, and with them these, alive
+static const char *__intern_strs[PGEN_INTERN_SLOTS];  // NULL = empty slot
+static size_t __intern_lens[PGEN_INTERN_SLOTS];
+
+// Push the len bytes at s as a string, through the intern cache when its
+// length is in range. Needs 3 free stack slots.
+static void pgen_push_interned(lua_State *L, const char *s, size_t len) {
+  if (len < PGEN_INTERN_MIN_LEN || len > PGEN_INTERN_MAX_LEN) {
+    lua_pushlstring(L, s, len);
+    return;
+  }
+  // the slot only selects a candidate, and the bytes decide, so hashing
+  // the length and 16 bytes from each end is enough
+  uint64_t hash = (uint64_t)len * 0x9e3779b97f4a7c15u;
+  if (len >= 16) {
+    hash = (hash ^ pgen_load64(s)) * 0x9e3779b97f4a7c15u;
+    hash = (hash ^ pgen_load64(s + 8)) * 0x9e3779b97f4a7c15u;
+    hash = (hash ^ pgen_load64(s + len - 16)) * 0x9e3779b97f4a7c15u;
+    hash = (hash ^ pgen_load64(s + len - 8)) * 0x9e3779b97f4a7c15u;
+  } else {
+    for (size_t k = 0; k < len; k++) {
+      hash = (hash ^ (unsigned char)s[k]) * 0x9e3779b97f4a7c15u;
+    }
+  }
+  int slot = (int)((hash >> 32) % PGEN_INTERN_SLOTS);
+
+  const char *cached = __intern_strs[slot];
+  if (cached && __intern_lens[slot] == len && memcmp(cached, s, len) == 0) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, __intern_ref);
+    lua_rawgeti(L, -1, slot + 1);
+    lua_remove(L, -2);
+    return;
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, __intern_ref);
+  lua_pushlstring(L, s, len);
+  __intern_strs[slot] = lua_tostring(L, -1);
+  __intern_lens[slot] = len;
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, -3, slot + 1);
+  lua_remove(L, -2);
+}
+#endif
+
+#ifdef PGEN_NUM
+// Number captures (Cnum) convert decimal numbers: an optional sign, digits
+// with an optional fraction, and an optional exponent. Returns whether the
+// len bytes at s are one.
+static bool pgen_is_number(const char *s, size_t len) {
+  size_t k = 0;
+  size_t digits = 0;
+  if (k < len && (s[k] == '+' || s[k] == '-')) {
+    k++;
+  }
+  while (k < len && s[k] >= '0' && s[k] <= '9') {
+    k++;
+    digits++;
+  }
+  if (k < len && s[k] == '.') {
+    k++;
+    while (k < len && s[k] >= '0' && s[k] <= '9') {
+      k++;
+      digits++;
+    }
+  }
+  if (digits == 0) {
+    return false;
+  }
+  if (k < len && (s[k] == 'e' || s[k] == 'E')) {
+    k++;
+    if (k < len && (s[k] == '+' || s[k] == '-')) {
+      k++;
+    }
+    size_t exponent = k;
+    while (k < len && s[k] >= '0' && s[k] <= '9') {
+      k++;
+    }
+    if (k == exponent) {
+      return false;
+    }
+  }
+  return k == len;
+}
+
+// Push the len bytes at s as a number, or nil when they aren't one. The
+// number is the one tonumber gives, whatever the C locale's decimal point:
+// on Lua 5.3+ lua_stringtonumber converts it (an integer that fits a
+// lua_Integer stays one), before that strtod does. Needs 2 free stack
+// slots.
+static void pgen_push_number(lua_State *L, const char *s, size_t len) {
+  if (!pgen_is_number(s, len)) {
+    lua_pushnil(L);
+    return;
+  }
+  // The conversion reads a terminated copy: the input goes on past the
+  // capture
+  char buf[64];
+  char *text = buf;
+  if (len >= sizeof(buf)) {
+    text = (char*)lua_newuserdata(L, len + 1);
+  }
+  memcpy(text, s, len);
+  text[len] = '\0';
+#if LUA_VERSION_NUM >= 503
+  if (lua_stringtonumber(L, text) == 0) {
+    lua_pushnil(L);
+  }
+#else
+  char *end;
+  lua_Number number = (lua_Number)strtod(text, &end);
+  char *point = strchr(text, '.');
+  if (*end != '\0' && point) {
+    // strtod stopped at the '.': it isn't the locale's decimal point, so
+    // try again with that in its place, as Lua 5.3's l_str2d does
+    *point = localeconv()->decimal_point[0];
+    number = (lua_Number)strtod(text, NULL);
+  }
+  lua_pushnumber(L, number);
+#endif
+  if (text != buf) {
+    lua_remove(L, -2);
+  }
+}
+#endif
+
+#ifdef PGEN_UNESCAPE
+// Unescaping captures (Cunescape) decode the escape sequences of JSON
+// strings or Lua short strings into a luaL_Buffer. The decoders take the
+// text and the index of a backslash in it, append the escape's value and
+// return the index past the escape, or 0 when it is malformed: then the
+// backslash is kept as it is and decoding resumes after it.
+typedef size_t (*PgenUnescape)(luaL_Buffer *b, const char *s, size_t len, size_t k);
+
+static int pgen_hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// The value of the n hex digits at s, or -1 when they aren't all hex
+static long pgen_hex_value(const char *s, size_t n) {
+  long value = 0;
+  for (size_t k = 0; k < n; k++) {
+    int digit = pgen_hex_digit(s[k]);
+    if (digit < 0) {
+      return -1;
+    }
+    value = value * 16 + digit;
+  }
+  return value;
+}
+
+// Append cp as UTF-8, including the 5 and 6 byte forms Lua's "\u{XXX}"
+// allows for values up to 2^31
+static void pgen_add_utf8(luaL_Buffer *b, unsigned long cp) {
+  if (cp < 0x80) {
+    luaL_addchar(b, (char)cp);
+    return;
+  }
+  char bytes[6];
+  int n = 0;
+  unsigned long first_max = 0x3f;  // the most the first byte can hold
+  do {
+    bytes[5 - n++] = (char)(0x80 | (cp & 0x3f));
+    cp >>= 6;
+    first_max >>= 1;
+  } while (cp > first_max);
+  bytes[5 - n++] = (char)((~first_max << 1) | cp);
+  luaL_addlstring(b, bytes + 6 - n, (size_t)n);
+}
+
+// JSON: \" \\ \/ \b \f \n \r \t and \uXXXX, with surrogate pairs combined
+// and lone surrogates decoded as U+FFFD
+static size_t pgen_unescape_json(luaL_Buffer *b, const char *s, size_t len, size_t k) {
+  if (k + 1 >= len) {
+    return 0;
+  }
+  switch (s[k + 1]) {
+  case '"': luaL_addchar(b, '"'); return k + 2;
+  case '\\': luaL_addchar(b, '\\'); return k + 2;
+  case '/': luaL_addchar(b, '/'); return k + 2;
+  case 'b': luaL_addchar(b, '\b'); return k + 2;
+  case 'f': luaL_addchar(b, '\f'); return k + 2;
+  case 'n': luaL_addchar(b, '\n'); return k + 2;
+  case 'r': luaL_addchar(b, '\r'); return k + 2;
+  case 't': luaL_addchar(b, '\t'); return k + 2;
+  case 'u': {
+    long cp = k + 6 <= len ? pgen_hex_value(s + k + 2, 4) : -1;
+    if (cp < 0) {
+      return 0;
+    }
+    k += 6;
+    if (cp >= 0xD800 && cp <= 0xDBFF && k + 6 <= len && s[k] == '\\' && s[k + 1] == 'u') {
+      long low = pgen_hex_value(s + k + 2, 4);
+      if (low >= 0xDC00 && low <= 0xDFFF) {
+        cp = 0x10000 + (cp - 0xD800) * 0x400 + (low - 0xDC00);
+        k += 6;
+      }
+    }
+    if (cp >= 0xD800 && cp <= 0xDFFF) {
+      cp = 0xFFFD;
+    }
+    pgen_add_utf8(b, (unsigned long)cp);
+    return k;
+  }
+  default:
+    return 0;
+  }
+}
+
+// Lua 5.4 short strings: \a \b \f \n \r \t \v \\ \" \', an escaped line
+// break, \xXX, \z, \ddd (up to 255) and \u{XXX} (up to 2^31)
+static size_t pgen_unescape_lua(luaL_Buffer *b, const char *s, size_t len, size_t k) {
+  if (k + 1 >= len) {
+    return 0;
+  }
+  char c = s[k + 1];
+  switch (c) {
+  case 'a': luaL_addchar(b, '\a'); return k + 2;
+  case 'b': luaL_addchar(b, '\b'); return k + 2;
+  case 'f': luaL_addchar(b, '\f'); return k + 2;
+  case 'n': luaL_addchar(b, '\n'); return k + 2;
+  case 'r': luaL_addchar(b, '\r'); return k + 2;
+  case 't': luaL_addchar(b, '\t'); return k + 2;
+  case 'v': luaL_addchar(b, '\v'); return k + 2;
+  case '\\': luaL_addchar(b, '\\'); return k + 2;
+  case '"': luaL_addchar(b, '"'); return k + 2;
+  case '\'': luaL_addchar(b, '\''); return k + 2;
+  case '\n':
+  case '\r':
+    // \r\n and \n\r are one line break
+    luaL_addchar(b, '\n');
+    k += 2;
+    if (k < len && (s[k] == '\n' || s[k] == '\r') && s[k] != c) {
+      k++;
+    }
+    return k;
+  case 'x': {
+    long value = k + 4 <= len ? pgen_hex_value(s + k + 2, 2) : -1;
+    if (value < 0) {
+      return 0;
+    }
+    luaL_addchar(b, (char)value);
+    return k + 4;
+  }
+  case 'z':
+    // skips the whitespace that follows
+    k += 2;
+    while (k < len && (s[k] == ' ' || (s[k] >= '\t' && s[k] <= '\r'))) {
+      k++;
+    }
+    return k;
+  case 'u': {
+    if (k + 2 >= len || s[k + 2] != '{') {
+      return 0;
+    }
+    size_t j = k + 3;
+    unsigned long cp = 0;
+    bool too_big = false;
+    while (j < len && pgen_hex_digit(s[j]) >= 0) {
+      if (cp > 0x7FFFFFF) {
+        too_big = true;
+      } else {
+        cp = cp * 16 + (unsigned long)pgen_hex_digit(s[j]);
+      }
+      j++;
+    }
+    if (j == k + 3 || j >= len || s[j] != '}' || too_big) {
+      return 0;
+    }
+    pgen_add_utf8(b, cp);
+    return j + 1;
+  }
+  default:
+    if (c >= '0' && c <= '9') {
+      int value = 0;
+      size_t j = k + 1;
+      while (j < len && j < k + 4 && s[j] >= '0' && s[j] <= '9') {
+        value = value * 10 + (s[j] - '0');
+        j++;
+      }
+      if (value > 255) {
+        return 0;
+      }
+      luaL_addchar(b, (char)value);
+      return j;
+    }
+    return 0;
+  }
+}
+
+// Push the len bytes at s with their escapes decoded by unescape. Text
+// without a backslash is pushed as it is. Needs LUA_MINSTACK free stack
+// slots (luaL_Buffer uses the stack).
+static void pgen_push_unescaped(lua_State *L, const char *s, size_t len, PgenUnescape unescape) {
+  const char *backslash = (const char *)memchr(s, '\\', len);
+  if (!backslash) {
+    lua_pushlstring(L, s, len);
+    return;
+  }
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  size_t k = 0;
+  while (backslash) {
+    size_t at = (size_t)(backslash - s);
+    luaL_addlstring(&b, s + k, at - k);
+    k = unescape(&b, s, len, at);
+    if (k == 0) {
+      luaL_addchar(&b, '\\');
+      k = at + 1;
+    }
+    backslash = k < len ? (const char *)memchr(s + k, '\\', len - k) : NULL;
+  }
+  luaL_addlstring(&b, s + k, len - k);
+  luaL_pushresult(&b);
+}
+#endif
+
+#if LUA_VERSION_NUM >= 502
+#define pgen_setuservalue lua_setuservalue
+#define pgen_getuservalue lua_getuservalue
+#define pgen_rawlen lua_rawlen
+#else
+#define pgen_setuservalue lua_setfenv
+#define pgen_getuservalue lua_getfenv
+#define pgen_rawlen lua_objlen
+#endif
+
+// parse_lazy documents keep the parser (and its capture log) alive after
+// the parse: an anchor table holds the parser userdata, the subject, the
+// values of Cmt captures (by their stack index during the parse) and the
+// cache of built table levels (by log index). Each table capture is a
+// proxy userdata whose uservalue is the anchor.
+enum {
+  PGEN_LAZY_PARSER = 1,
+  PGEN_LAZY_INPUT,
+  PGEN_LAZY_VALUES,
+  PGEN_LAZY_CACHE
+};
+
+typedef struct {
+  Parser *parser;
+  size_t open;  // log index of the table's TBL_OPEN entry
+} PgenLazy;
+
+static int __lazy_mt_ref = LUA_NOREF;
+
+// Push a proxy for the table opened at log index open
+static void pgen_lazy_push(Parser *parser, size_t open) {
+  lua_State *L = parser->L;
+  pgen_checkstack(parser, 2);
+  PgenLazy *proxy = (PgenLazy*)lua_newuserdata(L, sizeof(PgenLazy));
+  proxy->parser = parser;
+  proxy->open = open;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, __lazy_mt_ref);
+  lua_setmetatable(L, -2);
+  lua_pushvalue(L, parser->lazy_anchor);
+  pgen_setuservalue(L, -2);
+  parser->top++;
+}
+
 // Push the single value a capture group produces: its first inner capture
 // value, or the text it matched when its contents produce no values
 static void pgen_cap_eval_group(Parser *parser, size_t *i) {
@@ -217,27 +708,91 @@ static void pgen_cap_eval_group(Parser *parser, size_t *i) {
   }
 
   // no values: the group's value is the text it matched
-  size_t start = parser->caps[open].start;
+  size_t start = PGEN_CAP_START(parser, open);
   pgen_checkstack(parser, 1);
-  lua_pushlstring(parser->L, parser->input + start, parser->caps[close].start - start);
+  lua_pushlstring(parser->L, parser->input + start, PGEN_CAP_START(parser, close) - start);
+  parser->top++;
+}
+
+// Count the items of the table opened at index open, for presizing it:
+// array items (every item but a named group; a hint, since a Cfn item may
+// produce any number of values) and named groups. Nested brackets are
+// skipped whole, so this reads one kind per item.
+static void pgen_cap_table_counts(Parser *parser, size_t open, size_t *narr, size_t *nrec) {
+  size_t close = open + PGEN_CAP_LINK(parser, open);
+  *narr = 0;
+  *nrec = 0;
+  size_t j = open + 1;
+  while (j < close) {
+    int kind = PGEN_CAP_KIND(parser, j);
+    if (kind == PGEN_CAP_GROUP_OPEN) {
+      (*nrec)++;
+    } else {
+      *narr += kind == PGEN_CAP_SPAN ? 2 : 1;
+    }
+    pgen_cap_skip(parser, &j);
+  }
+}
+
+// Push the table captured between the TBL_OPEN entry at open and its
+// close, presized from its item counts
+static void pgen_cap_build_table(Parser *parser, size_t open) {
+  size_t close = open + PGEN_CAP_LINK(parser, open);
+  size_t narr, nrec;
+  pgen_cap_table_counts(parser, open, &narr, &nrec);
+  pgen_checkstack(parser, 3);
+  lua_createtable(parser->L, (int)narr, (int)nrec);
   parser->top++;
+  int table_idx = parser->top;
+
+  size_t j = open + 1;
+  int array_idx = 1;
+  while (j < close) {
+    // without named groups every item goes to the array part
+    if (nrec > 0 && PGEN_CAP_KIND(parser, j) == PGEN_CAP_GROUP_OPEN) {
+      pgen_checkstack(parser, 2);
+      lua_rawgeti(parser->L, LUA_REGISTRYINDEX, __cg_name_refs[PGEN_CAP_OPEN_AUX(parser, j)]);
+      parser->top++;
+      pgen_cap_eval_group(parser, &j);
+      lua_rawset(parser->L, table_idx);
+      parser->top -= 2;
+    } else {
+      // rawseti pops the top value, so multi-value items assign their
+      // indexes in reverse
+      int produced = pgen_cap_eval(parser, &j);
+      for (int v = produced - 1; v >= 0; v--) {
+        lua_rawseti(parser->L, table_idx, array_idx + v);
+      }
+      array_idx += produced;
+      parser->top -= produced;
+    }
+  }
 }
 
 // Materialize one log item (entry or bracketed range) at *i, advancing *i
 // past the item. Returns the number of Lua values pushed: always 1 except
-// for transform captures, whose callbacks may return any number of values.
+// for spans (2) and transform captures, whose callbacks may return any
+// number of values.
 static int pgen_cap_eval(Parser *parser, size_t *i) {
-  PgenCap *cap = &parser->caps[*i];
-  switch (cap->kind) {
+  size_t at = *i;
+  switch (PGEN_CAP_KIND(parser, at)) {
   case PGEN_CAP_STR:
     pgen_checkstack(parser, 1);
-    lua_pushlstring(parser->L, parser->input + cap->start, cap->len);
+    lua_pushlstring(parser->L, parser->input + PGEN_CAP_START(parser, at), PGEN_CAP_LEN(parser, at));
+    parser->top++;
+    (*i)++;
+    return 1;
+#ifdef PGEN_INTERN
+  case PGEN_CAP_INTERN:
+    pgen_checkstack(parser, 3);
+    pgen_push_interned(parser->L, parser->input + PGEN_CAP_START(parser, at), PGEN_CAP_LEN(parser, at));
     parser->top++;
     (*i)++;
     return 1;
+#endif
   case PGEN_CAP_CONST:
     pgen_checkstack(parser, 1);
-    lua_rawgeti(parser->L, LUA_REGISTRYINDEX, cap->aux);
+    lua_rawgeti(parser->L, LUA_REGISTRYINDEX, PGEN_CAP_AUX(parser, at));
     parser->top++;
     (*i)++;
     return 1;
@@ -249,13 +804,46 @@ static int pgen_cap_eval(Parser *parser, size_t *i) {
     return 1;
   case PGEN_CAP_POS:
     pgen_checkstack(parser, 1);
-    lua_pushinteger(parser->L, (lua_Integer)(cap->start + 1));
+    lua_pushinteger(parser->L, (lua_Integer)(PGEN_CAP_START(parser, at) + 1));
+    parser->top++;
+    (*i)++;
+    return 1;
+  case PGEN_CAP_SPAN:
+    // 1-based inclusive bounds, so subject:sub(start, stop) is the text
+    pgen_checkstack(parser, 2);
+    lua_pushinteger(parser->L, (lua_Integer)(PGEN_CAP_START(parser, at) + 1));
+    lua_pushinteger(parser->L, (lua_Integer)(PGEN_CAP_START(parser, at) + PGEN_CAP_LEN(parser, at)));
+    parser->top += 2;
+    (*i)++;
+    return 2;
+#ifdef PGEN_NUM
+  case PGEN_CAP_NUM:
+    pgen_checkstack(parser, 2);
+    pgen_push_number(parser->L, parser->input + PGEN_CAP_START(parser, at), PGEN_CAP_LEN(parser, at));
+    parser->top++;
+    (*i)++;
+    return 1;
+#endif
+#ifdef PGEN_UNESCAPE
+  case PGEN_CAP_JSON_STR:
+  case PGEN_CAP_LUA_STR:
+    pgen_checkstack(parser, LUA_MINSTACK);
+    pgen_push_unescaped(parser->L, parser->input + PGEN_CAP_START(parser, at), PGEN_CAP_LEN(parser, at),
+      PGEN_CAP_KIND(parser, at) == PGEN_CAP_JSON_STR ? pgen_unescape_json : pgen_unescape_lua);
     parser->top++;
     (*i)++;
     return 1;
+#endif
   case PGEN_CAP_VALUE:
-    pgen_checkstack(parser, 1);
-    lua_pushvalue(parser->L, cap->aux);
+    pgen_checkstack(parser, 2);
+    if (parser->lazy_anchor) {
+      // the parse's stack is gone: the value was kept in the document
+      lua_rawgeti(parser->L, parser->lazy_anchor, PGEN_LAZY_VALUES);
+      lua_rawgeti(parser->L, -1, PGEN_CAP_AUX(parser, at));
+      lua_remove(parser->L, -2);
+    } else {
+      lua_pushvalue(parser->L, PGEN_CAP_AUX(parser, at));
+    }
     parser->top++;
     (*i)++;
     return 1;
@@ -269,13 +857,16 @@ static int pgen_cap_eval(Parser *parser, size_t *i) {
     size_t open = *i;
     int func_base = parser->top;
     pgen_checkstack(parser, 1);
-    lua_rawgeti(parser->L, LUA_REGISTRYINDEX, cap->aux);
+    lua_rawgeti(parser->L, LUA_REGISTRYINDEX, PGEN_CAP_OPEN_AUX(parser, at));
     parser->top++;
+    // callbacks always receive real tables
+    bool lazy_tables = parser->lazy_tables;
+    parser->lazy_tables = false;
 
     int nargs = 0;
     size_t j = open + 1;
-    while (parser->caps[j].kind != PGEN_CAP_FN_CLOSE) {
-      if (parser->caps[j].kind == PGEN_CAP_GROUP_OPEN) {
+    while (PGEN_CAP_KIND(parser, j) != PGEN_CAP_FN_CLOSE) {
+      if (PGEN_CAP_KIND(parser, j) == PGEN_CAP_GROUP_OPEN) {
         // named groups are not visible as arguments (as at the top level)
         pgen_cap_skip(parser, &j);
       } else {
@@ -285,11 +876,12 @@ static int pgen_cap_eval(Parser *parser, size_t *i) {
 
     if (nargs == 0) {
       // no inner captures: the callback receives the matched text
-      size_t start = parser->caps[open].start;
+      size_t start = PGEN_CAP_START(parser, open);
       pgen_checkstack(parser, 1);
-      lua_pushlstring(parser->L, parser->input + start, parser->caps[j].start - start);
+      lua_pushlstring(parser->L, parser->input + start, PGEN_CAP_START(parser, j) - start);
       nargs = 1;
     }
+    parser->lazy_tables = lazy_tables;
 
     // lua_call propagates errors (aborts materialization on Lua error)
     lua_call(parser->L, nargs, LUA_MULTRET);
@@ -300,35 +892,14 @@ static int pgen_cap_eval(Parser *parser, size_t *i) {
     return parser->top - func_base;
   }
   default: {  // PGEN_CAP_TBL_OPEN
-    // No presizing: counting items would re-walk every nested subtree at
-    // each nesting level, which costs more than letting the table grow
-    pgen_checkstack(parser, 3);
-    lua_createtable(parser->L, 0, 0);
-    parser->top++;
-    int table_idx = parser->top;
-
-    size_t j = *i + 1;
-    int array_idx = 1;
-    while (parser->caps[j].kind != PGEN_CAP_TBL_CLOSE) {
-      if (parser->caps[j].kind == PGEN_CAP_GROUP_OPEN) {
-        pgen_checkstack(parser, 2);
-        lua_rawgeti(parser->L, LUA_REGISTRYINDEX, __cg_name_refs[parser->caps[j].aux]);
-        parser->top++;
-        pgen_cap_eval_group(parser, &j);
-        lua_rawset(parser->L, table_idx);
-        parser->top -= 2;
-      } else {
-        // rawseti pops the top value, so multi-value items assign their
-        // indexes in reverse
-        int produced = pgen_cap_eval(parser, &j);
-        for (int v = produced - 1; v >= 0; v--) {
-          lua_rawseti(parser->L, table_idx, array_idx + v);
-        }
-        array_idx += produced;
-        parser->top -= produced;
-      }
+    size_t close = at + PGEN_CAP_LINK(parser, at);
+    if (parser->lazy_tables) {
+      pgen_lazy_push(parser, at);
+      *i = close + 1;
+      return 1;
     }
-    *i = j + 1;  // past TBL_CLOSE
+    pgen_cap_build_table(parser, at);
+    *i = close + 1;
     return 1;
   }
   }
@@ -343,16 +914,24 @@ static void pgen_run_cmt(Parser *parser, int func_ref, size_t start_pos, size_t
   size_t pos_after_inner = parser->pos;
   int leftovers = parser->top - top_base;  // nested Cmt values still on the stack
 
+  // the callback sees only the data fed so far: run at its end, it may be
+  // waiting for more
+  if (pos_after_inner == parser->input_len) {
+    pgen_starve(parser, pos_after_inner + 1);
+  }
+
   pgen_checkstack(parser, 3);
   lua_rawgeti(L, LUA_REGISTRYINDEX, func_ref);
-  lua_pushlstring(L, parser->input, parser->input_len);
+  // the subject string itself: copying it (and on Lua 5.1 hashing it)
+  // would cost O(n) per call
+  lua_pushvalue(L, parser->subject_idx);
   lua_pushinteger(L, (lua_Integer)(pos_after_inner + 1));  // 1-based
   parser->top += 3;
 
   int nargs = 2;
   size_t i = cap_base;
   while (i < parser->cap_len) {
-    if (parser->caps[i].kind == PGEN_CAP_GROUP_OPEN) {
+    if (PGEN_CAP_KIND(parser, i) == PGEN_CAP_GROUP_OPEN) {
       // named groups only matter inside Ct; they aren't passed as arguments
       pgen_cap_skip(parser, &i);
     } else {
@@ -379,11 +958,20 @@ static void pgen_run_cmt(Parser *parser, int func_ref, size_t start_pos, size_t
     if (first_type == LUA_TNUMBER) {
       // Number = new position (1-based from Lua)
       lua_Integer new_pos = lua_tointeger(L, first) - 1;
-      // Per lpeg: must be in range [pos_after_inner, input_len]
+      // Per lpeg: must be in range [pos_after_inner, input_len], where
+      // input_len is the end of the parse window
       if (new_pos >= (lua_Integer)pos_after_inner && new_pos <= (lua_Integer)parser->input_len) {
         parser->pos = (size_t)new_pos;
         parser->success = true;
+        if (parser->pos == parser->input_len) {
+          pgen_starve(parser, parser->pos + 1);  // more input may extend it
+        }
       } else {
+        // a position past the data fed so far asks a streaming parse for
+        // input up to it
+        if (new_pos > (lua_Integer)parser->input_len) {
+          pgen_starve(parser, (size_t)new_pos);
+        }
         parser->success = false;
         PGEN_RECORD_FURTHEST(parser);
         parser->pos = start_pos;
@@ -409,64 +997,657 @@ static void pgen_run_cmt(Parser *parser, int func_ref, size_t start_pos, size_t
     if (parser->stack_claimed > parser->top) parser->stack_claimed = parser->top;
     int extras = returns_count - 1;
     for (int r = 0; r < extras; r++) {
-      pgen_cap_push(parser, PGEN_CAP_VALUE, top_base + 1 + r, 0, 0);
+      pgen_cap_push(parser, PGEN_CAP_VALUE, 0, top_base + 1 + r);
     }
   } else {
     PGEN_SETTOP(parser, top_base);
   }
 }
+
+#ifdef PGEN_COMMIT
+// Commit point of a pgen.Commit repetition during parse_stream: call the
+// consumer with the values of the log entries from cap_base on, then drop
+// them along with the Cmt values above top_base they referenced. Nothing
+// can backtrack past a commit (analyze.check_commits), so the entries are
+// never needed again.
+static void pgen_commit(Parser *parser, size_t cap_base, int top_base) {
+  lua_State *L = parser->L;
+  pgen_checkstack(parser, 1);
+  lua_pushvalue(L, parser->commit_fn);
+  parser->top++;
+
+  int nargs = 0;
+  size_t i = cap_base;
+  while (i < parser->cap_len) {
+    if (PGEN_CAP_KIND(parser, i) == PGEN_CAP_GROUP_OPEN) {
+      // named groups only matter inside Ct, as at the top level
+      pgen_cap_skip(parser, &i);
+    } else {
+      nargs += pgen_cap_eval(parser, &i);
+    }
+  }
+  parser->cap_len = cap_base;
+
+  // iterations without values aren't passed on; consumer errors propagate
+  // (abort the parse)
+  if (nargs > 0) {
+    lua_call(L, nargs, 0);
+  }
+  PGEN_SETTOP(parser, top_base);
+}
+#endif
 ]]
 end
 
--- Generate Cmt (match-time capture) infrastructure
--- Returns C code for: static code strings, ref array, and init function
-local function generate_cmt_infrastructure(cmt_codes)
-  if #cmt_codes == 0 then
-    return ""
-  end
+-- Generate the parse_to_buffer encoder: writes the capture log as
+-- MessagePack or pgen's native binary format without building Lua values.
+-- Only Cc constants, Cmt values and Cfn results, which are Lua values
+-- already, go through the Lua stack.
+local function generate_buf_encoder()
+  return [==[
+// --- Binary encoding (parse_to_buffer) ---
 
-  local lines = {}
-  table.insert(lines, "// Callback (Cmt/Cfn) infrastructure")
-  table.insert(lines, "")
+// Output formats, in the order of parse_to_buffer's format names
+enum {
+  PGEN_BUF_MSGPACK = 1,
+  PGEN_BUF_NATIVE
+};
 
-  -- Generate static code strings
-  for _, cmt in ipairs(cmt_codes) do
-    table.insert(lines, template_code(
-      "static const char __cmt_code_$ID$[] = $CODE_STR$;",
-      {ID = cmt.id, CODE_STR = escape_c_literal(cmt.code)}
-    ))
-  end
+// Values written as a length (bytes, items or key/value pairs) followed by
+// their contents
+enum {
+  PGEN_BUF_STR,
+  PGEN_BUF_ARRAY,
+  PGEN_BUF_MAP
+};
 
-  -- Generate refs array
-  table.insert(lines, "")
-  table.insert(lines, template_code("static int __cmt_refs[$COUNT$];", {COUNT = #cmt_codes}))
+// Native format tags. Each value is a tag byte, followed for INT by a
+// zigzag LEB128 varint, for FLOAT by a little-endian IEEE 754 double, and
+// for STR, ARRAY and MAP by a LEB128 length and the contents.
+enum {
+  PGEN_NATIVE_NIL,
+  PGEN_NATIVE_FALSE,
+  PGEN_NATIVE_TRUE,
+  PGEN_NATIVE_INT,
+  PGEN_NATIVE_FLOAT,
+  PGEN_NATIVE_STR,
+  PGEN_NATIVE_ARRAY,
+  PGEN_NATIVE_MAP
+};
 
-  -- Generate init function
-  table.insert(lines, "")
-  table.insert(lines, [[// Initialize callbacks by loading their Lua code
-static void __cmt_init(lua_State *L) {]])
+// Make room for n more bytes of output, returning where they go
+static unsigned char *pgen_buf_reserve(Parser *parser, size_t n) {
+  if (parser->enc_cap - parser->enc_len < n) {
+    size_t new_cap = parser->enc_cap ? parser->enc_cap : 256;
+    while (new_cap - parser->enc_len < n) {
+      new_cap *= 2;
+    }
+    char *grown = (char*)realloc(parser->enc, new_cap);
+    if (!grown) {
+      luaL_error(parser->L, "pgen: out of memory encoding captures");
+    }
+    parser->enc = grown;
+    parser->enc_cap = new_cap;
+  }
+  unsigned char *at = (unsigned char*)parser->enc + parser->enc_len;
+  parser->enc_len += n;
+  return at;
+}
 
-  for _, cmt in ipairs(cmt_codes) do
-    if cmt.kind == "cfn" then
-      -- Cfn: the chunk runs once at load and must return the callback
-      table.insert(lines, template_code([[  if (luaL_loadstring(L, __cmt_code_$ID$) != 0) {
-    luaL_error(L, "Failed to load Cfn callback $ID$: %s", lua_tostring(L, -1));
+static void pgen_buf_byte(Parser *parser, unsigned char b) {
+  *pgen_buf_reserve(parser, 1) = b;
+}
+
+// Write the low bytes of v, most significant first
+static void pgen_buf_be(Parser *parser, uint64_t v, int bytes) {
+  unsigned char *at = pgen_buf_reserve(parser, bytes);
+  for (int b = bytes - 1; b >= 0; b--) {
+    at[b] = (unsigned char)(v & 0xff);
+    v >>= 8;
   }
-  if (lua_pcall(L, 0, 1, 0) != 0) {
-    luaL_error(L, "Failed to run Cfn chunk $ID$: %s", lua_tostring(L, -1));
+}
+
+static void pgen_buf_varint(Parser *parser, uint64_t v) {
+  while (v >= 0x80) {
+    pgen_buf_byte(parser, (unsigned char)(v | 0x80));
+    v >>= 7;
   }
-  if (!lua_isfunction(L, -1)) {
-    luaL_error(L, "Cfn chunk $ID$ did not return a function");
+  pgen_buf_byte(parser, (unsigned char)v);
+}
+
+// Bytes taken by the header of a string, array or map of count items
+static size_t pgen_buf_header_size(Parser *parser, int type, size_t count) {
+  if (parser->enc_format == PGEN_BUF_NATIVE) {
+    size_t size = 2;
+    while (count >= 0x80) {
+      count >>= 7;
+      size++;
+    }
+    return size;
   }
-  __cmt_refs[$ID$] = luaL_ref(L, LUA_REGISTRYINDEX);]], {ID = cmt.id}))
-    else
-      table.insert(lines, template_code([[  if (luaL_loadstring(L, __cmt_code_$ID$) != 0) {
-    luaL_error(L, "Failed to load Cmt callback $ID$: %s", lua_tostring(L, -1));
+  if (count < (type == PGEN_BUF_STR ? 32u : 16u)) {
+    return 1;
   }
-  __cmt_refs[$ID$] = luaL_ref(L, LUA_REGISTRYINDEX);]], {ID = cmt.id}))
-    end
-  end
-
+  if (type == PGEN_BUF_STR && count < 256) {
+    return 2;
+  }
+  return count < 65536 ? 3 : 5;
+}
+
+static void pgen_buf_header(Parser *parser, int type, size_t count) {
+  if (parser->enc_format == PGEN_BUF_NATIVE) {
+    pgen_buf_byte(parser, (unsigned char)(PGEN_NATIVE_STR + type));
+    pgen_buf_varint(parser, count);
+    return;
+  }
+  // fixstr/fixarray/fixmap, then the 8 (strings only), 16 and 32-bit forms
+  static const unsigned char fixed[] = {0xa0, 0x90, 0x80};
+  static const unsigned char sized[][3] = {
+    {0xd9, 0xda, 0xdb}, {0, 0xdc, 0xdd}, {0, 0xde, 0xdf}
+  };
+  switch (pgen_buf_header_size(parser, type, count)) {
+  case 1:
+    pgen_buf_byte(parser, (unsigned char)(fixed[type] | count));
+    break;
+  case 2:
+    pgen_buf_byte(parser, sized[type][0]);
+    pgen_buf_be(parser, count, 1);
+    break;
+  case 3:
+    pgen_buf_byte(parser, sized[type][1]);
+    pgen_buf_be(parser, count, 2);
+    break;
+  default:
+    if ((uint64_t)count > UINT32_MAX) {
+      luaL_error(parser->L, "pgen: capture too large for MessagePack");
+    }
+    pgen_buf_byte(parser, sized[type][2]);
+    pgen_buf_be(parser, count, 4);
+  }
+}
+
+static void pgen_buf_str(Parser *parser, const char *s, size_t len) {
+  pgen_buf_header(parser, PGEN_BUF_STR, len);
+  memcpy(pgen_buf_reserve(parser, len), s, len);
+}
+
+static void pgen_buf_nil(Parser *parser) {
+  pgen_buf_byte(parser, parser->enc_format == PGEN_BUF_NATIVE ? PGEN_NATIVE_NIL : 0xc0);
+}
+
+static void pgen_buf_bool(Parser *parser, bool b) {
+  if (parser->enc_format == PGEN_BUF_NATIVE) {
+    pgen_buf_byte(parser, b ? PGEN_NATIVE_TRUE : PGEN_NATIVE_FALSE);
+  } else {
+    pgen_buf_byte(parser, b ? 0xc3 : 0xc2);
+  }
+}
+
+static void pgen_buf_int(Parser *parser, int64_t v) {
+  if (parser->enc_format == PGEN_BUF_NATIVE) {
+    pgen_buf_byte(parser, PGEN_NATIVE_INT);
+    pgen_buf_varint(parser, v < 0 ? ~((uint64_t)v << 1) : (uint64_t)v << 1);
+    return;
+  }
+  // the smallest MessagePack form that holds v
+  if (v >= -32 && v < 128) {
+    pgen_buf_byte(parser, (unsigned char)(v & 0xff));  // positive/negative fixint
+  } else if (v >= 0) {
+    int bytes = v < 256 ? 1 : v < 65536 ? 2 : v <= UINT32_MAX ? 4 : 8;
+    pgen_buf_byte(parser, bytes == 1 ? 0xcc : bytes == 2 ? 0xcd : bytes == 4 ? 0xce : 0xcf);
+    pgen_buf_be(parser, (uint64_t)v, bytes);
+  } else {
+    int bytes = v >= INT8_MIN ? 1 : v >= INT16_MIN ? 2 : v >= INT32_MIN ? 4 : 8;
+    pgen_buf_byte(parser, bytes == 1 ? 0xd0 : bytes == 2 ? 0xd1 : bytes == 4 ? 0xd2 : 0xd3);
+    pgen_buf_be(parser, (uint64_t)v, bytes);
+  }
+}
+
+static void pgen_buf_float(Parser *parser, double d) {
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  if (parser->enc_format == PGEN_BUF_NATIVE) {
+    pgen_buf_byte(parser, PGEN_NATIVE_FLOAT);
+    unsigned char *at = pgen_buf_reserve(parser, 8);
+    for (int b = 0; b < 8; b++) {
+      at[b] = (unsigned char)(bits >> (8 * b));
+    }
+  } else {
+    pgen_buf_byte(parser, 0xcb);
+    pgen_buf_be(parser, bits, 8);
+  }
+}
+
+// Encode the Lua value at absolute stack index idx: Cc constants, Cmt
+// values and Cfn results. A table whose keys are exactly 1..#t becomes an
+// array, any other table a map. Tables may be cyclic, so nesting is
+// limited like rule recursion.
+static void pgen_buf_value(Parser *parser, int idx, int depth) {
+  lua_State *L = parser->L;
+  switch (lua_type(L, idx)) {
+  case LUA_TNIL:
+    pgen_buf_nil(parser);
+    break;
+  case LUA_TBOOLEAN:
+    pgen_buf_bool(parser, lua_toboolean(L, idx));
+    break;
+  case LUA_TNUMBER: {
+#if LUA_VERSION_NUM >= 503
+    if (lua_isinteger(L, idx)) {
+      pgen_buf_int(parser, (int64_t)lua_tointeger(L, idx));
+    } else {
+      pgen_buf_float(parser, (double)lua_tonumber(L, idx));
+    }
+#else
+    // every number is a double here: integral ones are written as integers
+    lua_Number n = lua_tonumber(L, idx);
+    if (n >= -9223372036854775808.0 && n < 9223372036854775808.0 &&
+        n == (lua_Number)(int64_t)n) {
+      pgen_buf_int(parser, (int64_t)n);
+    } else {
+      pgen_buf_float(parser, (double)n);
+    }
+#endif
+    break;
+  }
+  case LUA_TSTRING: {
+    size_t len;
+    const char *s = lua_tolstring(L, idx, &len);
+    pgen_buf_str(parser, s, len);
+    break;
+  }
+  case LUA_TTABLE: {
+    if (depth >= PGEN_MAX_DEPTH) {
+      luaL_error(L, "pgen: max nesting depth (%d) exceeded encoding a table", (int)PGEN_MAX_DEPTH);
+    }
+    luaL_checkstack(L, 3, "pgen: encoding a table");
+    size_t len = (size_t)pgen_rawlen(L, idx);
+    size_t count = 0;
+    bool array = true;
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+      count++;
+      if (array) {
+        lua_Number k = lua_type(L, -2) == LUA_TNUMBER ? lua_tonumber(L, -2) : 0;
+        array = k >= 1 && k <= (lua_Number)len && k == (lua_Number)(size_t)k;
+      }
+      lua_pop(L, 1);
+    }
+    if (array && count == len) {
+      pgen_buf_header(parser, PGEN_BUF_ARRAY, len);
+      for (size_t k = 1; k <= len; k++) {
+        lua_rawgeti(L, idx, (int)k);
+        pgen_buf_value(parser, lua_gettop(L), depth + 1);
+        lua_pop(L, 1);
+      }
+    } else {
+      pgen_buf_header(parser, PGEN_BUF_MAP, count);
+      lua_pushnil(L);
+      while (lua_next(L, idx)) {
+        pgen_buf_value(parser, lua_gettop(L) - 1, depth + 1);
+        pgen_buf_value(parser, lua_gettop(L), depth + 1);
+        lua_pop(L, 1);
+      }
+    }
+    break;
+  }
+  default:
+    luaL_error(L, "pgen: can't encode a %s value", luaL_typename(L, idx));
+  }
+}
+
+static int pgen_buf_item(Parser *parser, size_t *i, int max, int64_t *key);
+
+// Encode the value of the capture group opened at *i and advance *i past
+// it: its first inner value, or the text it matched (as pgen_cap_eval_group)
+static void pgen_buf_group(Parser *parser, size_t *i, int64_t *key) {
+  size_t open = *i;
+  pgen_cap_skip(parser, i);
+  size_t close = *i - 1;
+
+  size_t j = open + 1;
+  while (j < close) {
+    if (pgen_buf_item(parser, &j, 1, key) > 0) {
+      return;
+    }
+  }
+  if (key) {
+    pgen_buf_int(parser, (*key)++);
+  }
+  size_t start = PGEN_CAP_START(parser, open);
+  pgen_buf_str(parser, parser->input + start, PGEN_CAP_START(parser, close) - start);
+}
+
+// Encode the table captured between the TBL_OPEN entry at open and its
+// close. Named groups make it a map, with the array items under integer
+// keys. The header is sized from the table's item counts; when Cfn results
+// make the real count differ, the contents are shifted to fit the header
+// that count needs.
+static void pgen_buf_table(Parser *parser, size_t open) {
+  size_t close = open + PGEN_CAP_LINK(parser, open);
+  size_t narr, nrec;
+  pgen_cap_table_counts(parser, open, &narr, &nrec);
+  int type = nrec > 0 ? PGEN_BUF_MAP : PGEN_BUF_ARRAY;
+  size_t header_at = parser->enc_len;
+  size_t header_size = pgen_buf_header_size(parser, type, narr + nrec);
+  pgen_buf_reserve(parser, header_size);
+
+  size_t count = 0;
+  int64_t key = 1;
+  size_t j = open + 1;
+  while (j < close) {
+    if (nrec > 0 && PGEN_CAP_KIND(parser, j) == PGEN_CAP_GROUP_OPEN) {
+      size_t name_len;
+      pgen_checkstack(parser, 1);
+      lua_rawgeti(parser->L, LUA_REGISTRYINDEX, __cg_name_refs[PGEN_CAP_OPEN_AUX(parser, j)]);
+      const char *name = lua_tolstring(parser->L, -1, &name_len);
+      pgen_buf_str(parser, name, name_len);
+      lua_pop(parser->L, 1);
+      pgen_buf_group(parser, &j, NULL);
+      count++;
+    } else {
+      count += pgen_buf_item(parser, &j, -1, type == PGEN_BUF_MAP ? &key : NULL);
+    }
+  }
+
+  size_t need = pgen_buf_header_size(parser, type, count);
+  if (need != header_size) {
+    size_t body = parser->enc_len - header_at - header_size;
+    if (need > header_size) {
+      pgen_buf_reserve(parser, need - header_size);
+    } else {
+      parser->enc_len -= header_size - need;
+    }
+    memmove(parser->enc + header_at + need, parser->enc + header_at + header_size, body);
+  }
+  size_t end = parser->enc_len;
+  parser->enc_len = header_at;
+  pgen_buf_header(parser, type, count);
+  parser->enc_len = end;
+}
+
+// Encode the log item (entry or bracketed range) at *i, advancing *i past
+// it. Writes at most max of its values (all when max is -1), each preceded
+// by the integer map key *key++ when key isn't NULL. Returns the number of
+// values written.
+static int pgen_buf_item(Parser *parser, size_t *i, int max, int64_t *key) {
+  size_t at = *i;
+  switch (PGEN_CAP_KIND(parser, at)) {
+  case PGEN_CAP_STR:
+  case PGEN_CAP_INTERN:
+    if (key) pgen_buf_int(parser, (*key)++);
+    pgen_buf_str(parser, parser->input + PGEN_CAP_START(parser, at), PGEN_CAP_LEN(parser, at));
+    (*i)++;
+    return 1;
+  case PGEN_CAP_NIL:
+    if (key) pgen_buf_int(parser, (*key)++);
+    pgen_buf_nil(parser);
+    (*i)++;
+    return 1;
+  case PGEN_CAP_POS:
+    if (key) pgen_buf_int(parser, (*key)++);
+    pgen_buf_int(parser, (int64_t)PGEN_CAP_START(parser, at) + 1);
+    (*i)++;
+    return 1;
+  case PGEN_CAP_SPAN:
+    if (key) pgen_buf_int(parser, (*key)++);
+    pgen_buf_int(parser, (int64_t)PGEN_CAP_START(parser, at) + 1);
+    (*i)++;
+    if (max == 1) {
+      return 1;
+    }
+    if (key) pgen_buf_int(parser, (*key)++);
+    pgen_buf_int(parser, (int64_t)(PGEN_CAP_START(parser, at) + PGEN_CAP_LEN(parser, at)));
+    return 2;
+  case PGEN_CAP_TBL_OPEN:
+    if (key) pgen_buf_int(parser, (*key)++);
+    pgen_buf_table(parser, at);
+    *i = at + PGEN_CAP_LINK(parser, at) + 1;
+    return 1;
+  case PGEN_CAP_GROUP_OPEN:
+    pgen_buf_group(parser, i, key);
+    return 1;
+  default: {
+    // CONST, VALUE, Cnum/Cunescape and Cfn brackets: encode the Lua
+    // values they evaluate to
+    int base = parser->top;
+    int produced = pgen_cap_eval(parser, i);
+    int written = max >= 0 && produced > max ? max : produced;
+    for (int v = 0; v < written; v++) {
+      if (key) pgen_buf_int(parser, (*key)++);
+      pgen_buf_value(parser, base + 1 + v, 0);
+    }
+    lua_pop(parser->L, produced);
+    parser->top -= produced;
+    return written;
+  }
+  }
+}
+
+// Push parse_to_buffer's result for a successful parse: the top-level
+// captures (the position after the match when there are none) encoded one
+// after another into a string. Lingering Cmt values above base are dropped.
+static int pgen_buf_results(Parser *parser, int base) {
+  parser->enc_len = 0;
+  int count = 0;
+  size_t i = 0;
+  while (i < parser->cap_len) {
+    if (PGEN_CAP_KIND(parser, i) == PGEN_CAP_GROUP_OPEN) {
+      pgen_cap_skip(parser, &i);
+    } else {
+      count += pgen_buf_item(parser, &i, -1, NULL);
+    }
+  }
+  if (count == 0) {
+    pgen_buf_int(parser, (int64_t)parser->pos + 1);
+  }
+  PGEN_SETTOP(parser, base);
+  lua_pushlstring(parser->L, parser->enc, parser->enc_len);
+  return 1;
+}
+]==]
+end
+
+-- Generate the parse_events replay: walks the capture log as calls to the
+-- caller's handlers instead of building values. Tables and groups become
+-- open/field/close events; other entries are materialized one at a time.
+local function generate_event_replay()
+  return [==[
+// --- Event replay (parse_events) ---
+
+// Stack slots parse_events fills above ev_base: the handlers (nil when not
+// given) and the reused array of a batch
+enum {
+  PGEN_EV_OPEN = 1,
+  PGEN_EV_VALUE,
+  PGEN_EV_FIELD,
+  PGEN_EV_CLOSE,
+  PGEN_EV_BATCH,
+  PGEN_EV_LIST
+};
+
+// Events per handlers.batch call
+#ifndef PGEN_EV_BATCH_SIZE
+#define PGEN_EV_BATCH_SIZE 256
+#endif
+
+static const char *const pgen_ev_names[] = {NULL, "open", "value", "field", "close"};
+
+// Hand the batched events to handlers.batch(list, n)
+static void pgen_ev_flush(Parser *parser) {
+  if (parser->ev_count == 0) {
+    return;
+  }
+  lua_State *L = parser->L;
+  pgen_checkstack(parser, 3);
+  lua_pushvalue(L, parser->ev_base + PGEN_EV_BATCH);
+  lua_pushvalue(L, parser->ev_base + PGEN_EV_LIST);
+  lua_pushinteger(L, parser->ev_count);
+  parser->ev_count = 0;
+  lua_call(L, 2, 0);
+}
+
+// Deliver an event whose argument is on top of the stack (popping it):
+// appended to the batch, or passed to its handler when there is one
+static void pgen_ev_emit(Parser *parser, int event) {
+  lua_State *L = parser->L;
+  int base = parser->ev_base;
+  if (!lua_isnil(L, base + PGEN_EV_BATCH)) {
+    int n = parser->ev_count++;
+    lua_pushstring(L, pgen_ev_names[event]);
+    lua_rawseti(L, base + PGEN_EV_LIST, 2 * n + 1);
+    lua_rawseti(L, base + PGEN_EV_LIST, 2 * n + 2);
+    if (parser->ev_count == PGEN_EV_BATCH_SIZE) {
+      pgen_ev_flush(parser);
+    }
+  } else if (lua_isnil(L, base + event)) {
+    lua_pop(L, 1);
+  } else {
+    lua_pushvalue(L, base + event);
+    lua_insert(L, -2);
+    lua_call(L, 1, 0);
+  }
+}
+
+static int pgen_ev_item(Parser *parser, size_t *i, int max);
+
+// Replay the capture group opened at *i and advance *i past it: the events
+// of its first inner value, or the text it matched (as pgen_cap_eval_group)
+static void pgen_ev_group(Parser *parser, size_t *i) {
+  size_t open = *i;
+  pgen_cap_skip(parser, i);
+  size_t close = *i - 1;
+
+  size_t j = open + 1;
+  while (j < close) {
+    if (pgen_ev_item(parser, &j, 1) > 0) {
+      return;
+    }
+  }
+  size_t start = PGEN_CAP_START(parser, open);
+  pgen_checkstack(parser, 3);
+  lua_pushlstring(parser->L, parser->input + start, PGEN_CAP_START(parser, close) - start);
+  pgen_ev_emit(parser, PGEN_EV_VALUE);
+}
+
+// Replay the log item at *i, advancing *i past it, as at most max values
+// (all when max is -1); a table counts as one. Returns the number of
+// values replayed.
+static int pgen_ev_item(Parser *parser, size_t *i, int max) {
+  lua_State *L = parser->L;
+  size_t at = *i;
+  switch (PGEN_CAP_KIND(parser, at)) {
+  case PGEN_CAP_TBL_OPEN: {
+    size_t close = at + PGEN_CAP_LINK(parser, at);
+    pgen_checkstack(parser, 3);
+    lua_pushinteger(L, (lua_Integer)PGEN_CAP_START(parser, at) + 1);
+    pgen_ev_emit(parser, PGEN_EV_OPEN);
+    size_t j = at + 1;
+    while (j < close) {
+      if (PGEN_CAP_KIND(parser, j) == PGEN_CAP_GROUP_OPEN) {
+        pgen_checkstack(parser, 3);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, __cg_name_refs[PGEN_CAP_OPEN_AUX(parser, j)]);
+        pgen_ev_emit(parser, PGEN_EV_FIELD);
+        pgen_ev_group(parser, &j);
+      } else {
+        pgen_ev_item(parser, &j, -1);
+      }
+    }
+    pgen_checkstack(parser, 3);
+    lua_pushinteger(L, (lua_Integer)PGEN_CAP_START(parser, close) + 1);
+    pgen_ev_emit(parser, PGEN_EV_CLOSE);
+    *i = close + 1;
+    return 1;
+  }
+  case PGEN_CAP_GROUP_OPEN:
+    pgen_ev_group(parser, i);
+    return 1;
+  default: {
+    // everything else is replayed as the values it evaluates to
+    int base = parser->top;
+    int produced = pgen_cap_eval(parser, i);
+    int replayed = max >= 0 && produced > max ? max : produced;
+    for (int v = 0; v < replayed; v++) {
+      pgen_checkstack(parser, 3);
+      lua_pushvalue(L, base + 1 + v);
+      pgen_ev_emit(parser, PGEN_EV_VALUE);
+    }
+    lua_pop(L, produced);
+    parser->top -= produced;
+    return replayed;
+  }
+  }
+}
+
+// Replay the log of a successful parse_events parse, then push its result:
+// the position after the match. Lingering Cmt values above base are
+// dropped.
+static int pgen_ev_results(Parser *parser, int base) {
+  size_t i = 0;
+  while (i < parser->cap_len) {
+    if (PGEN_CAP_KIND(parser, i) == PGEN_CAP_GROUP_OPEN) {
+      pgen_cap_skip(parser, &i);
+    } else {
+      pgen_ev_item(parser, &i, -1);
+    }
+  }
+  pgen_ev_flush(parser);
+  PGEN_SETTOP(parser, base);
+  lua_pushinteger(parser->L, (lua_Integer)parser->pos + 1);
+  return 1;
+}
+]==]
+end
+
+-- Generate Cmt (match-time capture) infrastructure
+-- Returns C code for: static code strings, ref array, and init function
+local function generate_cmt_infrastructure(cmt_codes)
+  if #cmt_codes == 0 then
+    return ""
+  end
+
+  local lines = {}
+  table.insert(lines, "// Callback (Cmt/Cfn) infrastructure")
+  table.insert(lines, "")
+
+  -- Generate static code strings
+  for _, cmt in ipairs(cmt_codes) do
+    table.insert(lines, template_code(
+      "static const char __cmt_code_$ID$[] = $CODE_STR$;",
+      {ID = cmt.id, CODE_STR = escape_c_literal(cmt.code)}
+    ))
+  end
+
+  -- Generate refs array
+  table.insert(lines, "")
+  table.insert(lines, template_code("static int __cmt_refs[$COUNT$];", {COUNT = #cmt_codes}))
+
+  -- Generate init function
+  table.insert(lines, "")
+  table.insert(lines, [[// Initialize callbacks by loading their Lua code
+static void __cmt_init(lua_State *L) {]])
+
+  for _, cmt in ipairs(cmt_codes) do
+    if cmt.kind == "cfn" then
+      -- Cfn: the chunk runs once at load and must return the callback
+      table.insert(lines, template_code([[  if (luaL_loadstring(L, __cmt_code_$ID$) != 0) {
+    luaL_error(L, "Failed to load Cfn callback $ID$: %s", lua_tostring(L, -1));
+  }
+  if (lua_pcall(L, 0, 1, 0) != 0) {
+    luaL_error(L, "Failed to run Cfn chunk $ID$: %s", lua_tostring(L, -1));
+  }
+  if (!lua_isfunction(L, -1)) {
+    luaL_error(L, "Cfn chunk $ID$ did not return a function");
+  }
+  __cmt_refs[$ID$] = luaL_ref(L, LUA_REGISTRYINDEX);]], {ID = cmt.id}))
+    else
+      table.insert(lines, template_code([[  if (luaL_loadstring(L, __cmt_code_$ID$) != 0) {
+    luaL_error(L, "Failed to load Cmt callback $ID$: %s", lua_tostring(L, -1));
+  }
+  __cmt_refs[$ID$] = luaL_ref(L, LUA_REGISTRYINDEX);]], {ID = cmt.id}))
+    end
+  end
+
   table.insert(lines, "}")
   table.insert(lines, "")
 
@@ -594,7 +1775,7 @@ static void pgen_ind_trail_record(Parser *parser, int stack_id, int op, int valu
     size_t new_cap = parser->trail_cap == 0 ? 64 : parser->trail_cap * 2;
     PgenTrailEntry *trail = (PgenTrailEntry*)realloc(parser->trail, new_cap * sizeof(PgenTrailEntry));
     if (!trail) {
-      luaL_error(parser->L, "pgen: out of memory growing indenter trail");
+      PGEN_FATAL(parser, "pgen: out of memory growing indenter trail");
     }
     parser->trail = trail;
     parser->trail_cap = new_cap;
@@ -611,7 +1792,7 @@ static void pgen_ind_push(Parser *parser, int stack_id, int value) {
     int new_cap = s->cap * 2;
     int *items = (int*)realloc(s->items, new_cap * sizeof(int));
     if (!items) {
-      luaL_error(parser->L, "pgen: out of memory growing indenter stack");
+      PGEN_FATAL(parser, "pgen: out of memory growing indenter stack");
     }
     s->items = items;
     s->cap = new_cap;
@@ -648,6 +1829,9 @@ static int pgen_ind_measure(Parser *parser, size_t *end_pos, int tab_width) {
     }
     p++;
   }
+  if (p == parser->input_len) {
+    pgen_starve(parser, p + 1);  // the run may continue past the fed data
+  }
   *end_pos = p;
   return width;
 }
@@ -671,68 +1855,399 @@ static int pgen_ind_measure(Parser *parser, size_t *end_pos, int tab_width) {
   }
 end
 
--- Generate parser header
-function generator.generate_parser_header(parser_name, cg_names, cmt_codes, indenters, const_pool, memo_count)
-  cg_names = cg_names or {}
-  indenters = indenters or {}
-  memo_count = memo_count or 0
-
-  local header_vars = generate_indenter_header_vars(indenters)
-  header_vars.PARSER_NAME = parser_name
-
-  if memo_count > 0 then
-    header_vars.MEMO_TYPES = template_code([[// Single-slot memo for position-pure rules: pos is the memoized input
-// position + 1 (0 = empty slot), endpos the resulting position or
-// (size_t)-1 for failure
-#define PGEN_MEMO_COUNT $COUNT$
-typedef struct {
-  size_t pos;
-  size_t endpos;
-} PgenMemoSlot;
-
-]], {COUNT = memo_count})
-    header_vars.MEMO_FIELD = "\n  PgenMemoSlot memo[PGEN_MEMO_COUNT];"
-  else
-    header_vars.MEMO_TYPES = ""
-    header_vars.MEMO_FIELD = ""
-  end
-
-  return template_code([[#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdbool.h>
-#include <lua.h>
+-- Parser header pieces that differ between the Lua module (below) and the
+-- standalone c-api target (c_api_header_vars)
+local LUA_HEADER_VARS = {
+  INCLUDES = [[#include <lua.h>
 #include <lauxlib.h>
-#include <lualib.h>
-#include <assert.h>
+#include <lualib.h>]],
+  CONST_AUX = "registry ref of an interned constant",
+  STACK_FIELDS = [[
 
-// $PARSER_NAME$ - generated parser
-
-// Maximum rule-call recursion depth before the parse is aborted with a Lua
-// error (prevents C stack overflow on deeply nested input). Override with
-// the max_depth compile option or -DPGEN_MAX_DEPTH=n
-#ifndef PGEN_MAX_DEPTH
-#define PGEN_MAX_DEPTH 5000
-#endif
+  int top;                  // Shadow of lua_gettop(L), exact between patterns
+  int stack_claimed;        // Stack index secured so far via lua_checkstack
+  int lazy_anchor;          // Stack index of the parse_lazy document anchor
+                            // while evaluating for one, else 0
+  bool lazy_tables;         // Evaluate table captures to parse_lazy proxies]],
+  RUNTIME_FIELDS = [[
+
+  lua_State *L;
+  int subject_idx;          // Stack index of the input as a Lua string,
+                            // passed to Cmt
+  bool busy;                // Handle is mid-parse (guards re-entrant use)
+  size_t trim;              // Handle high-water limit in entries, 0 = none
+  char *stream;             // Streaming: input fed; what's past stream_off
+  size_t stream_off;        // isn't consumed yet
+  size_t stream_len;
+  size_t stream_cap;
+  size_t stream_need;       // Streaming: unconsumed length the next partial
+                            // attempt waits for (see stream_run)
+  char *enc;                // parse_to_buffer output, grown as it's written
+  size_t enc_len;
+  size_t enc_cap;
+  int enc_format;           // PGEN_BUF_* during parse_to_buffer, else 0
+  int ev_base;              // parse_events: stack index below the handler
+                            // slots, else 0
+  int ev_count;             // parse_events: events in the pending batch
+  int commit_fn;            // parse_stream: stack index of the consumer,
+                            // else 0]],
+  STACK_PP_FIELD = "\n  int stack_size;",
+  FATAL = [[// Abort the parse with a Lua error
+#define PGEN_FATAL(parser, ...) luaL_error((parser)->L, __VA_ARGS__)
+]],
+  SETTOP = [[// Set the Lua stack top, keeping the parser's shadow copy in sync. Any
+// batched lua_checkstack claim beyond what survives GC stack shrinking is
+// forfeited: capacity may shrink to twice the in-use size, but never below
+// the runtime's minimum allocation (conservatively PGEN_STACK_FLOOR).
+#define PGEN_SETTOP(parser, n) \
+  do { \
+    int pgen_newtop_ = (n); \
+    lua_settop((parser)->L, pgen_newtop_); \
+    (parser)->top = pgen_newtop_; \
+    int pgen_keep_ = 2 * pgen_newtop_; \
+    if (pgen_keep_ < PGEN_STACK_FLOOR) pgen_keep_ = PGEN_STACK_FLOOR; \
+    if ((parser)->stack_claimed > pgen_keep_) \
+      (parser)->stack_claimed = pgen_keep_; \
+  } while (0)
 
-// --- Capture log ---
-// Captures are recorded as log entries during matching and only materialized
-// into Lua values after the whole parse succeeds. Backtracking rewinds the
-// log length, so discarded speculative captures never touch the Lua runtime.
+]],
+  -- these extend the line-continuation macros, so they must supply their
+  -- own leading " \" on the previous line
+  STACK_REMEMBER = " \\\n  (pp).stack_size = (parser)->top;",
+  STACK_RESTORE = " \\\n  PGEN_SETTOP(parser, (pp).stack_size);",
+  CHECKSTACK = [[// Ensure the Lua stack can hold n more values. Captures are built on the Lua
+// stack, so without this a large parse tree would overflow it (undefined
+// behavior). Raises a Lua error when the stack cannot grow any further
+// (LUAI_MAXCSTACK).
+//
+// Claims are batched so most calls are a single comparison against the
+// shadow top. Batch size is limited to what survives GC stack shrinking:
+// PUC Lua honors lua_checkstack claims for the frame's lifetime, but
+// LuaJIT's GC may shrink capacity to twice the in-use size (never below
+// its minimum allocation, conservatively PGEN_STACK_FLOOR). Claims above
+// released stack space are forfeited by PGEN_SETTOP.
+#define PGEN_STACK_BATCH 64
+#define PGEN_STACK_FLOOR 32
+
+static void pgen_checkstack_slow(Parser *parser, int n) {
+  int batch = parser->top - n;                       // survives 2x-used shrink
+  int floor_batch = PGEN_STACK_FLOOR - (parser->top + n); // under shrink floor
+  if (floor_batch > batch) batch = floor_batch;
+  if (batch > PGEN_STACK_BATCH) batch = PGEN_STACK_BATCH;
+  if (batch < 0) batch = 0;
+  if (lua_checkstack(parser->L, n + batch)) {
+    parser->stack_claimed = parser->top + n + batch;
+  } else if (lua_checkstack(parser->L, n)) {
+    // Batched request exceeded the stack limit; the exact one still fits
+    parser->stack_claimed = parser->top + n;
+  } else {
+    luaL_error(parser->L, "pgen: Lua stack overflow while building captures");
+  }
+}
+
+// Fast path: one comparison against the already-claimed capacity. n may be
+// evaluated twice, so call sites must pass side-effect-free expressions.
+#define pgen_checkstack(parser, n) \
+  do { \
+    if ((parser)->top + (n) > (parser)->stack_claimed) \
+      pgen_checkstack_slow(parser, n); \
+  } while (0)
+]],
+  MATCH_BACK_CONST = [[        } else if (PGEN_CAP_KIND(parser, inner) == PGEN_CAP_CONST) {
+          // interned constant: compare through the materialized value
+          bool matched = false;
+          pgen_checkstack(parser, 1);
+          lua_rawgeti(parser->L, LUA_REGISTRYINDEX, PGEN_CAP_AUX(parser, inner));
+          if (lua_type(parser->L, -1) == LUA_TSTRING) {
+            size_t const_len;
+            const char *const_str = lua_tolstring(parser->L, -1, &const_len);
+            matched = PGEN_AVAIL(parser, const_len) &&
+                memcmp(parser->input + parser->pos, const_str, const_len) == 0;
+            if (matched) parser->pos += const_len;
+          }
+          lua_pop(parser->L, 1);
+          return matched;
+]],
+  DEBUG_HELPERS = [[#ifdef PGEN_DEBUG
+static void dumpstack (lua_State *L) {
+  int top=lua_gettop(L);
+  for (int i=1; i <= top; i++) {
+    printf("%d\t%s\t", i, luaL_typename(L,i));
+    switch (lua_type(L, i)) {
+      case LUA_TNUMBER:
+        printf("%g\n",lua_tonumber(L,i));
+        break;
+      case LUA_TSTRING:
+        printf("%s\n",lua_tostring(L,i));
+        break;
+      case LUA_TBOOLEAN:
+        printf("%s\n", (lua_toboolean(L, i) ? "true" : "false"));
+        break;
+      case LUA_TNIL:
+        printf("%s\n", "nil");
+        break;
+      default:
+        printf("%p\n",lua_topointer(L,i));
+        break;
+    }
+  }
+}
+#endif
+]]
+}
+
+local function c_api_header_vars(parser_name)
+  return {
+    INCLUDES = "#include <stdarg.h>\n#include <setjmp.h>",
+    CONST_AUX = parser_name .. "_constants index",
+    STACK_FIELDS = "",
+    RUNTIME_FIELDS = template_code([[
+
+  jmp_buf *fatal;           // Unwinds to $PARSER_NAME$_parse on fatal errors]], {PARSER_NAME = parser_name}),
+    STACK_PP_FIELD = "",
+    FATAL = template_code([[// Abort the parse: the message is left in error_message for
+// $PARSER_NAME$_parse to report
+static void pgen_fatal(Parser *parser, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(parser->error_message, sizeof(parser->error_message), fmt, args);
+  va_end(args);
+  longjmp(*parser->fatal, 1);
+}
+#define PGEN_FATAL pgen_fatal
+]], {PARSER_NAME = parser_name}),
+    SETTOP = "",
+    STACK_REMEMBER = "",
+    STACK_RESTORE = "",
+    CHECKSTACK = "",
+    MATCH_BACK_CONST = template_code([[        } else if (PGEN_CAP_KIND(parser, inner) == PGEN_CAP_CONST) {
+          // constant: compare against its string value
+          const $PARSER_NAME$_constant *c = &$PARSER_NAME$_constants[PGEN_CAP_AUX(parser, inner)];
+          if (c->type != $UPPER_NAME$_CONST_STRING) {
+            return false;
+          }
+          text = c->str;
+          text_len = c->len;
+]], {PARSER_NAME = parser_name, UPPER_NAME = parser_name:upper()}),
+    DEBUG_HELPERS = ""
+  }
+end
+
+-- With c_api set, the header is generated for the c-api target: no Lua
+-- headers, the capture log is unpacked into public PARSER_capture entries,
+-- fatal errors longjmp out of PARSER_parse, and there is no Lua stack to
+-- track. memo describes the memoized rules (see generator.generate); with
+-- memo.packrat, position-pure rules get a slot per input position instead
+-- of a single slot (the memo = "packrat" compile option).
+function generator.generate_parser_header(parser_name, cg_names, cmt_codes, indenters, const_pool, memo, c_api)
+  cg_names = cg_names or {}
+  indenters = indenters or {}
+  memo = memo or {count = 0, replay_count = 0}
+  local memo_count = memo.count
+
+  local header_vars = generate_indenter_header_vars(indenters)
+  header_vars.PARSER_NAME = parser_name
+  if c_api then
+    for k, v in pairs(c_api_header_vars(parser_name)) do
+      header_vars[k] = v
+    end
+  else
+    for k, v in pairs(LUA_HEADER_VARS) do
+      header_vars[k] = v
+    end
+  end
+
+  header_vars.MEMO_HELPERS = ""
+  if memo_count > 0 and memo.packrat then
+    header_vars.MEMO_TYPES = template_code([[// Packrat memo for position-pure rules: one table of memo_size slots per
+// rule, indexed by input position modulo memo_size (a power of two). A slot
+// holds the memoized position tagged with its parse (memo_base + position;
+// 0 = empty) and the resulting position or (size_t)-1 for failure. Tables
+// are sized to cover the parse window, which makes the memoized rules
+// linear time, as long as all of them fit in PGEN_MEMO_LIMIT bytes; past
+// that, positions memo_size apart share a slot.
+#define PGEN_MEMO_COUNT $COUNT$
+#ifndef PGEN_MEMO_LIMIT
+#define PGEN_MEMO_LIMIT (64 * 1024 * 1024)
+#endif
+#define PGEN_MEMO_PREPARE(parser) pgen_memo_prepare(parser)
+typedef struct {
+  size_t pos;
+  size_t endpos;
+} PgenMemoSlot;
+
+]], {COUNT = memo_count})
+    header_vars.MEMO_FIELD = [[
+
+  PgenMemoSlot *memo;       // Packrat memo tables, memo_size slots each
+  size_t memo_size;
+  size_t memo_cap;          // Slots allocated across all tables
+  size_t memo_base;         // Tag of this parse's slots, added to positions
+  size_t memo_next;         // memo_base of the next parse]]
+    header_vars.MEMO_HELPERS = [[// Size the packrat memo tables for the parse window (the smallest power of
+// two past its length, within PGEN_MEMO_LIMIT) and start a new tag. Tags
+// of later parses are past every tag of earlier ones, so their slots never
+// match and the tables aren't cleared between parses: only newly allocated
+// slots are, and all of them when the tags wrap around.
+static void pgen_memo_prepare(Parser *parser) {
+  size_t window = parser->input_len - parser->pos;
+  size_t limit = PGEN_MEMO_LIMIT / (PGEN_MEMO_COUNT * sizeof(PgenMemoSlot));
+  size_t size = 1;
+  while (size <= window && size * 2 <= limit) {
+    size *= 2;
+  }
+  size_t slots = size * PGEN_MEMO_COUNT;
+  if (slots > parser->memo_cap) {
+    PgenMemoSlot *memo = (PgenMemoSlot*)realloc(parser->memo, slots * sizeof(PgenMemoSlot));
+    if (!memo) {
+      PGEN_FATAL(parser, "pgen: out of memory allocating memo tables");
+    }
+    memset(memo + parser->memo_cap, 0, (slots - parser->memo_cap) * sizeof(PgenMemoSlot));
+    parser->memo = memo;
+    parser->memo_cap = slots;
+  }
+  parser->memo_size = size;
+  if (parser->memo_next > SIZE_MAX - parser->input_len - 1) {
+    memset(parser->memo, 0, parser->memo_cap * sizeof(PgenMemoSlot));
+    parser->memo_next = 1;
+  }
+  parser->memo_base = parser->memo_next;
+  parser->memo_next = parser->memo_base + parser->input_len + 1;
+}
+
+]]
+  elseif memo_count > 0 then
+    header_vars.MEMO_TYPES = template_code([[// Single-slot memo for position-pure rules: pos is the memoized input
+// position + 1 (0 = empty slot), endpos the resulting position or
+// (size_t)-1 for failure
+#define PGEN_MEMO_COUNT $COUNT$
+#define PGEN_MEMO_PREPARE(parser) ((void)0)
+typedef struct {
+  size_t pos;
+  size_t endpos;
+} PgenMemoSlot;
+
+]], {COUNT = memo_count})
+    header_vars.MEMO_FIELD = "\n  PgenMemoSlot memo[PGEN_MEMO_COUNT];"
+  else
+    header_vars.MEMO_TYPES = "#define PGEN_MEMO_PREPARE(parser) ((void)0)\n\n"
+    header_vars.MEMO_FIELD = ""
+  end
+
+  if memo.replay_count > 0 then
+    header_vars.MEMO_TYPES = header_vars.MEMO_TYPES .. template_code([[// Capture-replay memo for rules whose only state is the capture log
+// entries they append: a single slot per rule holding the result at one
+// position and a copy of the appended entries (at most PGEN_MEMO_CAPS,
+// the memo_caps compile option), which a hit splices back into the log
+#define PGEN_REPLAY_COUNT $COUNT$
+#ifndef PGEN_MEMO_CAPS
+#define PGEN_MEMO_CAPS 64
+#endif
+typedef struct {
+  size_t pos;               // memoized position + 1, 0 = empty slot
+  size_t endpos;            // resulting position, (size_t)-1 for failure
+  size_t cap_count;         // entries saved at index id * PGEN_MEMO_CAPS of
+                            // the replay_* arrays
+} PgenReplaySlot;
+
+]], {COUNT = memo.replay_count})
+    header_vars.MEMO_FIELD = header_vars.MEMO_FIELD .. [[
+
+  PgenReplaySlot replay[PGEN_REPLAY_COUNT];
+  void *replay_starts;        // Capture-replay memo entries, laid out like
+  void *replay_data;          // the capture log (replay_starts owns the
+                              // shared allocation, sized for 64-bit offsets)
+  unsigned char *replay_kinds;]]
+    header_vars.MEMO_HELPERS = header_vars.MEMO_HELPERS .. [[// Record the outcome of capture-replay rule id, called at start with the
+// log at base: the entries it appended are saved with a successful result.
+// A segment too long to save leaves the slot as it was.
+static void pgen_replay_store(Parser *parser, int id, size_t start, size_t base) {
+  PgenReplaySlot *slot = &parser->replay[id];
+  size_t count = parser->success ? parser->cap_len - base : 0;
+  if (count > PGEN_MEMO_CAPS) {
+    return;
+  }
+  size_t at = (size_t)id * PGEN_MEMO_CAPS;
+  memcpy(PGEN_OFF_AT(parser, parser->replay_starts, at), PGEN_OFF_AT(parser, parser->cap_starts, base), count * PGEN_OFF_SIZE(parser));
+  memcpy(PGEN_OFF_AT(parser, parser->replay_data, at), PGEN_OFF_AT(parser, parser->cap_data, base), count * PGEN_OFF_SIZE(parser));
+  memcpy(parser->replay_kinds + at, parser->cap_kinds + base, count);
+  slot->pos = start + 1;
+  slot->endpos = parser->success ? parser->pos : (size_t)-1;
+  slot->cap_count = count;
+}
+
+// Replay the memoized match of capture-replay rule id: append its saved
+// entries to the log and move to its end position
+static void pgen_replay(Parser *parser, int id) {
+  PgenReplaySlot *slot = &parser->replay[id];
+  while (parser->cap_len + slot->cap_count > parser->cap_cap) {
+    pgen_cap_grow(parser);
+  }
+  size_t at = (size_t)id * PGEN_MEMO_CAPS;
+  memcpy(PGEN_OFF_AT(parser, parser->cap_starts, parser->cap_len), PGEN_OFF_AT(parser, parser->replay_starts, at), slot->cap_count * PGEN_OFF_SIZE(parser));
+  memcpy(PGEN_OFF_AT(parser, parser->cap_data, parser->cap_len), PGEN_OFF_AT(parser, parser->replay_data, at), slot->cap_count * PGEN_OFF_SIZE(parser));
+  memcpy(parser->cap_kinds + parser->cap_len, parser->replay_kinds + at, slot->cap_count);
+  parser->cap_len += slot->cap_count;
+  parser->pos = slot->endpos;
+}
+
+]]
+  end
+
+  local header = template_code([[#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <locale.h>
+$INCLUDES$
+#include <assert.h>
+
+// $PARSER_NAME$ - generated parser
+
+// Maximum rule-call recursion depth before the parse is aborted with a
+// fatal error (prevents C stack overflow on deeply nested input). Override
+// with the max_depth compile option or -DPGEN_MAX_DEPTH=n
+#ifndef PGEN_MAX_DEPTH
+#define PGEN_MAX_DEPTH 5000
+#endif
+
+// --- Capture log ---
+// Captures are recorded as log entries during matching and only materialized
+// into Lua values after the whole parse succeeds. Backtracking rewinds the
+// log length, so discarded speculative captures never touch the Lua runtime.
 // The exception is Cmt: its callback runs mid-parse and its extra return
 // values live on the Lua stack, referenced by PGEN_CAP_VALUE entries.
+// Bracket entries carry the input position they were pushed at in start.
+// The log is stored as parallel arrays (kinds, starts, data) so the scans
+// that only look at kinds touch one byte per entry; data holds len for STR
+// entries and aux for the rest, since no kind uses both. Bracket pairs link
+// their entries through data instead: when the CLOSE is pushed, the OPEN's
+// data gets their distance apart, so skips jump over whole subtrees, and a
+// pair's aux moves to the CLOSE. Tables have no aux, so a TBL_CLOSE holds
+// the distance as well and backward scans jump over tables too. The
+// distance is relative, so it survives moving the pair (pgen_cap_select,
+// capture replay, pgen_cap_wrap).
 enum {
   PGEN_CAP_STR,         // start/len: slice of the input
-  PGEN_CAP_CONST,       // aux: registry ref of an interned constant
+  PGEN_CAP_CONST,       // aux: $CONST_AUX$
   PGEN_CAP_NIL,
   PGEN_CAP_POS,         // start: input position
   PGEN_CAP_VALUE,       // aux: absolute Lua stack index (Cmt results)
-  PGEN_CAP_TBL_OPEN,    // Ct brackets
+  PGEN_CAP_TBL_OPEN,    // Ct brackets; start: input position
   PGEN_CAP_TBL_CLOSE,
-  PGEN_CAP_GROUP_OPEN,  // Cg brackets; aux: name index, start: input position
+  PGEN_CAP_GROUP_OPEN,  // Cg brackets; aux (CLOSE): name index, start: pos
   PGEN_CAP_GROUP_CLOSE,
-  PGEN_CAP_FN_OPEN,     // Cfn brackets; aux: callback registry ref, start: pos
-  PGEN_CAP_FN_CLOSE
+  PGEN_CAP_FN_OPEN,     // Cfn brackets; aux (CLOSE): callback registry ref,
+  PGEN_CAP_FN_CLOSE,    // start: pos
+  PGEN_CAP_SPAN,        // start/len as STR, materialized as two positions
+  PGEN_CAP_INTERN,      // start/len as STR, materialized through the
+                        // intern cache
+  PGEN_CAP_NUM,         // start/len as STR, materialized as a number (Cnum)
+  PGEN_CAP_JSON_STR,    // start/len as STR, materialized with JSON escapes
+                        // decoded (Cunescape)
+  PGEN_CAP_LUA_STR      // start/len as STR, materialized with Lua escapes
+                        // decoded
 };
 
 // Bracket kind tests: OPEN kinds and their CLOSE kinds are laid out in
@@ -742,67 +2257,84 @@ enum {
 #define PGEN_CAP_IS_CLOSE(k) \
   ((k) == PGEN_CAP_TBL_CLOSE || (k) == PGEN_CAP_GROUP_CLOSE || (k) == PGEN_CAP_FN_CLOSE)
 
-typedef struct {
-  int kind;
-  int aux;
-  size_t start;
-  size_t len;
-} PgenCap;
+// Capture log offsets are 32-bit, halving the log's footprint, unless the
+// subject is 4 GiB or longer: _reset then switches the log to 64-bit
+// offsets for that parse (parser->cap_wide). All access to the offset
+// arrays goes through these macros. Parsers compiled with
+// -DPGEN_CAP_OFFSET64 always use 64-bit offsets.
+#ifdef PGEN_CAP_OFFSET64
+#define PGEN_CAP_WIDE(parser) 1
+#else
+#define PGEN_CAP_WIDE(parser) ((parser)->cap_wide)
+#endif
+#define PGEN_OFF_SIZE(parser) (PGEN_CAP_WIDE(parser) ? sizeof(uint64_t) : sizeof(uint32_t))
+#define PGEN_OFF_GET(parser, arr, i) \
+  (PGEN_CAP_WIDE(parser) ? (size_t)((const uint64_t*)(arr))[i] : (size_t)((const uint32_t*)(arr))[i])
+#define PGEN_OFF_SET(parser, arr, i, v) \
+  do { \
+    if (PGEN_CAP_WIDE(parser)) ((uint64_t*)(arr))[i] = (uint64_t)(v); \
+    else ((uint32_t*)(arr))[i] = (uint32_t)(v); \
+  } while (0)
+// Address of entry i of an offset array, for bulk copies
+#define PGEN_OFF_AT(parser, arr, i) ((char*)(arr) + (size_t)(i) * PGEN_OFF_SIZE(parser))
+
+// Bytes per log entry across the three arrays, at the parse's width and at
+// the widest
+#define PGEN_CAP_ENTRY_SIZE(parser) (2 * PGEN_OFF_SIZE(parser) + 1)
+#define PGEN_CAP_ENTRY_MAX (2 * sizeof(uint64_t) + 1)
+
+#define PGEN_CAP_KIND(parser, i) ((int)(parser)->cap_kinds[i])
+#define PGEN_CAP_START(parser, i) PGEN_OFF_GET(parser, (parser)->cap_starts, i)
+#define PGEN_CAP_LEN(parser, i) PGEN_OFF_GET(parser, (parser)->cap_data, i)
+#define PGEN_CAP_AUX(parser, i) ((int)PGEN_OFF_GET(parser, (parser)->cap_data, i))
+// Distance from a closed OPEN entry to its CLOSE, or from a TBL_CLOSE back
+// to its OPEN
+#define PGEN_CAP_LINK(parser, i) PGEN_OFF_GET(parser, (parser)->cap_data, i)
+// The aux of the bracket pair opened at index open
+#define PGEN_CAP_OPEN_AUX(parser, open) PGEN_CAP_AUX(parser, (open) + PGEN_CAP_LINK(parser, open))
 
 $MEMO_TYPES$$IND_TYPES$typedef struct {
   const char *input;
-  size_t input_len;
+  size_t input_len;         // End of the parse window (exclusive)
+  size_t subject_len;       // Length of the whole subject, passed to Cmt
+  bool partial;             // Streaming: input_len is only the end of the data fed so far
+  size_t starved;           // Streaming: 0, or the shortest input a check that
+                            // looked past the data fed so far can decide on
   size_t pos;
   bool success;
   char error_message[256];
   const char *throw_label;  // Label from T() or NULL for ordinary failure
   size_t throw_pos;         // Position where T() was thrown
   size_t furthest_fail;     // Furthest position where a match attempt failed
-  size_t depth;
-  int top;                  // Shadow of lua_gettop(L), exact between patterns
-  int stack_claimed;        // Stack index secured so far via lua_checkstack
-  PgenCap *caps;            // Capture log
+  size_t depth;$STACK_FIELDS$
+  void *cap_starts;         // Capture log: entry positions (owns the
+                            // allocation shared by the three arrays)
+  void *cap_data;           // STR length, aux value or bracket link per entry
+  unsigned char *cap_kinds; // PGEN_CAP_* per entry
   size_t cap_len;
-  size_t cap_cap;$MEMO_FIELD$
-  lua_State *L;$IND_PARSER_FIELDS$
+  size_t cap_cap;
+  bool cap_wide;            // The offset arrays hold uint64_t, not uint32_t$MEMO_FIELD$$RUNTIME_FIELDS$$IND_PARSER_FIELDS$
 } Parser;
 
 typedef struct {
   size_t pos;
-  size_t cap_len;
-  int stack_size;$IND_PP_FIELD$
+  size_t cap_len;$STACK_PP_FIELD$$IND_PP_FIELD$
 } ParserPosition;
 
 typedef struct {
   size_t pos;
 } ParserInputPosition;
 
-// Set the Lua stack top, keeping the parser's shadow copy in sync. Any
-// batched lua_checkstack claim beyond what survives GC stack shrinking is
-// forfeited: capacity may shrink to twice the in-use size, but never below
-// the runtime's minimum allocation (conservatively PGEN_STACK_FLOOR).
-#define PGEN_SETTOP(parser, n) \
-  do { \
-    int pgen_newtop_ = (n); \
-    lua_settop((parser)->L, pgen_newtop_); \
-    (parser)->top = pgen_newtop_; \
-    int pgen_keep_ = 2 * pgen_newtop_; \
-    if (pgen_keep_ < PGEN_STACK_FLOOR) pgen_keep_ = PGEN_STACK_FLOOR; \
-    if ((parser)->stack_claimed > pgen_keep_) \
-      (parser)->stack_claimed = pgen_keep_; \
-  } while (0)
-
-#define REMEMBER_POSITION(parser, pp) \
+$FATAL$
+$SETTOP$#define REMEMBER_POSITION(parser, pp) \
   ParserPosition pp; \
   (pp).pos = (parser)->pos; \
-  (pp).cap_len = (parser)->cap_len; \
-  (pp).stack_size = (parser)->top;$IND_REMEMBER$
+  (pp).cap_len = (parser)->cap_len;$STACK_REMEMBER$$IND_REMEMBER$
 
 // Restore parser position
 #define RESTORE_POSITION(parser, pp) \
   (parser)->pos = (pp).pos; \
-  (parser)->cap_len = (pp).cap_len; \
-  PGEN_SETTOP(parser, (pp).stack_size);$IND_RESTORE$
+  (parser)->cap_len = (pp).cap_len;$STACK_RESTORE$$IND_RESTORE$
 
 #define REMEMBER_INPUT_POSITION(parser, pp) \
   ParserInputPosition pp; \
@@ -835,90 +2367,109 @@ typedef struct {
   } while (0)
 #endif
 
-// Ensure the Lua stack can hold n more values. Captures are built on the Lua
-// stack, so without this a large parse tree would overflow it (undefined
-// behavior). Raises a Lua error when the stack cannot grow any further
-// (LUAI_MAXCSTACK).
-//
-// Claims are batched so most calls are a single comparison against the
-// shadow top. Batch size is limited to what survives GC stack shrinking:
-// PUC Lua honors lua_checkstack claims for the frame's lifetime, but
-// LuaJIT's GC may shrink capacity to twice the in-use size (never below
-// its minimum allocation, conservatively PGEN_STACK_FLOOR). Claims above
-// released stack space are forfeited by PGEN_SETTOP.
-#define PGEN_STACK_BATCH 64
-#define PGEN_STACK_FLOOR 32
-
-static void pgen_checkstack_slow(Parser *parser, int n) {
-  int batch = parser->top - n;                       // survives 2x-used shrink
-  int floor_batch = PGEN_STACK_FLOOR - (parser->top + n); // under shrink floor
-  if (floor_batch > batch) batch = floor_batch;
-  if (batch > PGEN_STACK_BATCH) batch = PGEN_STACK_BATCH;
-  if (batch < 0) batch = 0;
-  if (lua_checkstack(parser->L, n + batch)) {
-    parser->stack_claimed = parser->top + n + batch;
-  } else if (lua_checkstack(parser->L, n)) {
-    // Batched request exceeded the stack limit; the exact one still fits
-    parser->stack_claimed = parser->top + n;
-  } else {
-    luaL_error(parser->L, "pgen: Lua stack overflow while building captures");
+// Mark a streaming parse (handle:feed) starved by a check that needs need
+// bytes of input to decide: the end of the window is only the end of the
+// data fed so far, so the outcome may change once that much has arrived.
+// The earliest such length over the attempt is kept; nothing fed short of
+// it can change the outcome.
+static inline void pgen_starve(Parser *parser, size_t need) {
+  if (parser->partial && (!parser->starved || need < parser->starved)) {
+    parser->starved = need;
   }
 }
 
-// Fast path: one comparison against the already-claimed capacity. n may be
-// evaluated twice, so call sites must pass side-effect-free expressions.
-#define pgen_checkstack(parser, n) \
-  do { \
-    if ((parser)->top + (n) > (parser)->stack_claimed) \
-      pgen_checkstack_slow(parser, n); \
-  } while (0)
+// Whether n more bytes can be read at the current position. A failed check
+// marks a streaming parse starved.
+#define PGEN_AVAIL(parser, n) \
+  ((parser)->pos + (n) <= (parser)->input_len || \
+   (pgen_starve(parser, (parser)->pos + (n)), false))
+
+// Unaligned loads for comparing short literals a word at a time. Loading
+// the literal side through the same function keeps the comparison
+// independent of byte order; compilers fold it to a constant.
+static inline uint16_t pgen_load16(const void *p) { uint16_t v; memcpy(&v, p, 2); return v; }
+static inline uint32_t pgen_load32(const void *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint64_t pgen_load64(const void *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+
+$CHECKSTACK$
+// Move the log to a new allocation of new_cap entries, keeping the first
+// min(cap_len, new_cap) of them. The three arrays share one block, so a
+// failed allocation leaves the log untouched.
+static bool pgen_cap_resize(Parser *parser, size_t new_cap) {
+  char *starts = (char*)malloc(new_cap * PGEN_CAP_ENTRY_SIZE(parser));
+  if (!starts) {
+    return false;
+  }
+  char *data = PGEN_OFF_AT(parser, starts, new_cap);
+  unsigned char *kinds = (unsigned char*)PGEN_OFF_AT(parser, data, new_cap);
+  size_t keep = parser->cap_len < new_cap ? parser->cap_len : new_cap;
+  if (keep > 0) {
+    memcpy(starts, parser->cap_starts, keep * PGEN_OFF_SIZE(parser));
+    memcpy(data, parser->cap_data, keep * PGEN_OFF_SIZE(parser));
+    memcpy(kinds, parser->cap_kinds, keep);
+  }
+  free(parser->cap_starts);
+  parser->cap_starts = starts;
+  parser->cap_data = data;
+  parser->cap_kinds = kinds;
+  parser->cap_cap = new_cap;
+  return true;
+}
 
 static void pgen_cap_grow(Parser *parser) {
-  size_t new_cap = parser->cap_cap * 2;
-  PgenCap *caps = (PgenCap*)realloc(parser->caps, new_cap * sizeof(PgenCap));
-  if (!caps) {
-    luaL_error(parser->L, "pgen: out of memory growing capture log");
+  if (!pgen_cap_resize(parser, parser->cap_cap * 2)) {
+    PGEN_FATAL(parser, "pgen: out of memory growing capture log");
   }
-  parser->caps = caps;
-  parser->cap_cap = new_cap;
 }
 
-// Append one log entry. A macro so the hot path (bounds check + four
+// Append one log entry: data is the length for STR entries and the aux
+// value for every other kind. A macro so the hot path (bounds check + three
 // stores) inlines into every capture site; arguments may be evaluated
 // twice, so call sites must pass side-effect-free expressions.
-#define pgen_cap_push(parser, k, a, s, l) \
+#define pgen_cap_push(parser, k, s, d) \
   do { \
     if ((parser)->cap_len == (parser)->cap_cap) pgen_cap_grow(parser); \
-    PgenCap *pgen_cap_ = &(parser)->caps[(parser)->cap_len++]; \
-    pgen_cap_->kind = (k); \
-    pgen_cap_->aux = (a); \
-    pgen_cap_->start = (s); \
-    pgen_cap_->len = (l); \
+    (parser)->cap_kinds[(parser)->cap_len] = (unsigned char)(k); \
+    PGEN_OFF_SET(parser, (parser)->cap_starts, (parser)->cap_len, s); \
+    PGEN_OFF_SET(parser, (parser)->cap_data, (parser)->cap_len, d); \
+    (parser)->cap_len++; \
+  } while (0)
+
+// Append the CLOSE entry of the bracket opened at index open, carrying the
+// pair's aux, and link the OPEN to it
+#define pgen_cap_push_close(parser, k, open, s, aux) \
+  do { \
+    pgen_cap_push(parser, k, s, aux); \
+    PGEN_OFF_SET(parser, (parser)->cap_data, open, (parser)->cap_len - 1 - (open)); \
   } while (0)
 
+// Close the table opened at index open, linking its CLOSE back to it
+#define pgen_cap_close_table(parser, open) \
+  pgen_cap_push_close(parser, PGEN_CAP_TBL_CLOSE, open, (parser)->pos, (parser)->cap_len - (open))
+
 // Advance *i past one complete log item (a single entry, or a whole
 // bracketed Ct/Cg range including anything nested)
 static void pgen_cap_skip(Parser *parser, size_t *i) {
-  int kind = parser->caps[*i].kind;
-  (*i)++;
-  if (PGEN_CAP_IS_OPEN(kind)) {
-    int depth = 1;
-    while (depth > 0) {
-      kind = parser->caps[*i].kind;
-      if (PGEN_CAP_IS_OPEN(kind)) depth++;
-      else if (PGEN_CAP_IS_CLOSE(kind)) depth--;
-      (*i)++;
-    }
+  if (PGEN_CAP_IS_OPEN(PGEN_CAP_KIND(parser, *i))) {
+    *i += PGEN_CAP_LINK(parser, *i);  // jump to the CLOSE
   }
+  (*i)++;
 }
 
-// Reduce caps[base..] to only the nth capture value (group captures don't
-// count), or to a single nil when there are fewer than n values
+// Move count entries from index src to index dst (ranges may overlap)
+static void pgen_cap_move(Parser *parser, size_t dst, size_t src, size_t count) {
+  memmove(PGEN_OFF_AT(parser, parser->cap_starts, dst), PGEN_OFF_AT(parser, parser->cap_starts, src), count * PGEN_OFF_SIZE(parser));
+  memmove(PGEN_OFF_AT(parser, parser->cap_data, dst), PGEN_OFF_AT(parser, parser->cap_data, src), count * PGEN_OFF_SIZE(parser));
+  memmove(parser->cap_kinds + dst, parser->cap_kinds + src, count);
+}
+
+// Reduce the log from base to only the nth capture value (group captures
+// don't count), or to a single nil when there are fewer than n values
 static void pgen_cap_select(Parser *parser, size_t base, int n) {
   size_t i = base;
   int count = 0;
   while (i < parser->cap_len) {
-    if (parser->caps[i].kind == PGEN_CAP_GROUP_OPEN) {
+    if (PGEN_CAP_KIND(parser, i) == PGEN_CAP_GROUP_OPEN) {
       pgen_cap_skip(parser, &i);
       continue;
     }
@@ -927,13 +2478,13 @@ static void pgen_cap_select(Parser *parser, size_t base, int n) {
     count++;
     if (count == n) {
       size_t item_len = i - item_start;
-      memmove(&parser->caps[base], &parser->caps[item_start], item_len * sizeof(PgenCap));
+      pgen_cap_move(parser, base, item_start, item_len);
       parser->cap_len = base + item_len;
       return;
     }
   }
   parser->cap_len = base;
-  pgen_cap_push(parser, PGEN_CAP_NIL, 0, 0, 0);
+  pgen_cap_push(parser, PGEN_CAP_NIL, 0, 0);
 }
 
 // Match the text of the most recent visible "name" capture group at the
@@ -944,45 +2495,37 @@ static bool pgen_cap_match_back(Parser *parser, int name_idx) {
   size_t i = parser->cap_len;
   while (i > 0) {
     i--;
-    int kind = parser->caps[i].kind;
-    if (PGEN_CAP_IS_CLOSE(kind)) {
+    int kind = PGEN_CAP_KIND(parser, i);
+    if (kind == PGEN_CAP_TBL_CLOSE) {
+      i -= PGEN_CAP_LINK(parser, i);  // back to the OPEN
+    } else if (PGEN_CAP_IS_CLOSE(kind)) {
+      // group and Cfn CLOSE entries hold their aux, so walk back to the
+      // OPEN, jumping over nested tables
       size_t close = i;
       int depth = 1;
       while (depth > 0) {
         i--;
-        int k2 = parser->caps[i].kind;
-        if (PGEN_CAP_IS_CLOSE(k2)) depth++;
+        int k2 = PGEN_CAP_KIND(parser, i);
+        if (k2 == PGEN_CAP_TBL_CLOSE) i -= PGEN_CAP_LINK(parser, i);
+        else if (PGEN_CAP_IS_CLOSE(k2)) depth++;
         else if (PGEN_CAP_IS_OPEN(k2)) depth--;
       }
-      if (kind == PGEN_CAP_GROUP_CLOSE && parser->caps[i].aux == name_idx) {
+      if (kind == PGEN_CAP_GROUP_CLOSE && PGEN_CAP_AUX(parser, close) == name_idx) {
         const char *text;
         size_t text_len;
         size_t inner = i + 1;
         if (inner == close) {
           // group captured nothing: its value is the text it matched
-          text = parser->input + parser->caps[i].start;
-          text_len = parser->caps[close].start - parser->caps[i].start;
-        } else if (parser->caps[inner].kind == PGEN_CAP_STR) {
-          text = parser->input + parser->caps[inner].start;
-          text_len = parser->caps[inner].len;
-        } else if (parser->caps[inner].kind == PGEN_CAP_CONST) {
-          // interned constant: compare through the materialized value
-          bool matched = false;
-          pgen_checkstack(parser, 1);
-          lua_rawgeti(parser->L, LUA_REGISTRYINDEX, parser->caps[inner].aux);
-          if (lua_type(parser->L, -1) == LUA_TSTRING) {
-            size_t const_len;
-            const char *const_str = lua_tolstring(parser->L, -1, &const_len);
-            matched = parser->pos + const_len <= parser->input_len &&
-                memcmp(parser->input + parser->pos, const_str, const_len) == 0;
-            if (matched) parser->pos += const_len;
-          }
-          lua_pop(parser->L, 1);
-          return matched;
-        } else {
+          text = parser->input + PGEN_CAP_START(parser, i);
+          text_len = PGEN_CAP_START(parser, close) - PGEN_CAP_START(parser, i);
+        } else if (PGEN_CAP_KIND(parser, inner) == PGEN_CAP_STR ||
+                   PGEN_CAP_KIND(parser, inner) == PGEN_CAP_INTERN) {
+          text = parser->input + PGEN_CAP_START(parser, inner);
+          text_len = PGEN_CAP_LEN(parser, inner);
+$MATCH_BACK_CONST$        } else {
           return false;  // group holds a non-string value
         }
-        if (parser->pos + text_len <= parser->input_len &&
+        if (PGEN_AVAIL(parser, text_len) &&
             memcmp(parser->input + parser->pos, text, text_len) == 0) {
           parser->pos += text_len;
           return true;
@@ -994,53 +2537,407 @@ static bool pgen_cap_match_back(Parser *parser, int name_idx) {
   return false;
 }
 
-$IND_HELPERS$
+$MEMO_HELPERS$$IND_HELPERS$
 
-#ifdef PGEN_DEBUG
-static void dumpstack (lua_State *L) {
-  int top=lua_gettop(L);
-  for (int i=1; i <= top; i++) {
-    printf("%d\t%s\t", i, luaL_typename(L,i));
-    switch (lua_type(L, i)) {
-      case LUA_TNUMBER:
-        printf("%g\n",lua_tonumber(L,i));
-        break;
-      case LUA_TSTRING:
-        printf("%s\n",lua_tostring(L,i));
-        break;
-      case LUA_TBOOLEAN:
-        printf("%s\n", (lua_toboolean(L, i) ? "true" : "false"));
-        break;
-      case LUA_TNIL:
-        printf("%s\n", "nil");
-        break;
-      default:
-        printf("%p\n",lua_topointer(L,i));
-        break;
+$DEBUG_HELPERS$
+]], header_vars)
+
+  if c_api then
+    -- no Lua values to build: the log is unpacked for the caller, with
+    -- the constants and group names it references exposed as tables
+    return header .. require("pgen.generator_c_api").generate_tables(
+      parser_name, const_pool or {}, cg_names)
+  end
+
+  return header .. generate_cg_names(cg_names) ..
+    generate_const_infrastructure(const_pool or {}, cg_names) ..
+    generate_cap_evaluator() ..
+    generate_buf_encoder() ..
+    generate_event_replay() ..
+    generate_cmt_infrastructure(cmt_codes or {})
+end
+
+-- Generate the predicates of native match-time captures (Cmt_c), one
+-- function per distinct source, and the runner that calls them. Empty when
+-- the grammar has none.
+function generator.generate_native_cmt_functions(sources)
+  if #sources == 0 then
+    return ""
+  end
+
+  local chunks = {[[
+// --- Native match-time captures (Cmt_c) ---
+
+// A text capture of a Cmt_c's inner pattern, handed to its predicate
+typedef struct {
+  size_t start;
+  size_t len;
+} PgenSpan;
+
+// Predicate result rejecting the match
+#define PGEN_CMT_FAIL ((size_t)-1)
+
+// Inner captures passed to a predicate at most; later ones are dropped
+#ifndef PGEN_CMT_C_CAPS
+#define PGEN_CMT_C_CAPS 16
+#endif
+
+typedef size_t (*PgenNativeCmt)(const char *input, size_t len, size_t start, size_t pos, const PgenSpan *caps, int ncaps);
+
+// Run a native match-time capture: collect the spans of the inner
+// pattern's top-level C and Cspan captures, consume the inner captures and
+// let the predicate pick the position to continue at, which (as for Cmt)
+// must lie in [pos_after_inner, input_len]
+static void pgen_run_native_cmt(Parser *parser, PgenNativeCmt fn, size_t start_pos, size_t cap_base) {
+  size_t pos_after_inner = parser->pos;
+
+  // the predicate sees only the data fed so far, as a Cmt callback does
+  if (pos_after_inner == parser->input_len) {
+    pgen_starve(parser, pos_after_inner + 1);
+  }
+
+  PgenSpan caps[PGEN_CMT_C_CAPS];
+  int ncaps = 0;
+  size_t i = cap_base;
+  while (i < parser->cap_len && ncaps < PGEN_CMT_C_CAPS) {
+    int kind = PGEN_CAP_KIND(parser, i);
+    if (kind == PGEN_CAP_STR || kind == PGEN_CAP_SPAN || kind == PGEN_CAP_INTERN) {
+      caps[ncaps].start = PGEN_CAP_START(parser, i);
+      caps[ncaps].len = PGEN_CAP_LEN(parser, i);
+      ncaps++;
+    }
+    pgen_cap_skip(parser, &i);
+  }
+  parser->cap_len = cap_base;  // consume the inner captures
+
+  size_t new_pos = fn(parser->input, parser->input_len, start_pos, pos_after_inner, caps, ncaps);
+  if (new_pos != PGEN_CMT_FAIL && new_pos >= pos_after_inner && new_pos <= parser->input_len) {
+    parser->pos = new_pos;
+    if (new_pos == parser->input_len) {
+      pgen_starve(parser, new_pos + 1);
+    }
+  } else {
+    if (new_pos != PGEN_CMT_FAIL && new_pos > parser->input_len) {
+      pgen_starve(parser, new_pos);
+    }
+    parser->success = false;
+    PGEN_RECORD_FURTHEST(parser);  // record at pos_after_inner, before rewind
+    parser->pos = start_pos;
+  }
+}
+]]}
+
+  for id, source in ipairs(sources) do
+    chunks[#chunks + 1] = template_code([[
+static size_t pgen_cmt_c_$ID$(const char *input, size_t len, size_t start, size_t pos, const PgenSpan *caps, int ncaps) {
+  (void)input; (void)len; (void)start; (void)pos; (void)caps; (void)ncaps;
+$SOURCE$
+}
+]], {ID = id - 1, SOURCE = source})
+  end
+
+  return table.concat(chunks, "\n")
+end
+
+-- Generate forward declarations for all rules
+function generator.generate_forward_declarations(rules, start_rule)
+  local result = "// Forward declarations\n"
+
+  for name in sorted_rules(rules, start_rule) do
+    result = result .. template_code("static bool parse_$NAME$(Parser *parser);\n", {NAME = name})
+  end
+
+  return result .. "\n"
+end
+
+-- Capture log helpers for pgen.prec: an operator's table must enclose the
+-- left operand's entries, which are already in the log by the time the
+-- operator matches, so the open entry is inserted in front of them
+local PREC_HELPERS = [[
+// Insert a table open entry at index base, shifting the entries after it.
+// The shifted entries are complete items whose links are relative, so only
+// the new entry needs linking, by the pgen_cap_close_table that ends it.
+static void pgen_cap_wrap(Parser *parser, size_t base, size_t start) {
+  if (parser->cap_len == parser->cap_cap) pgen_cap_grow(parser);
+  pgen_cap_move(parser, base + 1, base, parser->cap_len - base);
+  parser->cap_len++;
+  parser->cap_kinds[base] = PGEN_CAP_TBL_OPEN;
+  PGEN_OFF_SET(parser, parser->cap_starts, base, start);
+  PGEN_OFF_SET(parser, parser->cap_data, base, 0);
+}
+
+// Undo pgen_cap_wrap when the right operand fails
+static void pgen_cap_unwrap(Parser *parser, size_t base) {
+  parser->cap_len--;
+  pgen_cap_move(parser, base, base + 1, parser->cap_len - base);
+}
+
+]]
+
+-- Scanning kernels for class runs (optimize.class_run_optimization). Each
+-- class is a PgenClass: a 256-entry table of member codes plus, where the
+-- class fits in a few byte ranges, the ranges for the SIMD kernels. On
+-- GCC/Clang x86 builds the SSE2 or AVX2 kernel is picked at runtime from
+-- CPUID; everything else uses the table loop. Compile with -DPGEN_NO_SIMD
+-- to always use the table loop.
+local CLASS_RUN_HELPERS = [==[
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(PGEN_NO_SIMD)
+#define PGEN_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define PGEN_CLASS_RANGES 8
+
+typedef struct {
+  // 1 for members, 2 for bytes whose rejection records the furthest
+  // failure, 0 for other bytes
+  unsigned char member[256];
+  // whether stopping at the end of input records the furthest failure
+  bool record_eof;
+  // ranges for the SIMD kernels, as lo and hi - lo; they cover the
+  // non-members instead of the members when negate is set. range_count
+  // is 0 when neither fits in PGEN_CLASS_RANGES
+  bool negate;
+  int range_count;
+  unsigned char lo[PGEN_CLASS_RANGES];
+  unsigned char span[PGEN_CLASS_RANGES];
+} PgenClass;
+
+#ifdef PGEN_SIMD_X86
+__attribute__((target("sse2")))
+static size_t pgen_class_run_sse2(const PgenClass *cls, const unsigned char *s, size_t n) {
+  const __m128i zero = _mm_setzero_si128();
+  unsigned flip = cls->negate ? 0 : 0xFFFFu;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i hit = zero;
+    for (int r = 0; r < cls->range_count; r++) {
+      // x - lo wraps below lo, so one saturating compare checks both ends
+      __m128i d = _mm_sub_epi8(x, _mm_set1_epi8((char)cls->lo[r]));
+      d = _mm_subs_epu8(d, _mm_set1_epi8((char)cls->span[r]));
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(d, zero));
+    }
+    unsigned miss = (unsigned)_mm_movemask_epi8(hit) ^ flip;
+    if (miss) {
+      return i + (size_t)__builtin_ctz(miss);
+    }
+  }
+  while (i < n && cls->member[s[i]] == 1) i++;
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t pgen_class_run_avx2(const PgenClass *cls, const unsigned char *s, size_t n) {
+  const __m256i zero = _mm256_setzero_si256();
+  unsigned flip = cls->negate ? 0 : 0xFFFFFFFFu;
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(s + i));
+    __m256i hit = zero;
+    for (int r = 0; r < cls->range_count; r++) {
+      __m256i d = _mm256_sub_epi8(x, _mm256_set1_epi8((char)cls->lo[r]));
+      d = _mm256_subs_epu8(d, _mm256_set1_epi8((char)cls->span[r]));
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(d, zero));
     }
+    unsigned miss = (unsigned)_mm256_movemask_epi8(hit) ^ flip;
+    if (miss) {
+      return i + (size_t)__builtin_ctz(miss);
+    }
+  }
+  while (i < n && cls->member[s[i]] == 1) i++;
+  return i;
+}
+
+// 0 = table loop, 1 = SSE2, 2 = AVX2, -1 = not detected yet. Detection is
+// idempotent, so racing threads at worst both run it.
+static int pgen_simd_level = -1;
+
+static void pgen_simd_detect(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    pgen_simd_level = 2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    pgen_simd_level = 1;
+  } else {
+    pgen_simd_level = 0;
   }
 }
 #endif
 
-]], header_vars) .. generate_cg_names(cg_names) ..
-    generate_const_infrastructure(const_pool or {}, cg_names) ..
-    generate_cap_evaluator() ..
-    generate_cmt_infrastructure(cmt_codes or {})
+// Length of the run of class members at the start of s
+static size_t pgen_class_run(const PgenClass *cls, const unsigned char *s, size_t n) {
+  size_t i = 0;
+  // Most runs are short (a space or two), so only set up the vector
+  // kernels once the first 16 bytes all match
+  while (i < n && i < 16) {
+    if (cls->member[s[i]] != 1) {
+      return i;
+    }
+    i++;
+  }
+#ifdef PGEN_SIMD_X86
+  if (n - i >= 16 && cls->range_count > 0) {
+    if (pgen_simd_level < 0) pgen_simd_detect();
+    if (pgen_simd_level == 2) return i + pgen_class_run_avx2(cls, s + i, n - i);
+    if (pgen_simd_level == 1) return i + pgen_class_run_sse2(cls, s + i, n - i);
+  }
+#endif
+  while (i < n && cls->member[s[i]] == 1) i++;
+  return i;
+}
+
+// Stopping a run fails its body once at the stop position: mark the parse
+// starved at the end of the window and record the furthest failure where
+// the body would have
+static void pgen_class_stop(Parser *parser, const PgenClass *cls) {
+  if (parser->pos == parser->input_len) {
+    pgen_starve(parser, parser->input_len + 1);
+    if (cls->record_eof) {
+      PGEN_RECORD_FURTHEST(parser);
+    }
+  } else if (cls->member[(unsigned char)parser->input[parser->pos]] == 2) {
+    PGEN_RECORD_FURTHEST(parser);
+  }
+}
+
+]==]
+
+-- The static PgenClass table for the classes used by class runs, in
+-- context.class_list order
+local function generate_class_table(classes)
+  local entries = {}
+  for i, class in ipairs(classes) do
+    local rows = {}
+    for row = 0, 15 do
+      rows[row + 1] = "      " .. table.concat({class:byte(row * 16 + 1, row * 16 + 16)}, ", ")
+    end
+
+    -- the SIMD kernels test ranges, so take whichever of the members or
+    -- the non-members needs fewer of them
+    local negate = #common.class_ranges(class, true) < #common.class_ranges(class, false)
+    local ranges = common.class_ranges(class, negate)
+    local lo, span = {}, {}
+    if #ranges > 8 then
+      ranges = {}
+    end
+    for r, range in ipairs(ranges) do
+      lo[r] = range[1]
+      span[r] = range[2] - range[1]
+    end
+
+    entries[i] = template_code([[  { // $INDEX$: $DESCRIPTION$
+    {
+$ROWS$
+    },
+    $RECORD_EOF$, $NEGATE$, $RANGE_COUNT$, {$LO$}, {$SPAN$}
+  }]], {
+      INDEX = i - 1,
+      DESCRIPTION = common.describe_class(class),
+      ROWS = table.concat(rows, ",\n"),
+      RECORD_EOF = class:byte(257) == 1 and "true" or "false",
+      NEGATE = negate and "true" or "false",
+      RANGE_COUNT = #ranges,
+      LO = #lo > 0 and table.concat(lo, ", ") or "0",
+      SPAN = #span > 0 and table.concat(span, ", ") or "0"
+    })
+  end
+
+  return template_code([[static const PgenClass pgen_classes[$COUNT$] = {
+$ENTRIES$
+};
+
+]], {
+    COUNT = #classes,
+    ENTRIES = table.concat(entries, ",\n")
+  })
+end
+
+-- The static class bitmaps tested by S, R and merged class choices, in
+-- context.bitmap_list order: bit (c & 7) of byte c >> 3 is set for members
+local function generate_bitmap_table(bitmaps)
+  local entries = {}
+  for i, bitmap in ipairs(bitmaps) do
+    local bytes = {}
+    for j, value in ipairs(bitmap.bits) do
+      bytes[j] = string.format("0x%02x", value)
+    end
+    entries[i] = template_code([[  { // $INDEX$: $DESCRIPTION$
+    $FIRST_HALF$,
+    $SECOND_HALF$
+  }]], {
+      INDEX = i - 1,
+      DESCRIPTION = bitmap.description,
+      FIRST_HALF = table.concat(bytes, ", ", 1, 16),
+      SECOND_HALF = table.concat(bytes, ", ", 17, 32)
+    })
+  end
+
+  return template_code([[// Character class bitmaps
+#define PGEN_IN_BITMAP(bitmap, c) ((bitmap)[(c) >> 3] & (1u << ((c) & 7)))
+
+static const unsigned char pgen_bitmaps[$COUNT$][32] = {
+$ENTRIES$
+};
+
+]], {
+    COUNT = #bitmaps,
+    ENTRIES = table.concat(entries, ",\n")
+  })
 end
 
--- Generate forward declarations for all rules
-function generator.generate_forward_declarations(rules, start_rule)
-  local result = "// Forward declarations\n"
+-- Reserved word lookups for pgen.Ident, one per distinct word list: a
+-- perfect hash (common.reserved_perfect_hash) picks the only slot the
+-- identifier could be in, and one comparison settles it
+local function generate_reserved_lookups(reserved_list)
+  local functions = {}
+  for id, words in ipairs(reserved_list) do
+    local hash = common.reserved_perfect_hash(words)
+    local entries, lengths = {}, {}
+    local min_len, max_len = math.huge, 0
+    for slot = 0, hash.size - 1 do
+      local word = hash.slots[slot]
+      entries[slot + 1] = word and escape_c_literal(word) or "NULL"
+      lengths[slot + 1] = word and #word or 0
+      if word then
+        min_len = math.min(min_len, #word)
+        max_len = math.max(max_len, #word)
+      end
+    end
 
-  for name in sorted_rules(rules, start_rule) do
-    result = result .. template_code("static bool parse_$NAME$(Parser *parser);\n", {NAME = name})
+    functions[id] = template_code([[static bool pgen_reserved_$ID$(const char *s, size_t len) {
+  static const char *const words[$SIZE$] = {
+    $WORDS$
+  };
+  static const size_t lengths[$SIZE$] = {$LENGTHS$};
+  if (len < $MIN_LEN$ || len > $MAX_LEN$) {
+    return false;
+  }
+  uint32_t h = 0;
+  for (size_t i = 0; i < len; i++) {
+    h = h * $MULT$u + (unsigned char)s[i];
+  }
+  h %= $SIZE$;
+  return lengths[h] == len && memcmp(words[h], s, len) == 0;
+}
+
+]], {
+      ID = id,
+      SIZE = hash.size,
+      WORDS = table.concat(entries, ", "),
+      LENGTHS = table.concat(lengths, ", "),
+      MIN_LEN = min_len,
+      MAX_LEN = max_len,
+      MULT = hash.mult
+    })
   end
 
-  return result .. "\n"
+  return "// Reserved word lookups\n" .. table.concat(functions)
 end
 
 -- Generate functions for each rule
-function generator.generate_rule_functions(rules, start_rule, const_index, cg_names, memo_ids)
+function generator.generate_rule_functions(rules, start_rule, const_index, cg_names, memo, c_api)
+  memo = memo or {}
   local result = "// Rule functions\n"
   local analyze = require("pgen.analyze")
   local cg_name_index = {}
@@ -1053,12 +2950,46 @@ function generator.generate_rule_functions(rules, start_rule, const_index, cg_na
     stateful_rules = analyze.stateful_rules(rules),
     const_index = const_index or {},
     cg_name_index = cg_name_index,
-    memo_ids = memo_ids or {}
+    memo_ids = memo.ids or {},
+    replay_ids = memo.replay_ids or {},
+    packrat = memo.packrat,
+    c_api = c_api,
+    prec_functions = {},
+    class_index = {},
+    class_list = {},
+    bitmap_index = {},
+    bitmap_list = {},
+    reserved_index = {},
+    reserved_list = {}
   }
   for name, pattern in sorted_rules(rules, start_rule) do
     result = result .. generator.generate_rule_function(name, pattern, context)
   end
 
+  -- Precedence climbing functions are called from the rule functions above
+  -- and call rules themselves, so they're declared first and defined last
+  local precs = context.prec_functions
+  if #precs > 0 then
+    local declarations = {}
+    for id in ipairs(precs) do
+      declarations[id] = template_code("static bool pgen_prec_$ID$(Parser *parser, int min_level);\n", {ID = id})
+    end
+    result = table.concat(declarations) .. "\n" .. result ..
+      "// Precedence climbing functions\n" .. PREC_HELPERS .. table.concat(precs)
+  end
+
+  -- Class tables come first so that every function above can scan with them
+  if #context.class_list > 0 then
+    result = "// Class run scanning\n" .. CLASS_RUN_HELPERS ..
+      generate_class_table(context.class_list) .. result
+  end
+  if #context.reserved_list > 0 then
+    result = generate_reserved_lookups(context.reserved_list) .. result
+  end
+  if #context.bitmap_list > 0 then
+    result = generate_bitmap_table(context.bitmap_list) .. result
+  end
+
   return result
 end
 
@@ -1066,7 +2997,45 @@ end
 function generator.generate_rule_function(name, pattern, context)
   local memo_check, memo_store = "", ""
   local memo_id = context.memo_ids[name]
-  if memo_id then
+  local replay_id = context.replay_ids[name]
+  if replay_id then
+    memo_check = template_code([[
+  // Capture-producing rule free of other state: a single-slot memo replays
+  // the log entries it appended when called again at the same position
+  if (parser->replay[$ID$].pos == start + 1) {
+    if (parser->replay[$ID$].endpos == (size_t)-1) {
+      parser->success = false;
+      return false;
+    }
+    pgen_replay(parser, $ID$);
+    parser->success = true;
+    return true;
+  }
+  size_t replay_base = parser->cap_len;
+]], {ID = replay_id})
+    memo_store = template_code([[
+  pgen_replay_store(parser, $ID$, start, replay_base);
+]], {ID = replay_id})
+  elseif memo_id and context.packrat then
+    memo_check = template_code([[
+  // Position-pure rule (no captures, labels, or other state): its packrat
+  // memo slot for this position answers every repeated call
+  PgenMemoSlot *memo_slot = &parser->memo[$ID$ * parser->memo_size + (start & (parser->memo_size - 1))];
+  if (memo_slot->pos == parser->memo_base + start) {
+    if (memo_slot->endpos == (size_t)-1) {
+      parser->success = false;
+      return false;
+    }
+    parser->pos = memo_slot->endpos;
+    parser->success = true;
+    return true;
+  }
+]], {ID = memo_id})
+    memo_store = [[
+  memo_slot->pos = parser->memo_base + start;
+  memo_slot->endpos = parser->success ? parser->pos : (size_t)-1;
+]]
+  elseif memo_id then
     memo_check = template_code([[
   // Position-pure rule (no captures, labels, or other state): a
   // single-slot memo short-circuits the repeated calls that backtracking
@@ -1092,9 +3061,9 @@ function generator.generate_rule_function(name, pattern, context)
 $MEMO_CHECK$
   parser->depth += 1;
   if (parser->depth > PGEN_MAX_DEPTH) {
-    // A Lua error (rather than a match failure) so the overflow can't be
+    // A fatal error (rather than a match failure) so the overflow can't be
     // silently converted into a successful parse by a predicate or choice
-    luaL_error(parser->L, "pgen: max recursion depth (%d) exceeded at position %d", (int)PGEN_MAX_DEPTH, (int)(parser->pos + 1));
+    PGEN_FATAL(parser, "pgen: max recursion depth (%d) exceeded at position %d", (int)PGEN_MAX_DEPTH, (int)(parser->pos + 1));
   }
 
 #ifdef PGEN_DEBUG
@@ -1124,6 +3093,13 @@ $MEMO_STORE$
   })
 end
 
+-- Capture log kinds of the C captures with a convert field
+local CONVERT_KINDS = {
+  num = "PGEN_CAP_NUM",
+  json = "PGEN_CAP_JSON_STR",
+  lua = "PGEN_CAP_LUA_STR"
+}
+
 -- Generate code for a pattern
 function generator.generate_pattern_code(pattern, context)
   local t = pattern.type
@@ -1137,15 +3113,24 @@ function generator.generate_pattern_code(pattern, context)
     end
 
   elseif t == types.R then -- R (character range)
-    return generator.generate_range_code(pattern.value)
+    return generator.generate_range_code(pattern, context)
   elseif t == types.S then -- S (character set)
-    local set = pattern.value
-    return generator.generate_set_code(set)
+    return generator.generate_set_code(pattern, context)
   elseif t == types.V then -- V (reference to another rule)
     local rule_name = pattern.value
     return generator.generate_rule_call_code(rule_name)
   elseif t == types.C then -- C (capture)
-    return generator.generate_capture_code(pattern.value, context)
+    local kind = "PGEN_CAP_STR"
+    if pattern.span then
+      kind = "PGEN_CAP_SPAN"
+    elseif context.c_api then
+      kind = "PGEN_CAP_STR"
+    elseif pattern.convert then
+      kind = CONVERT_KINDS[pattern.convert]
+    elseif pattern.intern then
+      kind = "PGEN_CAP_INTERN"
+    end
+    return generator.generate_capture_code(pattern.value, kind, context)
   elseif t == types.Ct then -- Ct (capture table)
     return generator.generate_capture_table_code(pattern.value, pattern.array_only, context)
   elseif t == types.Cp then -- Cp (capture position)
@@ -1161,6 +3146,9 @@ function generator.generate_pattern_code(pattern, context)
   elseif t == types.Cmb then -- Cmb (capture match back)
     return generator.generate_capture_match_back_code(pattern.name, context)
   elseif t == types.Cmt then -- Cmt (match-time capture)
+    if pattern.native then
+      return generator.generate_native_cmt_code(pattern.value, pattern.native_id, context)
+    end
     return generator.generate_cmt_code(pattern.value, pattern.cmt_id, context)
   elseif t == types.Cfn then -- Cfn (transform capture)
     return generator.generate_cfn_code(pattern.value, pattern.cmt_id, context)
@@ -1178,23 +3166,67 @@ function generator.generate_pattern_code(pattern, context)
   --elseif t == "optional" then
   --  return generator.generate_optional_code(pattern[1])
   elseif t == "repeat" then
+    if pattern.commit and not context.c_api then
+      return generator.generate_commit_repeat_code(pattern[1], pattern[2], context)
+    end
     return generator.generate_repeat_code(pattern[1], pattern[2], context)
   elseif t == "negate" then
     return generator.generate_negate_code(pattern[1], context)
   elseif t == "literal_trie" then
     return generator.generate_trie_code(pattern.trie, pattern.strings)
+  elseif t == "prec" then
+    return generator.generate_prec_code(pattern, context)
+  elseif t == "class_run" then
+    return generator.generate_class_run_code(pattern, context)
+  elseif t == "char_class" then
+    return generator.generate_char_class_code(pattern, context)
+  elseif t == "keyword" then
+    return generator.generate_keyword_code(pattern, context)
+  elseif t == "ident" then
+    return generator.generate_ident_code(pattern, context)
   else
     error("Unknown pattern type: " .. tostring(t))
   end
 end
 
+-- C expression comparing the input at the current position with str,
+-- assuming #str bytes are available. Literals up to 16 bytes compare as one
+-- or two word loads; odd lengths use two overlapping loads (a 7 byte
+-- literal is bytes 0-3 and 3-6) so no load reaches past the literal.
+local function literal_compare_code(str)
+  local n = #str
+  local function word(bits, offset)
+    return template_code("pgen_load$BITS$($INPUT$) == pgen_load$BITS$($LITERAL$)", {
+      BITS = bits,
+      INPUT = offset == 0 and "parser->input + parser->pos" or "parser->input + parser->pos + " .. offset,
+      LITERAL = escape_c_literal(str:sub(offset + 1))
+    })
+  end
+
+  if n == 1 then
+    return "(unsigned char)parser->input[parser->pos] == " .. str:byte()
+  elseif n == 2 or n == 4 or n == 8 then
+    return word(n * 8, 0)
+  elseif n == 3 then
+    return word(16, 0) .. " &&\n    " .. word(16, 1)
+  elseif n < 8 then
+    return word(32, 0) .. " &&\n    " .. word(32, n - 4)
+  elseif n <= 16 then
+    return word(64, 0) .. " &&\n    " .. word(64, n - 8)
+  end
+  return template_code("memcmp(parser->input + parser->pos, $LITERAL$, $LEN$) == 0", {
+    LITERAL = escape_c_literal(str),
+    LEN = n
+  })
+end
+
 -- Generate code for a literal string match
 function generator.generate_literal_code(literal)
   -- Optimization for single character literals - use direct comparison instead of memcmp
   if #literal == 1 then
     return template_code([[{// Match single character $ESCAPED_LITERAL$
-  if (parser->pos < parser->input_len &&
-      parser->input[parser->pos] == $CHAR_CODE$) {
+  if (PGEN_AVAIL(parser, 1) &&
+      (unsigned char)parser->input[parser->pos] == $CHAR_CODE$) {
     parser->pos++;
   } else {
 #ifdef PGEN_ERRORS
@@ -1210,8 +3242,8 @@ function generator.generate_literal_code(literal)
   end
 
   return template_code([[{// Match literal $ESCAPED_LITERAL$
-if (parser->pos + $LITERAL_LEN$ <= parser->input_len &&
-    memcmp(parser->input + parser->pos, $LITERAL$, $LITERAL_LEN$) == 0) {
+if (PGEN_AVAIL(parser, $LITERAL_LEN$) &&
+    $COMPARE$) {
   parser->pos += $LITERAL_LEN$;
 } else {
 #ifdef PGEN_ERRORS
@@ -1223,14 +3255,15 @@ if (parser->pos + $LITERAL_LEN$ <= parser->input_len &&
 }]], {
     ESCAPED_LITERAL = escape_string(literal),
     LITERAL = escape_c_literal(literal),
-    LITERAL_LEN = #literal
+    LITERAL_LEN = #literal,
+    COMPARE = literal_compare_code(literal)
   })
 end
 
 -- Generate code for matching exactly n characters
 function generator.generate_n_chars_code(n)
   return template_code([[{// Match any $N$ characters
-  if (parser->pos + $N$ <= parser->input_len) {
+  if (PGEN_AVAIL(parser, $N$)) {
     parser->pos += $N$;
   } else {
 #ifdef PGEN_ERRORS
@@ -1244,10 +3277,54 @@ function generator.generate_n_chars_code(n)
   })
 end
 
+-- Intern the 256-bit membership bitmap of a class (analyze.class_key
+-- encoding), returning its index in the pgen_bitmaps table. Identical
+-- classes share one bitmap across the grammar.
+local function bitmap_index(context, class)
+  local bits = {}
+  for i = 1, 32 do
+    local value = 0
+    for bit = 7, 0, -1 do
+      value = value * 2 + (class:byte((i - 1) * 8 + bit + 1) == 1 and 1 or 0)
+    end
+    bits[i] = value
+  end
+
+  local key = table.concat(bits, ",")
+  local index = context.bitmap_index[key]
+  if not index then
+    table.insert(context.bitmap_list, {bits = bits, description = common.describe_class(class)})
+    index = #context.bitmap_list - 1
+    context.bitmap_index[key] = index
+  end
+  return index
+end
+
+-- Test the current byte against a class bitmap. The byte is read as
+-- unsigned char, so classes above 0x7F match on signed-char platforms.
+-- errors is the PGEN_ERRORS message code run on failure.
+local function generate_bitmap_test_code(comment, class, errors, context)
+  return template_code([[{// Match $COMMENT$
+  if (PGEN_AVAIL(parser, 1) &&
+      PGEN_IN_BITMAP(pgen_bitmaps[$INDEX$], (unsigned char)parser->input[parser->pos])) {
+    parser->pos++;
+  } else {
+#ifdef PGEN_ERRORS
+    $ERRORS$
+#endif
+    parser->success = false;
+  }
+}]], {
+    COMMENT = comment,
+    INDEX = bitmap_index(context, class),
+    ERRORS = errors
+  })
+end
+
 -- Generate code for multiple character ranges
 -- ranges: array of two-character strings representing low and upper bounds characters
-function generator.generate_range_code(ranges)
-  local conditions = {}
+function generator.generate_range_code(pattern, context)
+  local ranges = pattern.value
   local error_ranges = {}
 
   for i, range in ipairs(ranges) do
@@ -1255,72 +3332,51 @@ function generator.generate_range_code(ranges)
     assert(range_left, "range must have two characters: " .. range)
     assert(range_left <= range_right, "range must be in ascending order: " .. range)
 
-    table.insert(conditions, template_code("(parser->input[parser->pos] >= $LOW$ && parser->input[parser->pos] <= $HIGH$)", {
-      LOW = string.byte(range_left),
-      HIGH = string.byte(range_right)
-    }))
-
     table.insert(error_ranges, template_code([[$LEFT$ " - " $RIGHT$]], {
       LEFT = escape_c_literal(range_left),
       RIGHT = escape_c_literal(range_right)
     }))
   end
 
-  local condition_str = table.concat(conditions, " || ")
   local error_ranges_str = table.concat(error_ranges, [[", "]])
 
-  return template_code([[{// Match character range: $RANGES$
-  if (parser->pos < parser->input_len &&
-      ($CONDITION$)) {
-    parser->pos++;
-  } else {
-#ifdef PGEN_ERRORS
-    sprintf(parser->error_message, "Expected character in ranges [" $ERROR_RANGES$ "] at position %zu", parser->pos);
-#endif
-    parser->success = false;
-  }
-}]], {
-    RANGES = escape_string(table.concat(ranges, ",")),
-    CONDITION = condition_str,
-    ERROR_RANGES = error_ranges_str
-  })
+  return generate_bitmap_test_code(
+    "character range: " .. escape_string(table.concat(ranges, ",")),
+    context.analyze.class_key(context.analyze.byte_class(pattern)),
+    template_code([[sprintf(parser->error_message, "Expected character in ranges [" $ERROR_RANGES$ "] at position %zu", parser->pos);]], {
+      ERROR_RANGES = error_ranges_str
+    }),
+    context)
 end
 
 -- Generate code for a character set match
-function generator.generate_set_code(set)
-  -- Generate cases for the switch
-  local cases = {}
-  for i = 1, #set do
-    local c = set:sub(i, i)
-    table.insert(cases, template_code("    case $BYTE$: /* $CHAR$ */", {
-      BYTE = tostring(string.byte(c)),
-      CHAR = escape_c_literal(c)
-    }))
-  end
+function generator.generate_set_code(pattern, context)
+  local set = pattern.value
 
-  return template_code([[{// Match character set $SET$
-  if (parser->pos < parser->input_len) {
-    switch (parser->input[parser->pos]) {
-$CASES$
-      parser->pos++;
-      break;
-    default:
-#ifdef PGEN_ERRORS
+  return generate_bitmap_test_code(
+    "character set " .. escape_string(set),
+    context.analyze.class_key(context.analyze.byte_class(pattern)),
+    template_code([[if (parser->pos < parser->input_len) {
       sprintf(parser->error_message, "Expected one of " $SET_LITERAL$ " at position %zu", parser->pos);
-#endif
-      parser->success = false;
-    }
-  } else {
-#ifdef PGEN_ERRORS
-    sprintf(parser->error_message, "Expected one of " $SET_LITERAL$ " at position %zu but reached end of input", parser->pos);
-#endif
-    parser->success = false;
-  }
-}]], {
-    SET = escape_string(set),
-    CASES = table.concat(cases, "\n"),
-    SET_LITERAL = escape_c_literal(escape_c_literal(set))
-  })
+    } else {
+      sprintf(parser->error_message, "Expected one of " $SET_LITERAL$ " at position %zu but reached end of input", parser->pos);
+    }]], {
+      SET_LITERAL = escape_c_literal(escape_c_literal(set))
+    }),
+    context)
+end
+
+-- Generate code for a choice of single-byte classes merged into one class
+-- (optimize.char_class_optimization)
+function generator.generate_char_class_code(pattern, context)
+  local description = common.describe_class(pattern.class)
+  return generate_bitmap_test_code(
+    "character class " .. description,
+    pattern.class,
+    template_code([[sprintf(parser->error_message, "Expected character in class $CLASS$ at position %zu", parser->pos);]], {
+      CLASS = escape_c_literal(description, ""):gsub("%%", "%%%%")
+    }),
+    context)
 end
 
 -- Generate code for a rule call
@@ -1484,7 +3540,7 @@ function generator.generate_dispatch_choice_code(pattern, context)
 
   return template_code([[{ // FIRST-byte dispatched ordered choice
   unsigned long long pgen_dispatch_mask;
-  if (parser->pos < parser->input_len) {
+  if (PGEN_AVAIL(parser, 1)) {
     switch ((unsigned char)parser->input[parser->pos]) {
 $CASES$
     default:
@@ -1606,6 +3662,74 @@ function generator.generate_repeat_code(a, n, context)
   })
 end
 
+-- Generate code for a committing repetition (pgen.Commit): patt^n whose
+-- iterations, once at least n have matched, are handed to parse_stream's
+-- consumer and dropped from the log (see pgen_commit). Outside
+-- parse_stream it matches exactly like patt^n.
+function generator.generate_commit_repeat_code(a, n, context)
+  if n == 0 then
+    return template_code([[{ // Zero or more repetitions, committing each one
+  size_t commit_cap_base = parser->cap_len;
+  int commit_top_base = parser->top;
+
+  while(true) {
+    $BODY$
+    if (!parser->success) {
+      break;
+    }
+    if (parser->commit_fn) {
+      pgen_commit(parser, commit_cap_base, commit_top_base);
+    }
+  }
+  // Only recover from ordinary failure, not labeled failure from T()
+  if (!parser->throw_label) {
+    parser->success = true;
+  }
+}]], {
+      BODY = generator.generate_pattern_code(a, context)
+    })
+  end
+
+  local remember, restore = position_operations(a, context)
+
+  return template_code([[{ // At least $N$ repetitions, committing once $N$ have matched
+  $REMEMBER$
+  size_t rep_count = 0;
+  size_t commit_cap_base = parser->cap_len;
+  int commit_top_base = parser->top;
+
+  while(true) {
+    $BODY$
+
+    if (!parser->success) {
+      break;
+    }
+
+    rep_count += 1;
+    if (parser->commit_fn && rep_count >= $N$) {
+      pgen_commit(parser, commit_cap_base, commit_top_base);
+    }
+  }
+
+  // Don't recover if labeled failure was thrown
+  if (parser->throw_label) {
+    // Keep failure state, propagate labeled failure
+  } else if (rep_count >= $N$) {
+    parser->success = true;
+  } else {
+    $RESTORE$
+#ifdef PGEN_ERRORS
+    sprintf(parser->error_message, "Expected $N$ repetitions at position %zu", parser->pos);
+#endif
+  }
+}]], {
+    N = n,
+    REMEMBER = remember,
+    RESTORE = restore,
+    BODY = generator.generate_pattern_code(a, context)
+  })
+end
+
 -- Generate code for a negated pattern
 function generator.generate_negate_code(a, context)
   local remember, restore = position_operations(a, context)
@@ -1640,33 +3764,36 @@ function generator.generate_negate_code(a, context)
   })
 end
 
--- Generate code for a capture
-function generator.generate_capture_code(body, context)
+-- Generate code for a capture, logged as kind: PGEN_CAP_STR, or for the
+-- same range materialized differently, PGEN_CAP_SPAN (Cspan),
+-- PGEN_CAP_INTERN (interned C) or one of CONVERT_KINDS (Cnum, Cunescape)
+function generator.generate_capture_code(body, kind, context)
   return template_code([[{ // Capture
   size_t start_pos = parser->pos;
   $BODY$
 
   if (parser->success) {
-    pgen_cap_push(parser, PGEN_CAP_STR, 0, start_pos, parser->pos - start_pos);
+    pgen_cap_push(parser, $KIND$, start_pos, parser->pos - start_pos);
   }
 }]], {
+    KIND = kind,
     BODY = generator.generate_pattern_code(body, context)
   })
 end
 
 -- Generate code for a capture table (Ct)
 -- Emits open/close brackets in the capture log; the table itself (array
--- part plus named Cg fields) is built by the evaluator after the parse.
--- The array_only flag is no longer needed: materialization happens once
--- per surviving table, so there is no per-attempt cost to optimize away.
+-- part plus named Cg fields) is built by the evaluator after the parse,
+-- presized from its item counts. The array_only flag isn't needed: the
+-- counts are taken once per surviving table, when it is built.
 function generator.generate_capture_table_code(body, array_only, context)
   return template_code([[{ // Capture Table
   size_t ct_cap_start = parser->cap_len;
-  pgen_cap_push(parser, PGEN_CAP_TBL_OPEN, 0, 0, 0);
+  pgen_cap_push(parser, PGEN_CAP_TBL_OPEN, parser->pos, 0);
   $BODY$
 
   if (parser->success) {
-    pgen_cap_push(parser, PGEN_CAP_TBL_CLOSE, 0, 0, 0);
+    pgen_cap_close_table(parser, ct_cap_start);
   } else {
     parser->cap_len = ct_cap_start;
   }
@@ -1678,7 +3805,7 @@ end
 -- Generate code for a position capture (Cp)
 function generator.generate_position_capture_code()
   return template_code([[{ // Position Capture
-  pgen_cap_push(parser, PGEN_CAP_POS, 0, parser->pos, 0);
+  pgen_cap_push(parser, PGEN_CAP_POS, parser->pos, 0);
 }]], {})
 end
 
@@ -1696,7 +3823,7 @@ function generator.generate_constant_capture_code(values, context)
     local value = values[i]
     local t = type(value)
     if t == "nil" then
-      push_code = push_code .. "\n  pgen_cap_push(parser, PGEN_CAP_NIL, 0, 0, 0);"
+      push_code = push_code .. "\n  pgen_cap_push(parser, PGEN_CAP_NIL, 0, 0);"
     elseif t == "string" or t == "number" or t == "boolean" then
       local idx = const_index[value]
       if not idx then
@@ -1705,9 +3832,11 @@ function generator.generate_constant_capture_code(values, context)
       local comment = t == "string" and
         " // " .. escape_c_literal(value):gsub("%*/", "* /") or
         " // " .. tostring(value)
+      -- the c-api target has no registry: entries index its constants table
+      local aux = context and context.c_api and tostring(idx) or "__const_refs[" .. idx .. "]"
       push_code = push_code .. "\n" .. template_code(
-        [[  pgen_cap_push(parser, PGEN_CAP_CONST, __const_refs[$IDX$], 0, 0);]],
-        {IDX = idx}) .. comment
+        [[  pgen_cap_push(parser, PGEN_CAP_CONST, 0, $AUX$);]],
+        {AUX = aux}) .. comment
     else
       error("Unsupported constant capture type: " .. t)
     end
@@ -1747,11 +3876,11 @@ end
 function generator.generate_capture_group_code(body, name, context)
   return template_code([[{ // Capture Group "$NAME$"
   size_t cg_cap_start = parser->cap_len;
-  pgen_cap_push(parser, PGEN_CAP_GROUP_OPEN, $NAME_IDX$, parser->pos, 0);
+  pgen_cap_push(parser, PGEN_CAP_GROUP_OPEN, parser->pos, 0);
   $BODY$
 
   if (parser->success) {
-    pgen_cap_push(parser, PGEN_CAP_GROUP_CLOSE, $NAME_IDX$, parser->pos, 0);
+    pgen_cap_push_close(parser, PGEN_CAP_GROUP_CLOSE, cg_cap_start, parser->pos, $NAME_IDX$);
   } else {
     parser->cap_len = cg_cap_start;
   }
@@ -1840,6 +3969,35 @@ function generator.generate_cmt_code(inner_pattern, cmt_id, context)
   })
 end
 
+-- Generate code for a native match-time capture (Cmt_c): like Cmt, but
+-- the predicate is a C function (see generate_native_cmt_functions)
+function generator.generate_native_cmt_code(inner_pattern, native_id, context)
+  return template_code([[{ // Native match-time capture (Cmt_c id=$ID$)
+  size_t cmt_cap_base = parser->cap_len;
+  size_t cmt_start_pos = parser->pos;
+#ifdef PGEN_HAS_IND
+  size_t cmt_trail_index = parser->trail_len;
+#endif
+
+  $INNER_PATTERN_CODE$
+
+  if (parser->success) {
+    pgen_run_native_cmt(parser, pgen_cmt_c_$ID$, cmt_start_pos, cmt_cap_base);
+
+#ifdef PGEN_HAS_IND
+    // Predicate rejected the match: undo indenter operations performed by
+    // the inner pattern (an inner failure rewinds itself)
+    if (!parser->success) {
+      pgen_ind_trail_rewind(parser, cmt_trail_index);
+    }
+#endif
+  }
+}]], {
+    ID = native_id,
+    INNER_PATTERN_CODE = generator.generate_pattern_code(inner_pattern, context)
+  })
+end
+
 -- Generate code for a transform capture (Cfn)
 -- Emits open/close brackets in the capture log carrying the callback's
 -- registry ref and the matched span; the callback runs during
@@ -1847,11 +4005,11 @@ end
 function generator.generate_cfn_code(body, cmt_id, context)
   return template_code([[{ // Transform Capture (Cfn id=$ID$)
   size_t fn_cap_start = parser->cap_len;
-  pgen_cap_push(parser, PGEN_CAP_FN_OPEN, __cmt_refs[$ID$], parser->pos, 0);
+  pgen_cap_push(parser, PGEN_CAP_FN_OPEN, parser->pos, 0);
   $BODY$
 
   if (parser->success) {
-    pgen_cap_push(parser, PGEN_CAP_FN_CLOSE, 0, parser->pos, 0);
+    pgen_cap_push_close(parser, PGEN_CAP_FN_CLOSE, fn_cap_start, parser->pos, __cmt_refs[$ID$]);
   } else {
     parser->cap_len = fn_cap_start;
   }
@@ -1966,20 +4124,268 @@ function generator.generate_labeled_failure_code(label)
   parser->throw_label = $ESCAPED_LABEL$;
   parser->throw_pos = parser->pos;
 #ifdef PGEN_ERRORS
-  sprintf(parser->error_message, $ESCAPED_LABEL$ " at position %zu", parser->pos + 1);
+  sprintf(parser->error_message, $ESCAPED_LABEL$ " at position %zu", parser->pos + 1);
+#endif
+}]], {
+    LABEL = label,
+    ESCAPED_LABEL = escaped_label
+  })
+end
+
+-- Generate code for a precedence climbing expression (pgen.prec). The loop
+-- lives in its own function, called recursively with a minimum level for
+-- right operands; the functions are collected in context.prec_functions
+-- and emitted after the rule functions.
+function generator.generate_prec_code(pattern, context)
+  local id = #context.prec_functions + 1
+  -- reserve the id before generating children, which may hold nested precs
+  context.prec_functions[id] = false
+
+  local space = pattern.space and pattern[2]
+  local first_op = space and 3 or 2
+  local space_code = space and generator.generate_pattern_code(space, context) or ""
+
+  local levels = {}
+  local level_count = #pattern.right
+  for level = level_count, 1, -1 do
+    local next_level = pattern.right[level] and level or level + 1
+    table.insert(levels, template_code([[
+    if (!level && min_level <= $LEVEL$ && !parser->throw_label) { // Level $LEVEL$ ($ASSOC$)
+      REMEMBER_POSITION(parser, pos);
+      $SPACE$
+      if (parser->success) {
+        size_t op_start = parser->pos;
+        $OPS$
+        if (parser->success) {
+          size_t op_end = parser->pos;
+          $SPACE$
+          if (parser->success) {
+            pgen_cap_wrap(parser, prec_base, start);
+            pgen_cap_push(parser, PGEN_CAP_STR, op_start, op_end - op_start);
+            pgen_prec_$ID$(parser, $NEXT$);
+            if (parser->success) {
+              pgen_cap_close_table(parser, prec_base);
+              level = $LEVEL$;
+            } else {
+              pgen_cap_unwrap(parser, prec_base);
+            }
+          }
+        }
+      }
+      if (!level && !parser->throw_label) {
+        RESTORE_POSITION(parser, pos);
+        parser->success = true;
+      }
+    }]], {
+      ID = id,
+      LEVEL = level,
+      NEXT = next_level,
+      ASSOC = pattern.right[level] and "right" or "left",
+      SPACE = space_code,
+      OPS = generator.generate_pattern_code(pattern[first_op + level - 1], context)
+    }))
+  end
+
+  context.prec_functions[id] = template_code([[static bool pgen_prec_$ID$(Parser *parser, int min_level) {
+  size_t start = parser->pos;
+  size_t prec_base = parser->cap_len;
+  parser->depth += 1;
+  if (parser->depth > PGEN_MAX_DEPTH) {
+    PGEN_FATAL(parser, "pgen: max recursion depth (%d) exceeded at position %d", (int)PGEN_MAX_DEPTH, (int)(parser->pos + 1));
+  }
+
+  $OPERAND$
+
+  // Extend the operand while an operator at min_level or tighter follows,
+  // trying the tightest level first as nested per-level rules would
+  while (parser->success) {
+    int level = 0;
+$LEVELS$
+    if (!level) {
+      break;
+    }
+  }
+
+  if (!parser->success) {
+    // a labeled failure past an operator leaves operand tables behind
+    parser->cap_len = prec_base;
+  }
+  parser->depth -= 1;
+  return parser->success;
+}
+
+]], {
+    ID = id,
+    OPERAND = generator.generate_pattern_code(pattern[1], context),
+    LEVELS = table.concat(levels, "\n")
+  })
+
+  return template_code([[pgen_prec_$ID$(parser, 1); // Precedence climbing, $N$ levels]], {
+    ID = id,
+    N = level_count
+  })
+end
+
+-- Generate code for a run of single-byte class members (the class_run
+-- node from optimize.class_run_optimization). Matches as many members as
+-- it can, like the repetition it replaces, and fails when that's fewer
+-- than the minimum count.
+local function class_run_index(context, class)
+  local index = context.class_index[class]
+  if not index then
+    table.insert(context.class_list, class)
+    index = #context.class_list - 1
+    context.class_index[class] = index
+  end
+  return index
+end
+
+function generator.generate_class_run_code(pattern, context)
+  local index = class_run_index(context, pattern.class)
+
+  local min_check = ""
+  if pattern.min > 0 then
+    min_check = template_code([[
+
+  if (parser->pos - run_start < $N$) {
+    parser->pos = run_start;
+#ifdef PGEN_ERRORS
+    sprintf(parser->error_message, "Expected $N$ repetitions at position %zu", parser->pos);
+#endif
+    parser->success = false;
+  }]], {N = pattern.min})
+  end
+
+  return template_code([[{ // Class run: $CLASS$^$N$
+  size_t run_start = parser->pos;
+  parser->pos += pgen_class_run(&pgen_classes[$INDEX$],
+    (const unsigned char *)parser->input + run_start, parser->input_len - run_start);
+  pgen_class_stop(parser, &pgen_classes[$INDEX$]);$MIN_CHECK$
+}]], {
+    CLASS = common.describe_class(pattern.class),
+    N = pattern.min,
+    INDEX = index,
+    MIN_CHECK = min_check
+  })
+end
+
+-- Generate code for a keyword fused with its boundary check (the keyword
+-- node from optimize.keyword_boundary_optimization): after the literal or
+-- trie matches, the next byte must not be in the class. Fails the way the
+-- negated class would: recording the furthest failure at the boundary, and
+-- marking a streaming parse starved when the boundary is the window end.
+function generator.generate_keyword_code(pattern, context)
+  return template_code([[{ // Keyword followed by not $CLASS$
+  size_t keyword_start = parser->pos;
+  $BODY$
+  if (parser->success) {
+    if (parser->pos == parser->input_len) {
+      pgen_starve(parser, parser->input_len + 1);
+    } else if (PGEN_IN_BITMAP(pgen_bitmaps[$INDEX$], (unsigned char)parser->input[parser->pos])) {
+      PGEN_RECORD_FURTHEST(parser);
+#ifdef PGEN_ERRORS
+      sprintf(parser->error_message, "Negated pattern unexpectedly matched at position %zu", parser->pos);
+#endif
+      parser->pos = keyword_start;
+      parser->success = false;
+    }
+  }
+}]], {
+    CLASS = common.describe_class(pattern.class),
+    INDEX = bitmap_index(context, pattern.class),
+    BODY = generator.generate_pattern_code(pattern[1], context)
+  })
+end
+
+-- Generate code for an identifier that isn't a reserved word (pgen.Ident):
+-- a start byte, a class run of rest bytes, then a perfect hash probe of
+-- the reserved words. A reserved word fails like the keyword predicate it
+-- replaces, recording the furthest failure at the identifier's start.
+function generator.generate_ident_code(pattern, context)
+  local reserved_check = ""
+  if #pattern.reserved > 0 then
+    local key = table.concat(pattern.reserved, "\0")
+    local id = context.reserved_index[key]
+    if not id then
+      table.insert(context.reserved_list, pattern.reserved)
+      id = #context.reserved_list
+      context.reserved_index[key] = id
+    end
+
+    reserved_check = template_code([[
+
+    if (pgen_reserved_$ID$(parser->input + ident_start, parser->pos - ident_start)) {
+      parser->pos = ident_start;
+      PGEN_RECORD_FURTHEST(parser);
+#ifdef PGEN_ERRORS
+      sprintf(parser->error_message, "Unexpected reserved word at position %zu", parser->pos);
+#endif
+      parser->success = false;
+    }]], {ID = id})
+  end
+
+  return template_code([[{ // Identifier $START$$REST$* ($COUNT$ reserved words)$IDENT_START$
+  if (PGEN_AVAIL(parser, 1) &&
+      PGEN_IN_BITMAP(pgen_bitmaps[$START_INDEX$], (unsigned char)parser->input[parser->pos])) {
+    parser->pos++;
+    parser->pos += pgen_class_run(&pgen_classes[$REST_INDEX$],
+      (const unsigned char *)parser->input + parser->pos, parser->input_len - parser->pos);
+    pgen_class_stop(parser, &pgen_classes[$REST_INDEX$]);$RESERVED_CHECK$
+  } else {
+#ifdef PGEN_ERRORS
+    sprintf(parser->error_message, "Expected identifier at position %zu", parser->pos);
 #endif
+    parser->success = false;
+  }
 }]], {
-    LABEL = label,
-    ESCAPED_LABEL = escaped_label
+    START = common.describe_class(pattern.start),
+    REST = common.describe_class(pattern.rest),
+    COUNT = #pattern.reserved,
+    START_INDEX = bitmap_index(context, pattern.start),
+    REST_INDEX = class_run_index(context, pattern.rest),
+    IDENT_START = #pattern.reserved > 0 and "\n  size_t ident_start = parser->pos;" or "",
+    RESERVED_CHECK = reserved_check
   })
 end
 
--- Generate core C parser functions (_init, _free, _parse)
-function generator.generate_c_core_functions(parser_name, start_rule, indenters, memo_count)
+-- Generate the parser state setup snippets shared by the Lua module and the
+-- c-api entry points: memo and indenter stack allocation, reset, trimming
+-- and release. Returns a table of template variables.
+function generator.generate_parser_state_code(indenters, memo)
   indenters = indenters or {}
+  memo = memo or {count = 0, replay_count = 0}
+  local memo_count = memo.count
+  local packrat = memo.packrat
 
   local memo_init = ""
-  if (memo_count or 0) > 0 then
+  local memo_null = ""
+  local memo_trim = ""
+  local memo_free = ""
+  if (memo_count or 0) > 0 and packrat then
+    -- sized and tagged per parse by PGEN_MEMO_PREPARE, once the window is
+    -- known
+    memo_null = [[
+
+  parser->memo = NULL;
+  parser->memo_size = 0;
+  parser->memo_cap = 0;
+  parser->memo_next = 1;]]
+    -- trim counts memo slots per rule
+    memo_trim = [[
+
+  if (parser->memo_cap > parser->trim * PGEN_MEMO_COUNT) {
+    PgenMemoSlot *memo = (PgenMemoSlot*)realloc(parser->memo, parser->trim * PGEN_MEMO_COUNT * sizeof(PgenMemoSlot));
+    if (memo) {
+      parser->memo = memo;
+      parser->memo_cap = parser->trim * PGEN_MEMO_COUNT;
+    }
+  }]]
+    memo_free = [[
+
+     free(parser->memo);
+     parser->memo = NULL;
+     parser->memo_cap = 0;]]
+  elseif (memo_count or 0) > 0 then
     memo_init = [[
 
   for (int i = 0; i < PGEN_MEMO_COUNT; i++) {
@@ -1987,8 +4393,34 @@ function generator.generate_c_core_functions(parser_name, start_rule, indenters,
   }]]
   end
 
+  local memo_alloc = ""
+  if (memo.replay_count or 0) > 0 then
+    memo_init = memo_init .. [[
+
+  for (int i = 0; i < PGEN_REPLAY_COUNT; i++) {
+    parser->replay[i].pos = 0;  // empty slot
+  }]]
+    memo_null = memo_null .. [[
+
+  parser->replay_starts = NULL;]]
+    memo_alloc = [[
+
+  parser->replay_starts = malloc(PGEN_REPLAY_COUNT * PGEN_MEMO_CAPS * PGEN_CAP_ENTRY_MAX);
+  if (!parser->replay_starts) {
+    PGEN_FATAL(parser, "pgen: out of memory initializing parser");
+  }
+  parser->replay_data = (uint64_t*)parser->replay_starts + PGEN_REPLAY_COUNT * PGEN_MEMO_CAPS;
+  parser->replay_kinds = (unsigned char*)((uint64_t*)parser->replay_data + PGEN_REPLAY_COUNT * PGEN_MEMO_CAPS);]]
+    memo_free = memo_free .. [[
+
+     free(parser->replay_starts);
+     parser->replay_starts = NULL;]]
+  end
+
   local ind_null = ""
-  local ind_init = ""
+  local ind_alloc = ""
+  local ind_reset = ""
+  local ind_trim = ""
   local ind_free = ""
 
   if #indenters > 0 then
@@ -2006,21 +4438,38 @@ function generator.generate_c_core_functions(parser_name, start_rule, indenters,
     parser->ind_stacks[i].items = NULL;
   }]]
 
-    ind_init = template_code([[
+    ind_alloc = [[
 
 
-  // Initialize indenter stacks (each starts holding its initial value)
-  static const int pgen_ind_initials[PGEN_IND_STACK_COUNT] = { $INITIALS$ };
   for (int i = 0; i < PGEN_IND_STACK_COUNT; i++) {
     parser->ind_stacks[i].items = (int*)malloc(8 * sizeof(int));
     if (!parser->ind_stacks[i].items) {
-      luaL_error(L, "pgen: out of memory initializing parser");
+      PGEN_FATAL(parser, "pgen: out of memory initializing parser");
     }
     parser->ind_stacks[i].cap = 8;
+    parser->ind_stacks[i].size = 0;
+  }]]
+
+    ind_reset = template_code([[
+
+
+  // Reset indenter stacks (each starts holding its initial value)
+  static const int pgen_ind_initials[PGEN_IND_STACK_COUNT] = { $INITIALS$ };
+  for (int i = 0; i < PGEN_IND_STACK_COUNT; i++) {
     parser->ind_stacks[i].size = 1;
     parser->ind_stacks[i].items[0] = pgen_ind_initials[i];
   }
-]], {INITIALS = table.concat(initials, ", ")})
+  parser->trail_len = 0;]], {INITIALS = table.concat(initials, ", ")})
+
+    ind_trim = [[
+
+  if (parser->trail_cap > parser->trim) {
+    PgenTrailEntry *trail = (PgenTrailEntry*)realloc(parser->trail, parser->trim * sizeof(PgenTrailEntry));
+    if (trail) {
+      parser->trail = trail;
+      parser->trail_cap = parser->trim;
+    }
+  }]]
 
     ind_free = [[
 
@@ -2032,24 +4481,88 @@ function generator.generate_c_core_functions(parser_name, start_rule, indenters,
      parser->trail = NULL;]]
   end
 
+  return {
+    MEMO_INIT = memo_init,
+    MEMO_NULL = memo_null,
+    MEMO_ALLOC = memo_alloc,
+    MEMO_TRIM = memo_trim,
+    MEMO_FREE = memo_free,
+    IND_NULL = ind_null,
+    IND_ALLOC = ind_alloc,
+    IND_RESET = ind_reset,
+    IND_TRIM = ind_trim,
+    IND_FREE = ind_free
+  }
+end
+
+-- Generate core C parser functions (_new, _reset, _init, _trim, _free)
+function generator.generate_c_core_functions(parser_name, start_rule, indenters, memo)
+  local vars = generator.generate_parser_state_code(indenters, memo)
+  vars.PARSER_NAME = parser_name
+  vars.START_RULE = start_rule
+
   return template_code([[
-#define PGEN_PARSER_MT "pgen.$PARSER_NAME$"
+// Registry ref of the parser userdata metatable. Held by ref rather than
+// by registry name: modules compiled with the same parser_name would
+// otherwise share one metatable, and with it each other's handle methods.
+static int __parser_mt_ref = LUA_NOREF;
 
-// Initialize a parser anchored in a Lua userdata (left on the stack). Its
+// Allocate a parser anchored in a Lua userdata (left on the stack). Its
 // metatable's __gc frees the owned allocations, so a Lua error unwinding
 // out of a parse (transform/Cmt callbacks, recursion depth, out of memory)
-// cannot leak them.
-static Parser* $PARSER_NAME$_init(const char *input, lua_State *L) {
+// cannot leak them. The same userdata backs parser handles from new(),
+// which keep their buffers between parses.
+static Parser* $PARSER_NAME$_new(lua_State *L) {
   Parser *parser = (Parser*)lua_newuserdata(L, sizeof(Parser));
 
   // Null the owned pointers before attaching the metatable so __gc is
   // safe even if a later allocation fails mid-init
-  parser->caps = NULL;$IND_NULL$
-  luaL_getmetatable(L, PGEN_PARSER_MT);
+  parser->cap_starts = NULL;
+  parser->stream = NULL;
+  parser->enc = NULL;$MEMO_NULL$$IND_NULL$
+  lua_rawgeti(L, LUA_REGISTRYINDEX, __parser_mt_ref);
   lua_setmetatable(L, -2);
 
+  parser->L = L;
+  parser->busy = false;
+  parser->trim = 0;
+  parser->stream_off = 0;
+  parser->stream_len = 0;
+  parser->stream_cap = 0;
+  parser->stream_need = 0;
+  parser->enc_len = 0;
+  parser->enc_cap = 0;
+
+  parser->cap_len = 0;
+  parser->cap_wide = false;
+  if (!pgen_cap_resize(parser, 64)) {
+    luaL_error(L, "pgen: out of memory initializing parser");
+  }$MEMO_ALLOC$$IND_ALLOC$
+  return parser;
+}
+
+// Prepare a parser for a parse of input. Only per-parse state is reset:
+// the capture log, indenter stacks and trail keep their allocations. The
+// parse window starts as the whole subject; see pgen_set_window.
+static void $PARSER_NAME$_reset(Parser *parser, const char *input, size_t input_len, lua_State *L) {
+#ifndef PGEN_CAP_OFFSET64
+  // Switch the log's offset width when this subject needs the other one.
+  // The log is empty between parses, so it is reallocated, not converted.
+  bool wide = input_len > UINT32_MAX;
+  if (wide != parser->cap_wide) {
+    parser->cap_len = 0;
+    parser->cap_wide = wide;
+    if (!pgen_cap_resize(parser, parser->cap_cap)) {
+      parser->cap_wide = !wide;
+      luaL_error(L, "pgen: out of memory growing capture log");
+    }
+  }
+#endif
   parser->input = input;
-  parser->input_len = strlen(input);
+  parser->input_len = input_len;
+  parser->subject_len = input_len;
+  parser->partial = false;
+  parser->starved = 0;
   parser->pos = 0;
   parser->depth = 0;
   parser->success = true;
@@ -2059,34 +4572,60 @@ static Parser* $PARSER_NAME$_init(const char *input, lua_State *L) {
   parser->furthest_fail = 0;
   parser->top = lua_gettop(L);
   parser->stack_claimed = parser->top;
+  parser->lazy_anchor = 0;
+  parser->lazy_tables = false;
+  parser->enc_format = 0;
+  parser->ev_base = 0;
+  parser->ev_count = 0;
+  parser->commit_fn = 0;
+  parser->subject_idx = 0;
   parser->L = L;
+  parser->cap_len = 0;$MEMO_INIT$$IND_RESET$
+}
 
-  parser->caps = (PgenCap*)malloc(64 * sizeof(PgenCap));
-  if (!parser->caps) {
-    luaL_error(L, "pgen: out of memory initializing parser");
-  }
-  parser->cap_len = 0;
-  parser->cap_cap = 64;$MEMO_INIT$$IND_INIT$
+// Allocate and reset a single-use parser (see _new)
+static Parser* $PARSER_NAME$_init(const char *input, size_t input_len, lua_State *L) {
+  Parser *parser = $PARSER_NAME$_new(L);
+  $PARSER_NAME$_reset(parser, input, input_len, L);
   return parser;
 }
 
+// Apply a handle's high-water policy: buffers that grew past parser->trim
+// entries during the last parse are shrunk back to it. A failed shrink
+// keeps the larger buffer.
+static void $PARSER_NAME$_trim(Parser *parser) {
+  if (parser->trim == 0) {
+    return;
+  }
+  if (parser->cap_cap > parser->trim) {
+    parser->cap_len = 0;  // the log was consumed by the last parse
+    pgen_cap_resize(parser, parser->trim);
+  }$MEMO_TRIM$$IND_TRIM$
+}
+
+// Free what only a parse in progress uses (memo, indenter stacks, stream
+// and encoder buffers) and shrink the capture log to the entries it holds:
+// what a parse_lazy document keeps alive after its parse. Idempotent.
+static void $PARSER_NAME$_release(Parser *parser) {$MEMO_FREE$$IND_FREE$
+  free(parser->stream);
+  parser->stream = NULL;
+  free(parser->enc);
+  parser->enc = NULL;
+  if (parser->cap_starts && parser->cap_cap > parser->cap_len) {
+    pgen_cap_resize(parser, parser->cap_len > 0 ? parser->cap_len : 1);
+  }
+}
 
 // Free the parser's owned allocations. Idempotent: called eagerly on
 // normal completion and again from __gc, which also covers error unwinds
 static void $PARSER_NAME$_free(Parser *parser) {
-  if (parser) {$IND_FREE$
-     free(parser->caps);
-     parser->caps = NULL;
+  if (parser) {
+     free(parser->cap_starts);
+     parser->cap_starts = NULL;
+     $PARSER_NAME$_release(parser);
   }
 }
-]], {
-    PARSER_NAME = parser_name,
-    START_RULE = start_rule,
-    MEMO_INIT = memo_init,
-    IND_NULL = ind_null,
-    IND_INIT = ind_init,
-    IND_FREE = ind_free
-  })
+]], vars)
 end
 
 -- Generate C code for the Lua module interface
@@ -2094,6 +4633,21 @@ function generator.generate_lua_module_code(parser_name, start_rule, cmt_codes,
   cmt_codes = cmt_codes or {}
   local cmt_init = #cmt_codes > 0 and "__cmt_init(L);" or ""
   local const_init = has_consts and "__const_init(L);" or ""
+  -- Cmt callbacks take the subject as a string: a streaming attempt makes
+  -- one from the buffer up front rather than one per call
+  local stream_subject, stream_subject_idx = "", ""
+  for _, cmt in ipairs(cmt_codes) do
+    if cmt.kind == "cmt" then
+      stream_subject = [[
+
+  // the buffered input as a Lua string at index 2, for Cmt callbacks
+  lua_pushlstring(L, parser->stream + parser->stream_off, parser->stream_len - parser->stream_off);]]
+      stream_subject_idx = [[
+
+  parser->subject_idx = 2;]]
+      break
+    end
+  end
 
   return template_code([[
 // --- Lua Module Interface ---
@@ -2104,28 +4658,28 @@ static int l_$PARSER_NAME$_gc(lua_State *L) {
   return 0;
 }
 
-// Lua wrapper function
-static int l_$PARSER_NAME$_parse(lua_State *L) {
-  // Check type and get the input string
-  if (!lua_isstring(L, 1)) {
-    return luaL_error(L, "Expected string argument for parsing");
-  }
-  const char *input = lua_tostring(L, 1);
-  if (!input) {
-      // Should not happen if lua_isstring passed, but good practice
-      return luaL_error(L, "Failed to get string argument");
-  }
-
-  // Initialize the parser (a userdata anchored on the stack; see _init)
-  Parser *parser = $PARSER_NAME$_init(input, L);
-
-  int initial_stack_size = lua_gettop(parser->L);
+// Run the start rule over a reset parser and push parse()'s return values:
+// the captures, the position after the match when there are none, or
+// nil plus failure info. Returns the number of values pushed, or -1 when a
+// streaming parse starved (see handle:feed) and nothing was pushed. A
+// nonzero lazy_anchor is the stack index of a parse_lazy document's anchor:
+// table captures are then returned as proxies into it.
+static int $PARSER_NAME$_run(Parser *parser, int lazy_anchor) {
+  lua_State *L = parser->L;
+  int initial_stack_size = lua_gettop(L);
 
+  PGEN_MEMO_PREPARE(parser);
   parse_$START_RULE$(parser);
 
-  int final_stack_size = lua_gettop(parser->L);
+  int final_stack_size = lua_gettop(L);
   assert(parser->top == final_stack_size && "Shadow stack top out of sync.");
 
+  if (parser->starved) {
+    // the outcome depends on input that hasn't been fed yet; materializing
+    // captures (and running Cfn callbacks) waits for a final attempt
+    return -1;
+  }
+
   // Return nil and error info on failure
   if (!parser->success) {
     assert(final_stack_size == initial_stack_size && "Unexpected stack size change on parse failure.");
@@ -2135,7 +4689,6 @@ static int l_$PARSER_NAME$_parse(lua_State *L) {
       // Labeled failure: return nil, label, position
       lua_pushstring(L, parser->throw_label);
       lua_pushinteger(L, parser->throw_pos + 1);  // 1-indexed for Lua
-      $PARSER_NAME$_free(parser);
       return 3;
     } else {
       // Ordinary failure: return nil, message (PGEN_ERRORS builds only) and
@@ -2146,23 +4699,46 @@ static int l_$PARSER_NAME$_parse(lua_State *L) {
       lua_pushnil(L);
 #endif
       lua_pushinteger(L, parser->furthest_fail + 1);
-      $PARSER_NAME$_free(parser);
       return 3;
     }
   }
 
+  if (parser->enc_format) {
+    // parse_to_buffer: encode straight from the log
+    return pgen_buf_results(parser, initial_stack_size);
+  }
+  if (parser->ev_base) {
+    // parse_events: replay the log to the handlers
+    return pgen_ev_results(parser, initial_stack_size);
+  }
+
   // Materialize the capture log into return values. Named groups produce
   // no top-level values (they only matter inside Ct).
   int cmt_slots = parser->top - initial_stack_size;  // lingering Cmt values
+  if (lazy_anchor) {
+    // the Cmt values must outlive this call: keep them in the document
+    pgen_checkstack(parser, 2);
+    lua_rawgeti(L, lazy_anchor, PGEN_LAZY_VALUES);
+    for (int idx = initial_stack_size + 1; idx <= initial_stack_size + cmt_slots; idx++) {
+      lua_pushvalue(L, idx);
+      lua_rawseti(L, -2, idx);
+    }
+    lua_pop(L, 1);
+    parser->lazy_anchor = lazy_anchor;
+    parser->lazy_tables = true;
+  }
+
   int result_count = 0;
   size_t cap_i = 0;
   while (cap_i < parser->cap_len) {
-    if (parser->caps[cap_i].kind == PGEN_CAP_GROUP_OPEN) {
+    if (PGEN_CAP_KIND(parser, cap_i) == PGEN_CAP_GROUP_OPEN) {
       pgen_cap_skip(parser, &cap_i);
     } else {
       result_count += pgen_cap_eval(parser, &cap_i);
     }
   }
+  parser->lazy_anchor = 0;
+  parser->lazy_tables = false;
 
   // Drop the lingering Cmt value slots sitting beneath the results
   for (int i = 0; i < cmt_slots; i++) {
@@ -2170,19 +4746,519 @@ static int l_$PARSER_NAME$_parse(lua_State *L) {
   }
 
   if (result_count > 0) {
-    $PARSER_NAME$_free(parser);
     return result_count;
   }
 
   // Success case with no captures
   lua_pushinteger(L, parser->pos + 1);
-  $PARSER_NAME$_free(parser);
   return 1; // Return position of consumed input
 }
 
+// Narrow a reset parser to the window given by the optional 1-based
+// inclusive (init, stop) arguments at stack indices idx and idx + 1.
+// Negative values count from the end of the subject and out-of-range
+// values are clamped, as with string.sub. Matching starts at init and
+// treats stop as the end of input, but positions stay absolute, so Cp,
+// failure positions and Cmt see offsets into the whole subject.
+static void pgen_set_window(lua_State *L, Parser *parser, int idx) {
+  lua_Integer len = (lua_Integer)parser->subject_len;
+  lua_Integer init = luaL_optinteger(L, idx, 1);
+  lua_Integer stop = luaL_optinteger(L, idx + 1, len);
+  if (init < 0) init += len + 1;
+  if (init < 1) init = 1;
+  if (init > len + 1) init = len + 1;
+  if (stop < 0) stop += len + 1;
+  if (stop > len) stop = len;
+  if (stop < init - 1) stop = init - 1;
+  parser->pos = (size_t)(init - 1);
+  parser->furthest_fail = parser->pos;
+  parser->input_len = (size_t)stop;
+}
+
+// parse(input, [init], [stop])
+static int l_$PARSER_NAME$_parse(lua_State *L) {
+  // Check type and get the input string
+  if (!lua_isstring(L, 1)) {
+    return luaL_error(L, "Expected string argument for parsing");
+  }
+  // Take the length from Lua: the input may contain NUL bytes, and it
+  // saves a strlen pass over the whole subject
+  size_t input_len;
+  const char *input = lua_tolstring(L, 1, &input_len);
+  if (!input) {
+      // Should not happen if lua_isstring passed, but good practice
+      return luaL_error(L, "Failed to get string argument");
+  }
+
+  // Initialize the parser (a userdata anchored on the stack above the
+  // arguments; see _new)
+  lua_settop(L, 3);
+  Parser *parser = $PARSER_NAME$_init(input, input_len, L);
+  parser->subject_idx = 1;
+  pgen_set_window(L, parser, 2);
+
+  int result_count = $PARSER_NAME$_run(parser, 0);
+  $PARSER_NAME$_free(parser);
+  return result_count;
+}
+
+// parse_to_buffer(input, format, [init], [stop]): parse() with the
+// captures encoded into a string, as "msgpack" or "native" (see
+// pgen_buf_results), instead of built as Lua values
+static int l_$PARSER_NAME$_parse_to_buffer(lua_State *L) {
+  static const char *const formats[] = {"msgpack", "native", NULL};
+  if (!lua_isstring(L, 1)) {
+    return luaL_error(L, "Expected string argument for parsing");
+  }
+  size_t input_len;
+  const char *input = lua_tolstring(L, 1, &input_len);
+  int format = PGEN_BUF_MSGPACK + luaL_checkoption(L, 2, NULL, formats);
+
+  lua_settop(L, 4);
+  Parser *parser = $PARSER_NAME$_init(input, input_len, L);
+  parser->subject_idx = 1;
+  parser->enc_format = format;
+  pgen_set_window(L, parser, 3);
+
+  int result_count = $PARSER_NAME$_run(parser, 0);
+  $PARSER_NAME$_free(parser);
+  return result_count;
+}
+
+// parse_events(input, handlers, [init], [stop]): parse() with the captures
+// replayed as calls to handlers.open/value/field/close, or batched to
+// handlers.batch, instead of built as Lua values (see pgen_ev_results).
+// Returns the position after the match, or parse()'s failure results.
+static int l_$PARSER_NAME$_parse_events(lua_State *L) {
+  static const char *const handler_names[] = {"open", "value", "field", "close", "batch"};
+  if (!lua_isstring(L, 1)) {
+    return luaL_error(L, "Expected string argument for parsing");
+  }
+  size_t input_len;
+  const char *input = lua_tolstring(L, 1, &input_len);
+  luaL_checktype(L, 2, LUA_TTABLE);
+
+  lua_settop(L, 4);
+  for (int h = 0; h < PGEN_EV_BATCH; h++) {
+    lua_getfield(L, 2, handler_names[h]);
+  }
+  lua_createtable(L, lua_isnil(L, -1) ? 0 : 2 * PGEN_EV_BATCH_SIZE, 0);
+  Parser *parser = $PARSER_NAME$_init(input, input_len, L);  // above the slots
+  parser->subject_idx = 1;
+  parser->ev_base = 4;
+  pgen_set_window(L, parser, 3);
+
+  int result_count = $PARSER_NAME$_run(parser, 0);
+  $PARSER_NAME$_free(parser);
+  return result_count;
+}
+
+// parse_stream(input, consumer, [init], [stop]): parse() that calls
+// consumer with the captures of each pgen.Commit iteration as it completes
+// (see pgen_commit) instead of keeping them for the results
+static int l_$PARSER_NAME$_parse_stream(lua_State *L) {
+  if (!lua_isstring(L, 1)) {
+    return luaL_error(L, "Expected string argument for parsing");
+  }
+  size_t input_len;
+  const char *input = lua_tolstring(L, 1, &input_len);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+
+  lua_settop(L, 4);
+  Parser *parser = $PARSER_NAME$_init(input, input_len, L);
+  parser->subject_idx = 1;
+  parser->commit_fn = 2;
+  pgen_set_window(L, parser, 3);
+
+  int result_count = $PARSER_NAME$_run(parser, 0);
+  $PARSER_NAME$_free(parser);
+  return result_count;
+}
+
+// parse_lazy(input, [init], [stop]): parse() whose table captures are
+// proxies built a level at a time on first access. The parser, holding the
+// capture log, stays alive in the document anchor until no proxy into it
+// is left; everything else it owns is released once the parse succeeds.
+static int l_$PARSER_NAME$_parse_lazy(lua_State *L) {
+  if (!lua_isstring(L, 1)) {
+    return luaL_error(L, "Expected string argument for parsing");
+  }
+  size_t input_len;
+  const char *input = lua_tolstring(L, 1, &input_len);
+
+  lua_settop(L, 3);
+  Parser *parser = $PARSER_NAME$_new(L);  // at index 4
+  lua_createtable(L, 4, 0);  // the anchor, at index 5
+  lua_pushvalue(L, 4);
+  lua_rawseti(L, 5, PGEN_LAZY_PARSER);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, 5, PGEN_LAZY_INPUT);
+  lua_newtable(L);
+  lua_rawseti(L, 5, PGEN_LAZY_VALUES);
+  lua_newtable(L);
+  lua_rawseti(L, 5, PGEN_LAZY_CACHE);
+
+  $PARSER_NAME$_reset(parser, input, input_len, L);
+  parser->subject_idx = 1;
+  pgen_set_window(L, parser, 2);
+  int result_count = $PARSER_NAME$_run(parser, 5);
+  if (parser->success) {
+    $PARSER_NAME$_release(parser);
+  } else {
+    $PARSER_NAME$_free(parser);
+  }
+  return result_count;
+}
+
+// Push a table built from the proxy at idx, whose anchor is at stack index
+// anchor: one level with nested tables as proxies, or with lazy_tables
+// false, the whole subtree. The parser is pointed at this stack for the
+// build; a Cfn callback may access another proxy of the same document
+// meanwhile, so its state is restored afterwards.
+static void pgen_lazy_build(lua_State *L, int idx, int anchor, bool lazy_tables) {
+  PgenLazy *proxy = (PgenLazy*)lua_touserdata(L, idx);
+  Parser *parser = proxy->parser;
+  lua_State *saved_L = parser->L;
+  int saved_top = parser->top;
+  int saved_claimed = parser->stack_claimed;
+  int saved_anchor = parser->lazy_anchor;
+  bool saved_tables = parser->lazy_tables;
+  parser->L = L;
+  parser->top = lua_gettop(L);
+  parser->stack_claimed = parser->top;
+  parser->lazy_anchor = anchor;
+  parser->lazy_tables = lazy_tables;
+
+  pgen_cap_build_table(parser, proxy->open);
+
+  parser->L = saved_L;
+  parser->top = saved_top;
+  parser->stack_claimed = saved_claimed;
+  parser->lazy_anchor = saved_anchor;
+  parser->lazy_tables = saved_tables;
+}
+
+// Push the level table of the proxy at idx, building it on first access
+static void pgen_lazy_level(lua_State *L, int idx) {
+  PgenLazy *proxy = (PgenLazy*)lua_touserdata(L, idx);
+  pgen_getuservalue(L, idx);
+  int anchor = lua_gettop(L);
+  lua_rawgeti(L, anchor, PGEN_LAZY_CACHE);
+  lua_pushinteger(L, (lua_Integer)proxy->open);
+  lua_rawget(L, -2);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    pgen_lazy_build(L, idx, anchor, true);
+    lua_pushinteger(L, (lua_Integer)proxy->open);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, anchor + 1);
+  }
+  lua_replace(L, anchor);
+  lua_settop(L, anchor);
+}
+
+// Is the value at idx a parse_lazy proxy?
+static bool pgen_is_lazy(lua_State *L, int idx) {
+  bool lazy = false;
+  if (lua_type(L, idx) == LUA_TUSERDATA && lua_getmetatable(L, idx)) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, __lazy_mt_ref);
+    lazy = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+  }
+  return lazy;
+}
+
+static int l_pgen_lazy_index(lua_State *L) {
+  lua_settop(L, 2);
+  pgen_lazy_level(L, 1);
+  lua_pushvalue(L, 2);
+  lua_rawget(L, 3);
+  return 1;
+}
+
+static int l_pgen_lazy_len(lua_State *L) {
+  pgen_lazy_level(L, 1);
+  lua_pushinteger(L, (lua_Integer)pgen_rawlen(L, -1));
+  return 1;
+}
+
+static int l_pgen_lazy_next(lua_State *L) {
+  lua_settop(L, 2);
+  return lua_next(L, 1) ? 2 : 0;
+}
+
+static int l_pgen_lazy_pairs(lua_State *L) {
+  pgen_lazy_level(L, 1);
+  lua_pushcfunction(L, l_pgen_lazy_next);
+  lua_insert(L, -2);
+  lua_pushnil(L);
+  return 3;
+}
+
+static int l_pgen_lazy_inext(lua_State *L) {
+  lua_Integer i = luaL_checkinteger(L, 2) + 1;
+  lua_pushinteger(L, i);
+  lua_rawgeti(L, 1, (int)i);
+  return lua_isnil(L, -1) ? 1 : 2;
+}
+
+static int l_pgen_lazy_ipairs(lua_State *L) {
+  pgen_lazy_level(L, 1);
+  lua_pushcfunction(L, l_pgen_lazy_inext);
+  lua_insert(L, -2);
+  lua_pushinteger(L, 0);
+  return 3;
+}
+
+// expand(value): the level table behind a proxy, for iterating it with
+// pairs/ipairs on Lua 5.1; any other value is returned unchanged
+static int l_pgen_lazy_expand(lua_State *L) {
+  lua_settop(L, 1);
+  if (pgen_is_lazy(L, 1)) {
+    pgen_lazy_level(L, 1);
+  }
+  return 1;
+}
+
+// materialize(value): a proxy's whole subtree as plain tables, built
+// afresh (Cfn callbacks run again); any other value is returned unchanged
+static int l_pgen_lazy_materialize(lua_State *L) {
+  lua_settop(L, 1);
+  if (pgen_is_lazy(L, 1)) {
+    pgen_getuservalue(L, 1);
+    pgen_lazy_build(L, 1, 2, false);
+  }
+  return 1;
+}
+
+// handle:parse(input, [init], [stop]) body, run under lua_pcall by
+// l_$PARSER_NAME$_handle_parse with (handle, input, init, stop) as its
+// arguments
+static int l_$PARSER_NAME$_handle_run(lua_State *L) {
+  Parser *parser = (Parser*)lua_touserdata(L, 1);
+  size_t input_len;
+  const char *input = lua_tolstring(L, 2, &input_len);
+  $PARSER_NAME$_reset(parser, input, input_len, L);
+  parser->subject_idx = 2;
+  pgen_set_window(L, parser, 3);
+  return $PARSER_NAME$_run(parser, 0);
+}
+
+// Check that argument 1 is a parser handle that isn't mid-parse
+static Parser* pgen_check_handle(lua_State *L, const char *method) {
+  Parser *parser = NULL;
+  if (lua_getmetatable(L, 1)) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, __parser_mt_ref);
+    if (lua_rawequal(L, -1, -2)) {
+      parser = (Parser*)lua_touserdata(L, 1);
+    }
+    lua_pop(L, 2);
+  }
+  if (!parser) {
+    luaL_error(L, "Expected a parser handle (use handle:%s)", method);
+  }
+  if (parser->busy) {
+    // the handle's buffers are in use further down the C stack (called
+    // again from one of its own Cmt callbacks)
+    luaL_error(L, "pgen: parser handle is already parsing");
+  }
+  return parser;
+}
+
+// Call upvalue 1 (a handle method body) with the nargs values on the stack,
+// protected so the handle is released (and trimmed) even when a callback
+// raises an error; the error is then rethrown unchanged
+static int $PARSER_NAME$_handle_call(lua_State *L, Parser *parser, int nargs) {
+  lua_settop(L, nargs);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, 1);
+  parser->busy = true;
+  int status = lua_pcall(L, nargs, LUA_MULTRET, 0);
+  parser->busy = false;
+  $PARSER_NAME$_trim(parser);
+  if (status != 0) {
+    return lua_error(L);
+  }
+  return lua_gettop(L);
+}
+
+// handle:parse(input): same results as the module's parse(), but reuses the
+// handle's capture log, trail and indenter stacks. Upvalue 1 is
+// l_$PARSER_NAME$_handle_run.
+static int l_$PARSER_NAME$_handle_parse(lua_State *L) {
+  Parser *parser = pgen_check_handle(L, "parse");
+  if (!lua_isstring(L, 2)) {
+    return luaL_error(L, "Expected string argument for parsing");
+  }
+  return $PARSER_NAME$_handle_call(L, parser, 4);
+}
+
+// Streaming body, run protected with (handle, partial) as its arguments:
+// parse the unconsumed input, as a partial parse when partial is true. A
+// final result consumes its input: the match on success, everything on
+// failure or at the end of the stream. A starved partial parse returns
+// nil, "need more input" and keeps the input. A parse can't be suspended
+// mid-match, so the next attempt matches the record again from its start,
+// but only once as much input as the starved checks need has been fed:
+// before that it could only starve the same way.
+static int l_$PARSER_NAME$_stream_run(lua_State *L) {
+  Parser *parser = (Parser*)lua_touserdata(L, 1);
+  bool partial = lua_toboolean(L, 2);
+  size_t len = parser->stream_len - parser->stream_off;
+  if (partial && len < parser->stream_need) {
+    lua_pushnil(L);
+    lua_pushliteral(L, "need more input");
+    return 2;
+  }
+  // keep the handle at index 1: it may be the only reference to it
+  // (parser.new():feed(s)), and a collection mid-parse must not free it
+  lua_settop(L, 1);$STREAM_SUBJECT$
+  $PARSER_NAME$_reset(parser, parser->stream + parser->stream_off, len, L);
+  parser->partial = partial;$STREAM_SUBJECT_IDX$
+
+  int result_count = $PARSER_NAME$_run(parser, 0);
+  if (result_count < 0) {
+    parser->stream_need = parser->starved;
+    lua_pushnil(L);
+    lua_pushliteral(L, "need more input");
+    return 2;
+  }
+
+  // consumed input stays in the buffer until feed needs the room
+  parser->stream_need = 0;
+  parser->stream_off += parser->success && partial ? parser->pos : len;
+  if (parser->stream_off == parser->stream_len) {
+    parser->stream_off = 0;
+    parser->stream_len = 0;
+  }
+  return result_count;
+}
+
+// handle:feed(chunk): append chunk to the handle's input buffer and try to
+// match the start rule against everything buffered so far. Returns
+// parse()'s results once they can't change with more input, with positions
+// relative to the start of the match, or nil, "need more input". Upvalue 1
+// is l_$PARSER_NAME$_stream_run.
+static int l_$PARSER_NAME$_handle_feed(lua_State *L) {
+  Parser *parser = pgen_check_handle(L, "feed");
+  if (!lua_isstring(L, 2)) {
+    return luaL_error(L, "Expected string argument for feed");
+  }
+  size_t chunk_len;
+  const char *chunk = lua_tolstring(L, 2, &chunk_len);
+
+  if (parser->stream_len + chunk_len > parser->stream_cap && parser->stream_off > 0) {
+    // drop the consumed input before growing the buffer
+    parser->stream_len -= parser->stream_off;
+    memmove(parser->stream, parser->stream + parser->stream_off, parser->stream_len);
+    parser->stream_off = 0;
+  }
+  if (parser->stream_len + chunk_len > parser->stream_cap) {
+    size_t cap = parser->stream_cap ? parser->stream_cap : 256;
+    while (cap < parser->stream_len + chunk_len) {
+      cap *= 2;
+    }
+    char *stream = (char*)realloc(parser->stream, cap);
+    if (!stream) {
+      return luaL_error(L, "pgen: out of memory buffering input");
+    }
+    parser->stream = stream;
+    parser->stream_cap = cap;
+  }
+  if (chunk_len > 0) {
+    memcpy(parser->stream + parser->stream_len, chunk, chunk_len);
+    parser->stream_len += chunk_len;
+  }
+
+  lua_settop(L, 1);
+  lua_pushboolean(L, 1);
+  return $PARSER_NAME$_handle_call(L, parser, 2);
+}
+
+// handle:finish(): end the stream and return parse()'s results for the
+// buffered input, treating its end as the end of input. The buffer is
+// emptied either way, so the handle can start a new stream. Upvalue 1 is
+// l_$PARSER_NAME$_stream_run.
+static int l_$PARSER_NAME$_handle_finish(lua_State *L) {
+  Parser *parser = pgen_check_handle(L, "finish");
+  lua_settop(L, 1);
+  lua_pushboolean(L, 0);
+  return $PARSER_NAME$_handle_call(L, parser, 2);
+}
+
+// new([opts]): create a reusable parser handle. opts.trim optionally caps
+// the capture log (in entries) retained between parses; without it the
+// buffers stay at their high-water size.
+static int l_$PARSER_NAME$_new(lua_State *L) {
+  size_t trim = 0;
+  if (!lua_isnoneornil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_getfield(L, 1, "trim");
+    if (!lua_isnil(L, -1)) {
+      // a number, not a numeric string, and finite (NaN fails both
+      // comparisons): the (size_t) conversion of inf is undefined
+      lua_Number n = lua_tonumber(L, -1);
+      if (lua_type(L, -1) != LUA_TNUMBER || !(n >= 1 && n < (lua_Number)SIZE_MAX)) {
+        return luaL_error(L, "pgen: trim must be a positive number of entries");
+      }
+      trim = (size_t)n;
+    }
+    lua_pop(L, 1);
+  }
+
+  Parser *parser = $PARSER_NAME$_new(L);
+  parser->trim = trim;
+  return 1;
+}
+
+// Register the parser userdata metatable: __gc, plus the handle methods
+static void $PARSER_NAME$_register_mt(lua_State *L) {
+  lua_newtable(L);
+  lua_pushcfunction(L, l_$PARSER_NAME$_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_newtable(L);
+  lua_pushcfunction(L, l_$PARSER_NAME$_handle_run);
+  lua_pushcclosure(L, l_$PARSER_NAME$_handle_parse, 1);
+  lua_setfield(L, -2, "parse");
+  lua_pushcfunction(L, l_$PARSER_NAME$_stream_run);
+  lua_pushcclosure(L, l_$PARSER_NAME$_handle_feed, 1);
+  lua_setfield(L, -2, "feed");
+  lua_pushcfunction(L, l_$PARSER_NAME$_stream_run);
+  lua_pushcclosure(L, l_$PARSER_NAME$_handle_finish, 1);
+  lua_setfield(L, -2, "finish");
+  lua_setfield(L, -2, "__index");
+  __parser_mt_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  // parse_lazy proxies. __pairs/__ipairs are honored from Lua 5.2 on;
+  // expand() covers iteration on 5.1
+  lua_newtable(L);
+  lua_pushcfunction(L, l_pgen_lazy_index);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, l_pgen_lazy_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, l_pgen_lazy_pairs);
+  lua_setfield(L, -2, "__pairs");
+  lua_pushcfunction(L, l_pgen_lazy_ipairs);
+  lua_setfield(L, -2, "__ipairs");
+  __lazy_mt_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+#ifdef PGEN_INTERN
+  memset(__intern_strs, 0, sizeof(__intern_strs));
+  lua_createtable(L, PGEN_INTERN_SLOTS, 0);
+  __intern_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+#endif
+}
+
 // Lua module function registration table
 static const struct luaL_Reg $PARSER_NAME$_module[] = {
   {"parse", l_$PARSER_NAME$_parse}, // Expose l_parsername_parse as "parse" in Lua
+  {"new", l_$PARSER_NAME$_new},     // Reusable parser handles
+  {"parse_lazy", l_$PARSER_NAME$_parse_lazy},
+  {"parse_to_buffer", l_$PARSER_NAME$_parse_to_buffer},
+  {"parse_events", l_$PARSER_NAME$_parse_events},
+  {"parse_stream", l_$PARSER_NAME$_parse_stream},
+  {"expand", l_pgen_lazy_expand},
+  {"materialize", l_pgen_lazy_materialize},
   {NULL, NULL} // Sentinel
 };
 
@@ -2191,11 +5267,7 @@ static const struct luaL_Reg $PARSER_NAME$_module[] = {
 #if defined(LUA_VERSION_NUM) && LUA_VERSION_NUM >= 502
   // Lua 5.2+ uses luaL_setfuncs
   int luaopen_$PARSER_NAME$(lua_State *L) {
-    if (luaL_newmetatable(L, PGEN_PARSER_MT)) {
-      lua_pushcfunction(L, l_$PARSER_NAME$_gc);
-      lua_setfield(L, -2, "__gc");
-    }
-    lua_pop(L, 1);
+    $PARSER_NAME$_register_mt(L);
     $CONST_INIT$
     $CMT_INIT$
     luaL_newlib(L, $PARSER_NAME$_module); // Creates table and registers functions
@@ -2207,11 +5279,7 @@ static const struct luaL_Reg $PARSER_NAME$_module[] = {
   // two parsers compiled with the same parser_name in one process would
   // silently overwrite the first module's parse function.
   int luaopen_$PARSER_NAME$(lua_State *L) {
-    if (luaL_newmetatable(L, PGEN_PARSER_MT)) {
-      lua_pushcfunction(L, l_$PARSER_NAME$_gc);
-      lua_setfield(L, -2, "__gc");
-    }
-    lua_pop(L, 1);
+    $PARSER_NAME$_register_mt(L);
     $CONST_INIT$
     $CMT_INIT$
     lua_newtable(L);
@@ -2223,14 +5291,16 @@ static const struct luaL_Reg $PARSER_NAME$_module[] = {
   PARSER_NAME = parser_name,
   START_RULE = start_rule,
   CMT_INIT = cmt_init,
-  CONST_INIT = const_init
+  CONST_INIT = const_init,
+  STREAM_SUBJECT = stream_subject,
+  STREAM_SUBJECT_IDX = stream_subject_idx
 })
 end
 
 -- Generate the final combined parser main C code
-function generator.generate_parser_main(parser_name, start_rule, cmt_codes, indenters, has_consts, memo_count)
+function generator.generate_parser_main(parser_name, start_rule, cmt_codes, indenters, has_consts, memo)
   -- core C functions
-  local c_core_code = generator.generate_c_core_functions(parser_name, start_rule, indenters, memo_count)
+  local c_core_code = generator.generate_c_core_functions(parser_name, start_rule, indenters, memo)
   -- Lua module interface
   local lua_module_code = generator.generate_lua_module_code(parser_name, start_rule, cmt_codes, has_consts)
 
@@ -2269,6 +5339,72 @@ function generator.generate_trie_node_code(node, depth)
 }]]
   end
 
+  -- A path without branches (the "unction" after "f" when nothing else
+  -- starts with "f") is matched with one literal comparison instead of a
+  -- switch per byte
+  local path, path_end = {}, node
+  while true do
+    local char, child = next(path_end.children)
+    if not char or next(path_end.children, char) then
+      break
+    end
+    table.insert(path, char)
+    path_end = child
+    if path_end.is_terminal then
+      break
+    end
+  end
+
+  if #path > 1 then
+    path = table.concat(path)
+    local rest = ""
+    if path_end.is_terminal and next(path_end.children) then
+      rest = template_code([[
+
+  $CHILD_CODE$
+  if (!parser->success) {
+    // Partial match is valid: "$WORD$"
+    parser->success = true;
+  }]], {
+        CHILD_CODE = generator.generate_trie_node_code(path_end, depth + #path),
+        WORD = path_end.word
+      })
+    elseif not path_end.is_terminal then
+      rest = "\n  " .. generator.generate_trie_node_code(path_end, depth + #path)
+    end
+
+    -- the bounds check doesn't mark the parse starved: the input may leave
+    -- the path before the end of the window, which the slow path finds
+    return template_code([[$PREAMBLE$
+if (parser->pos + $LEN$ <= parser->input_len &&
+    $COMPARE$) { // $PATH$
+  parser->pos += $LEN$;$REST$
+} else {
+  // Advance to where the input leaves the path, where the per-byte
+  // switches would have failed
+  for (size_t path_i = 0; path_i < $LEN$; path_i++) {
+    if (!PGEN_AVAIL(parser, 1) || parser->input[parser->pos] != $PATH_LITERAL$[path_i]) {
+      break;
+    }
+    parser->pos++;
+  }
+  parser->success = false;
+  if (has_terminal) {
+    parser->pos = last_terminal_pos;
+    parser->success = true;
+  } else {
+    PGEN_RECORD_FURTHEST(parser);
+  }
+}]], {
+      PREAMBLE = preamble,
+      LEN = #path,
+      COMPARE = literal_compare_code(path),
+      PATH = escape_string(path),
+      PATH_LITERAL = escape_c_literal(path),
+      REST = rest
+    })
+  end
+
   -- Collect and sort cases for deterministic output
   local chars = {}
   for char in pairs(node.children) do
@@ -2313,8 +5449,8 @@ $CHILD_CODE$]], {
   end
 
   return template_code([[$PREAMBLE$
-if (parser->pos < parser->input_len) {
-  switch (parser->input[parser->pos]) {
+if (PGEN_AVAIL(parser, 1)) {
+  switch ((unsigned char)parser->input[parser->pos]) {
 $CASES$
   default:
     parser->success = false;
@@ -0,0 +1,314 @@
+-- Pieces of the c-api target: the C generator's matching code wrapped in a
+-- plain C interface instead of a Lua module. A successful parse hands the
+-- capture log itself to the caller, so nothing is materialized; Cmt and Cfn
+-- (Lua callbacks) are rejected by generator.generate.
+local c_api = {}
+local common = require("pgen.codegen_common")
+
+local template_code = common.template_code
+
+-- Public capture kinds, in the numbering of the capture log's PGEN_CAP_*
+-- enum (see generate_parser_header). VALUE (Cmt results) and the FN
+-- brackets (Cfn) can't occur in c-api logs, so they aren't exposed.
+local CAP_KINDS = {
+  {"STR", 0, "C: the text at start, len bytes long"},
+  {"CONST", 1, "Cc value: aux indexes PARSER_constants"},
+  {"NIL", 2, "Cc(nil), or Cn selecting past the last capture"},
+  {"POS", 3, "Cp: start is the position"},
+  {"TBL_OPEN", 5, "Ct: start is where the table's match began"},
+  {"TBL_CLOSE", 6, "start is where the table's match ended"},
+  {"GROUP_OPEN", 7, "Cg: aux indexes PARSER_group_names, start as Ct"},
+  {"GROUP_CLOSE", 8, "start as Ct"},
+  {"SPAN", 11, "Cspan: start and len as STR"},
+}
+
+-- The declarations a C caller needs. They lead the generated file behind an
+-- include guard, so the same text can also be written out as a header
+-- (pgen --target c-api --header FILE).
+function c_api.generate_public_declarations(parser_name)
+  local upper = parser_name:upper()
+
+  local kinds = {}
+  for _, kind in ipairs(CAP_KINDS) do
+    local name = template_code("$UPPER_NAME$_CAP_$KIND$ = $VALUE$,", {
+      UPPER_NAME = upper,
+      KIND = kind[1],
+      VALUE = kind[2]
+    })
+    table.insert(kinds, ("  %-32s // %s"):format(name,
+      (kind[3]:gsub("PARSER", parser_name))))
+  end
+
+  return template_code([[#ifndef PGEN_$UPPER_NAME$_H
+#define PGEN_$UPPER_NAME$_H
+
+#include <stddef.h>
+
+// $PARSER_NAME$ - standalone parser, callable from C without a Lua VM:
+//
+//   $PARSER_NAME$_result result;
+//   if ($PARSER_NAME$_parse(buf, len, &result) == $UPPER_NAME$_OK) {
+//     // result.caps[0 .. result.cap_len - 1]
+//   }
+//   $PARSER_NAME$_result_free(&result);
+//
+// Positions are 0-based byte offsets into buf.
+
+// Capture log entry kinds. The log is flat: the captures of a Ct or Cg sit
+// between its OPEN and CLOSE entries, nested like the patterns themselves.
+enum {
+$KINDS$
+};
+
+typedef struct {
+  int kind;      // $UPPER_NAME$_CAP_*
+  int aux;
+  size_t start;
+  size_t len;
+} $PARSER_NAME$_capture;
+
+// Cc values referenced by CONST entries
+enum {
+  $UPPER_NAME$_CONST_STRING,
+  $UPPER_NAME$_CONST_NUMBER,
+  $UPPER_NAME$_CONST_BOOLEAN
+};
+
+typedef struct {
+  int type;          // $UPPER_NAME$_CONST_*
+  const char *str;   // STRING: the bytes (NUL-terminated, may contain NUL)
+  size_t len;        // STRING: length in bytes
+  double num;        // NUMBER: the value; BOOLEAN: 0 or 1
+} $PARSER_NAME$_constant;
+
+extern const $PARSER_NAME$_constant $PARSER_NAME$_constants[];
+extern const size_t $PARSER_NAME$_constant_count;
+
+// Cg names referenced by GROUP_OPEN entries, NULL-terminated
+extern const char *const $PARSER_NAME$_group_names[];
+
+enum {
+  $UPPER_NAME$_OK,        // matched: caps holds the capture log
+  $UPPER_NAME$_NO_MATCH,  // the input doesn't match the grammar
+  $UPPER_NAME$_ERROR      // parse aborted (recursion depth, out of memory)
+};
+
+typedef struct {
+  int status;          // $UPPER_NAME$_OK, _NO_MATCH or _ERROR
+  size_t pos;          // OK: end of the match. NO_MATCH: the T() label's
+                       // position, or the furthest position a match
+                       // attempt failed at
+  const char *label;   // NO_MATCH: the T() label, NULL for ordinary failure
+  char message[256];   // NO_MATCH: failure description (PGEN_ERRORS builds
+                       // only). ERROR: what went wrong
+  $PARSER_NAME$_capture *caps;
+  size_t cap_len;
+} $PARSER_NAME$_result;
+
+// Parse buf[0 .. len - 1], filling *out. Returns out->status. Always
+// release the result with $PARSER_NAME$_result_free.
+int $PARSER_NAME$_parse(const char *buf, size_t len, $PARSER_NAME$_result *out);
+void $PARSER_NAME$_result_free($PARSER_NAME$_result *result);
+
+#endif
+]], {
+    PARSER_NAME = parser_name,
+    UPPER_NAME = upper,
+    KINDS = table.concat(kinds, "\n")
+  })
+end
+
+-- Define the constants and group names tables declared above
+function c_api.generate_tables(parser_name, const_pool, cg_names)
+  local escape_c_literal = require("pgen.generator").escape_c_literal
+  local upper = parser_name:upper()
+
+  local entries = {}
+  for _, value in ipairs(const_pool) do
+    local t = type(value)
+    if t == "string" then
+      table.insert(entries, template_code("  {$UPPER_NAME$_CONST_STRING, $STR$, $LEN$, 0},", {
+        UPPER_NAME = upper,
+        STR = escape_c_literal(value),
+        LEN = #value
+      }))
+    elseif t == "number" then
+      table.insert(entries, template_code("  {$UPPER_NAME$_CONST_NUMBER, NULL, 0, $NUM$},", {
+        UPPER_NAME = upper,
+        NUM = string.format("%.17g", value)
+      }))
+    else
+      table.insert(entries, template_code("  {$UPPER_NAME$_CONST_BOOLEAN, NULL, 0, $NUM$},", {
+        UPPER_NAME = upper,
+        NUM = value and 1 or 0
+      }))
+    end
+  end
+  if #entries == 0 then
+    -- C has no empty arrays; the count keeps the placeholder out of reach
+    table.insert(entries, "  {0, NULL, 0, 0},")
+  end
+
+  local names = {}
+  for _, name in ipairs(cg_names) do
+    table.insert(names, "  " .. escape_c_literal(name) .. ",")
+  end
+  table.insert(names, "  NULL")
+
+  return template_code([[// --- Constants and group names ---
+
+const $PARSER_NAME$_constant $PARSER_NAME$_constants[] = {
+$ENTRIES$
+};
+const size_t $PARSER_NAME$_constant_count = $COUNT$;
+
+const char *const $PARSER_NAME$_group_names[] = {
+$NAMES$
+};
+
+]], {
+    PARSER_NAME = parser_name,
+    ENTRIES = table.concat(entries, "\n"),
+    COUNT = #const_pool,
+    NAMES = table.concat(names, "\n")
+  })
+end
+
+-- Generate the C entry points: PARSER_parse runs the start rule over a
+-- heap-allocated parser and moves its capture log into the result
+function c_api.generate_main(parser_name, start_rule, indenters, memo)
+  local generator = require("pgen.generator")
+  local vars = generator.generate_parser_state_code(indenters, memo)
+  vars.PARSER_NAME = parser_name
+  vars.UPPER_NAME = parser_name:upper()
+  vars.START_RULE = start_rule
+
+  local checks = {}
+  for _, kind in ipairs(CAP_KINDS) do
+    table.insert(checks, template_code("(int)$UPPER_NAME$_CAP_$KIND$ == (int)PGEN_CAP_$KIND$", {
+      UPPER_NAME = vars.UPPER_NAME,
+      KIND = kind[1]
+    }))
+  end
+  vars.KIND_CHECKS = table.concat(checks, " &&\n  ")
+
+  return template_code([[
+// --- C API ---
+
+// The public capture kinds must number the same as the capture log's
+typedef char pgen_cap_kinds_match[(
+  $KIND_CHECKS$) ? 1 : -1];
+
+static void $PARSER_NAME$_free(Parser *parser) {
+  if (parser) {$MEMO_FREE$$IND_FREE$
+     free(parser->cap_starts);
+     free(parser);
+  }
+}
+
+int $PARSER_NAME$_parse(const char *buf, size_t len, $PARSER_NAME$_result *out) {
+  jmp_buf fatal;
+
+  out->status = $UPPER_NAME$_ERROR;
+  out->pos = 0;
+  out->label = NULL;
+  out->message[0] = '\0';
+  out->caps = NULL;
+  out->cap_len = 0;
+
+  Parser *parser = (Parser*)malloc(sizeof(Parser));
+  if (!parser) {
+    snprintf(out->message, sizeof(out->message), "pgen: out of memory initializing parser");
+    return out->status;
+  }
+  // Null the owned pointers first so a fatal error during setup frees
+  // only what was allocated
+  parser->cap_starts = NULL;$MEMO_NULL$$IND_NULL$
+  parser->fatal = &fatal;
+  if (setjmp(fatal) != 0) {
+    // PGEN_FATAL: recursion depth exceeded or out of memory
+    snprintf(out->message, sizeof(out->message), "%s", parser->error_message);
+    $PARSER_NAME$_free(parser);
+    return out->status;
+  }
+
+  parser->cap_len = 0;
+  parser->cap_wide = len > UINT32_MAX;
+  if (!pgen_cap_resize(parser, 64)) {
+    PGEN_FATAL(parser, "pgen: out of memory initializing parser");
+  }$MEMO_ALLOC$$IND_ALLOC$
+
+  parser->input = buf;
+  parser->input_len = len;
+  parser->subject_len = len;
+  parser->partial = false;
+  parser->starved = 0;
+  parser->pos = 0;
+  parser->depth = 0;
+  parser->success = true;
+  parser->error_message[0] = '\0';
+  parser->throw_label = NULL;
+  parser->throw_pos = 0;
+  parser->furthest_fail = 0;$MEMO_INIT$$IND_RESET$
+
+  PGEN_MEMO_PREPARE(parser);
+  parse_$START_RULE$(parser);
+
+  if (parser->success) {
+    // unpack the log into the public entry layout
+    if (parser->cap_len > 0) {
+      out->caps = ($PARSER_NAME$_capture*)malloc(parser->cap_len * sizeof($PARSER_NAME$_capture));
+      if (!out->caps) {
+        PGEN_FATAL(parser, "pgen: out of memory returning capture log");
+      }
+    }
+    for (size_t i = 0; i < parser->cap_len; i++) {
+      $PARSER_NAME$_capture *cap = &out->caps[i];
+      cap->kind = PGEN_CAP_KIND(parser, i);
+      cap->start = PGEN_CAP_START(parser, i);
+      if (cap->kind == PGEN_CAP_STR || cap->kind == PGEN_CAP_SPAN) {
+        cap->aux = 0;
+        cap->len = PGEN_CAP_LEN(parser, i);
+      } else if (cap->kind == PGEN_CAP_TBL_OPEN || cap->kind == PGEN_CAP_TBL_CLOSE) {
+        // their data holds the links between them, which have no public
+        // field
+        cap->aux = 0;
+        cap->len = 0;
+      } else if (cap->kind == PGEN_CAP_GROUP_OPEN) {
+        // the pair's name index is kept in its CLOSE entry
+        cap->aux = PGEN_CAP_OPEN_AUX(parser, i);
+        cap->len = 0;
+      } else {
+        cap->aux = PGEN_CAP_AUX(parser, i);
+        cap->len = 0;
+      }
+    }
+    out->cap_len = parser->cap_len;
+    out->status = $UPPER_NAME$_OK;
+    out->pos = parser->pos;
+  } else {
+    out->status = $UPPER_NAME$_NO_MATCH;
+    if (parser->throw_label) {
+      out->label = parser->throw_label;
+      out->pos = parser->throw_pos;
+    } else {
+      out->pos = parser->furthest_fail;
+#ifdef PGEN_ERRORS
+      snprintf(out->message, sizeof(out->message), "%s", parser->error_message);
+#endif
+    }
+  }
+
+  $PARSER_NAME$_free(parser);
+  return out->status;
+}
+
+void $PARSER_NAME$_result_free($PARSER_NAME$_result *result) {
+  free(result->caps);
+  result->caps = NULL;
+  result->cap_len = 0;
+}
+]], vars)
+end
+
+return c_api
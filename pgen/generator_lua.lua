@@ -112,7 +112,9 @@ local function flatten_choice(node, out)
   return out
 end
 
--- Intern a character set, returning its index in the generated sets table
+-- Intern a character class (analyze.class_key encoding), returning its
+-- index in the generated sets table. S, R and merged class choices with the
+-- same members share one table.
 local function set_index(context, set)
   local idx = context.set_index[set]
   if not idx then
@@ -123,6 +125,18 @@ local function set_index(context, set)
   return idx
 end
 
+-- Intern a class run's class (analyze.class_key encoding), returning its
+-- index in the generated classes table
+local function class_index(context, class)
+  local idx = context.class_index[class]
+  if not idx then
+    idx = #context.class_list + 1
+    context.class_index[class] = idx
+    context.class_list[idx] = class
+  end
+  return idx
+end
+
 -- Generate code for a pattern
 function generator.generate_pattern_code(pattern, context)
   local t = pattern.type
@@ -135,15 +149,15 @@ function generator.generate_pattern_code(pattern, context)
       return generator.generate_literal_code(literal, context)
     end
   elseif t == types.R then
-    return generator.generate_range_code(pattern.value, context)
+    return generator.generate_range_code(pattern, context)
   elseif t == types.S then
-    return generator.generate_set_code(pattern.value, context)
+    return generator.generate_set_code(pattern, context)
   elseif t == types.V then
     return template_code([[rules[$RULE$](parser)]], {
       RULE = lua_string_literal(tostring(pattern.value))
     })
   elseif t == types.C then
-    return generator.generate_capture_code(pattern.value, context)
+    return generator.generate_capture_code(pattern.value, pattern.span, pattern.convert, context)
   elseif t == types.Ct then
     return generator.generate_capture_table_code(pattern.value, context)
   elseif t == types.Cp then
@@ -159,6 +173,9 @@ function generator.generate_pattern_code(pattern, context)
   elseif t == types.Cmb then
     return generator.generate_capture_match_back_code(pattern.name, context)
   elseif t == types.Cmt then
+    if pattern.native then
+      error("The lua target does not support Cmt_c: its predicate is C code", 0)
+    end
     return generator.generate_cmt_code(pattern.value, pattern.cmt_id, context)
   elseif t == types.Cfn then
     return generator.generate_cfn_code(pattern.value, pattern.cmt_id, context)
@@ -173,11 +190,24 @@ function generator.generate_pattern_code(pattern, context)
   elseif t == "dispatch_choice" then
     return generator.generate_dispatch_choice_code(pattern, context)
   elseif t == "repeat" then
+    if pattern.commit then
+      return generator.generate_commit_repeat_code(pattern[1], pattern[2], context)
+    end
     return generator.generate_repeat_code(pattern[1], pattern[2], context)
   elseif t == "negate" then
     return generator.generate_negate_code(pattern[1], context)
   elseif t == "literal_trie" then
     return generator.generate_trie_code(pattern.trie, pattern.strings)
+  elseif t == "prec" then
+    return generator.generate_prec_code(pattern, context)
+  elseif t == "class_run" then
+    return generator.generate_class_run_code(pattern, context)
+  elseif t == "char_class" then
+    return generator.generate_char_class_code(pattern, context)
+  elseif t == "keyword" then
+    return generator.generate_keyword_code(pattern, context)
+  elseif t == "ident" then
+    return generator.generate_ident_code(pattern, context)
   else
     error("Unknown pattern type: " .. tostring(t))
   end
@@ -186,7 +216,7 @@ end
 function generator.generate_literal_code(literal, context)
   if #literal == 1 then
     return template_code([[-- match single character $DISPLAY$
-if byte(parser.input, parser.pos + 1) == $CHAR_CODE$ then
+if parser.pos < parser.input_len and byte(parser.input, parser.pos + 1) == $CHAR_CODE$ then
   parser.pos = parser.pos + 1
 else
   parser.success = false
@@ -200,7 +230,8 @@ end]], {
   end
 
   return template_code([[-- match literal $DISPLAY$
-if sub(parser.input, parser.pos + 1, parser.pos + $LEN$) == $LITERAL$ then
+if parser.pos + $LEN$ <= parser.input_len and
+    sub(parser.input, parser.pos + 1, parser.pos + $LEN$) == $LITERAL$ then
   parser.pos = parser.pos + $LEN$
 else
   parser.success = false
@@ -231,25 +262,20 @@ end]], {
 end
 
 -- ranges: array of two-character strings representing low and upper bounds
-function generator.generate_range_code(ranges, context)
-  local conditions = {}
+function generator.generate_range_code(pattern, context)
+  local ranges = pattern.value
   local display = {}
 
   for _, range in ipairs(ranges) do
     local range_left, range_right = range:match("^(.)(.)")
     assert(range_left, "range must have two characters: " .. range)
     assert(range_left <= range_right, "range must be in ascending order: " .. range)
-
-    table.insert(conditions, template_code("(rb >= $LOW$ and rb <= $HIGH$)", {
-      LOW = string.byte(range_left),
-      HIGH = string.byte(range_right)
-    }))
     table.insert(display, escape_text(range_left) .. " - " .. escape_text(range_right))
   end
 
   return template_code([[do -- match character range $DISPLAY$
-  local rb = byte(parser.input, parser.pos + 1)
-  if rb and ($CONDITION$) then
+  local rb = parser.pos < parser.input_len and byte(parser.input, parser.pos + 1)
+  if rb and sets[$IDX$][rb] then
     parser.pos = parser.pos + 1
   else
     parser.success = false
@@ -257,15 +283,16 @@ function generator.generate_range_code(ranges, context)
   end
 end]], {
     DISPLAY = lua_string_literal(table.concat(ranges, ",")),
-    CONDITION = table.concat(conditions, " or "),
+    IDX = set_index(context, context.analyze.class_key(context.analyze.byte_class(pattern))),
     ERR = err_stmt(context, lua_string_literal(
       "Expected character in ranges [" .. table.concat(display, ", ") ..
       "] at position ") .. " .. parser.pos")
   })
 end
 
-function generator.generate_set_code(set, context)
-  local idx = set_index(context, set)
+function generator.generate_set_code(pattern, context)
+  local set = pattern.value
+  local idx = set_index(context, context.analyze.class_key(context.analyze.byte_class(pattern)))
 
   -- The set literal appears quoted inside the message, matching the C target
   local msg = ""
@@ -282,7 +309,7 @@ function generator.generate_set_code(set, context)
   end
 
   return template_code([[do -- match character set $DISPLAY$
-  local sb = byte(parser.input, parser.pos + 1)
+  local sb = parser.pos < parser.input_len and byte(parser.input, parser.pos + 1)
   if sb and sets[$IDX$][sb] then
     parser.pos = parser.pos + 1
   else
@@ -295,6 +322,26 @@ end]], {
   })
 end
 
+-- A choice of single-byte classes merged into one (char_class node from
+-- optimize.char_class_optimization)
+function generator.generate_char_class_code(pattern, context)
+  local description = common.describe_class(pattern.class)
+  return template_code([[do -- match character class $DISPLAY$
+  local cb = parser.pos < parser.input_len and byte(parser.input, parser.pos + 1)
+  if cb and sets[$IDX$][cb] then
+    parser.pos = parser.pos + 1
+  else
+    parser.success = false
+    $ERR$
+  end
+end]], {
+    DISPLAY = description,
+    IDX = set_index(context, pattern.class),
+    ERR = err_stmt(context, lua_string_literal(
+      "Expected character in class " .. description .. " at position ") .. " .. parser.pos")
+  })
+end
+
 function generator.generate_sequence_code(patterns, context)
   if raw_length(patterns) == 1 then
     -- TODO: throw an error here? shouldn't happen
@@ -498,7 +545,7 @@ end]], {
 
   return template_code([[do -- FIRST-byte dispatched ordered choice
   local dd = disp[$ID$]
-  local db = byte(parser.input, parser.pos + 1)
+  local db = parser.pos < parser.input_len and byte(parser.input, parser.pos + 1)
   local dm = db and dd.bytes[db] or dd.eof
   parser.success = false
   $ALTERNATIVES$
@@ -584,6 +631,200 @@ end]], {
   })
 end
 
+-- A committing repetition (pgen.Commit): patt^n whose iterations, once at
+-- least n have matched, are handed to parse_stream's consumer and dropped
+-- from the log (see commit). Outside parse_stream it matches exactly like
+-- patt^n.
+function generator.generate_commit_repeat_code(a, n, context)
+  context.features.commit = true
+
+  if n == 0 then
+    return template_code([[do -- zero or more repetitions, committing each one
+  local commit_cap_base = parser.cap_n
+  local commit_values_base = parser.values_n
+  while true do
+    $BODY$
+    if not parser.success then
+      break
+    end
+    if parser.commit then
+      commit(parser, commit_cap_base, commit_values_base)
+    end
+  end
+  -- Only recover from ordinary failure, not labeled failure from T()
+  if not parser.throw_label then
+    parser.success = true
+  end
+end]], {
+      BODY = generator.generate_pattern_code(a, context)
+    })
+  end
+
+  local remember, restore = position_ops(a, context)
+
+  return template_code([[do -- at least $N$ repetitions, committing once $N$ have matched
+  $REMEMBER$
+  local rep_count = 0
+  local commit_cap_base = parser.cap_n
+  local commit_values_base = parser.values_n
+  while true do
+    $BODY$
+    if not parser.success then
+      break
+    end
+    rep_count = rep_count + 1
+    if parser.commit and rep_count >= $N$ then
+      commit(parser, commit_cap_base, commit_values_base)
+    end
+  end
+  if parser.throw_label then
+    -- Keep failure state, propagate labeled failure
+  elseif rep_count >= $N$ then
+    parser.success = true
+  else
+    $RESTORE$
+    $ERR$
+  end
+end]], {
+    N = n,
+    REMEMBER = remember,
+    RESTORE = restore,
+    BODY = generator.generate_pattern_code(a, context),
+    ERR = err_stmt(context, lua_string_literal(
+      "Expected " .. n .. " repetitions at position ") .. " .. parser.pos")
+  })
+end
+
+-- A run of single-byte class members (optimize.class_run_optimization):
+-- one table lookup per byte instead of a pass through the repetition body.
+-- The stop byte records the furthest failure where the body would have.
+function generator.generate_class_run_code(pattern, context)
+  local class = pattern.class
+  local has_records = class:sub(1, 256):find("\2", 1, true) ~= nil
+  local record_eof = class:byte(257) == 1
+
+  local stop = ""
+  if has_records and record_eof then
+    stop = "\n  if p == len or class[byte(input, p + 1)] == 2 then record_furthest(parser) end"
+  elseif has_records then
+    stop = "\n  if p < len and class[byte(input, p + 1)] == 2 then record_furthest(parser) end"
+  elseif record_eof then
+    stop = "\n  if p == len then record_furthest(parser) end"
+  end
+
+  local min_check = ""
+  if pattern.min > 0 then
+    min_check = template_code([[
+
+  if p - run_start < $N$ then
+    parser.pos = run_start
+    parser.success = false
+    $ERR$
+  end]], {
+      N = pattern.min,
+      ERR = err_stmt(context, lua_string_literal(
+        "Expected " .. pattern.min .. " repetitions at position ") .. " .. parser.pos")
+    })
+  end
+
+  return template_code([[do -- class run $DISPLAY$^$N$
+  local class, input, len = classes[$IDX$], parser.input, parser.input_len
+  local run_start = parser.pos
+  local p = run_start
+  while p < len and class[byte(input, p + 1)] == 1 do
+    p = p + 1
+  end
+  parser.pos = p$STOP$$MIN_CHECK$
+end]], {
+    DISPLAY = common.describe_class(class),
+    N = pattern.min,
+    IDX = class_index(context, class),
+    STOP = stop,
+    MIN_CHECK = min_check
+  })
+end
+
+-- A keyword fused with its boundary check by the optimizer: the byte after
+-- the match must not be in the class
+function generator.generate_keyword_code(pattern, context)
+  return template_code([[do -- keyword followed by not $CLASS$
+  local keyword_start = parser.pos
+  $BODY$
+  if parser.success and parser.pos < parser.input_len and
+      sets[$IDX$][byte(parser.input, parser.pos + 1)] then
+    record_furthest(parser)
+    $ERR$
+    parser.pos = keyword_start
+    parser.success = false
+  end
+end]], {
+    CLASS = common.describe_class(pattern.class),
+    IDX = set_index(context, pattern.class),
+    BODY = generator.generate_pattern_code(pattern[1], context),
+    ERR = err_stmt(context, lua_string_literal(
+      "Negated pattern unexpectedly matched at position ") .. " .. parser.pos")
+  })
+end
+
+-- An identifier that isn't a reserved word (pgen.Ident). Lua's own string
+-- hashing stands in for the C target's perfect hash: the scanned name is
+-- looked up in a set of the reserved words.
+function generator.generate_ident_code(pattern, context)
+  local reserved_check = ""
+  if #pattern.reserved > 0 then
+    local key = table.concat(pattern.reserved, "\0")
+    local idx = context.reserved_index[key]
+    if not idx then
+      idx = #context.reserved_list + 1
+      context.reserved_index[key] = idx
+      context.reserved_list[idx] = pattern.reserved
+    end
+    local max_len = 0
+    for _, word in ipairs(pattern.reserved) do
+      max_len = math.max(max_len, #word)
+    end
+
+    reserved_check = template_code([[
+
+    if p - ident_start <= $MAX_LEN$ and reserved[$IDX$][sub(input, ident_start + 1, p)] then
+      parser.pos = ident_start
+      record_furthest(parser)
+      $ERR$
+      parser.success = false
+    end]], {
+      MAX_LEN = max_len,
+      IDX = idx,
+      ERR = err_stmt(context, lua_string_literal(
+        "Unexpected reserved word at position ") .. " .. parser.pos")
+    })
+  end
+
+  return template_code([[do -- identifier $START$$REST$* ($COUNT$ reserved words)
+  local input, len = parser.input, parser.input_len
+  local ident_start = parser.pos
+  if ident_start < len and sets[$START_IDX$][byte(input, ident_start + 1)] then
+    local rest = sets[$REST_IDX$]
+    local p = ident_start + 1
+    while p < len and rest[byte(input, p + 1)] do
+      p = p + 1
+    end
+    parser.pos = p$RESERVED_CHECK$
+  else
+    parser.success = false
+    $ERR$
+  end
+end]], {
+    START = common.describe_class(pattern.start),
+    REST = common.describe_class(pattern.rest),
+    COUNT = #pattern.reserved,
+    START_IDX = set_index(context, pattern.start),
+    REST_IDX = set_index(context, pattern.rest),
+    RESERVED_CHECK = reserved_check,
+    ERR = err_stmt(context, lua_string_literal(
+      "Expected identifier at position ") .. " .. parser.pos")
+  })
+end
+
 function generator.generate_negate_code(a, context)
   local remember, restore = position_ops(a, context)
 
@@ -631,14 +872,29 @@ end]], {
   })
 end
 
-function generator.generate_capture_code(body, context)
+-- Converting captures (Cnum, Cunescape) are logged as CAP_CONVERT entries
+-- whose aux is the function that converts the text
+local CONVERT_FUNCTIONS = {
+  num = "convert_num",
+  json = "convert_json",
+  lua = "convert_lua"
+}
+
+function generator.generate_capture_code(body, span, convert, context)
+  local kind, aux = span and "CAP_SPAN" or "CAP_STR", "nil"
+  if convert then
+    kind, aux = "CAP_CONVERT", CONVERT_FUNCTIONS[convert]
+    context.features.convert = true
+  end
   return template_code([[do -- capture
   local cap_start_pos = parser.pos
   $BODY$
   if parser.success then
-    cap_push(parser, CAP_STR, nil, cap_start_pos, parser.pos - cap_start_pos)
+    cap_push(parser, $KIND$, $AUX$, cap_start_pos, parser.pos - cap_start_pos)
   end
 end]], {
+    KIND = kind,
+    AUX = aux,
     BODY = generator.generate_pattern_code(body, context)
   })
 end
@@ -646,10 +902,10 @@ end
 function generator.generate_capture_table_code(body, context)
   return template_code([[do -- capture table
   local ct_cap_start = parser.cap_n
-  cap_push(parser, CAP_TBL_OPEN, nil, 0, 0)
+  cap_push(parser, CAP_TBL_OPEN, nil, parser.pos, 0)
   $BODY$
   if parser.success then
-    cap_push(parser, CAP_TBL_CLOSE, nil, 0, 0)
+    cap_push_close(parser, CAP_TBL_CLOSE, nil, parser.pos, ct_cap_start)
   else
     parser.cap_n = ct_cap_start
   end
@@ -688,7 +944,7 @@ function generator.generate_capture_group_code(body, name, context)
   cap_push(parser, CAP_GROUP_OPEN, $NAME$, parser.pos, 0)
   $BODY$
   if parser.success then
-    cap_push(parser, CAP_GROUP_CLOSE, $NAME$, parser.pos, 0)
+    cap_push_close(parser, CAP_GROUP_CLOSE, $NAME$, parser.pos, cg_cap_start)
   else
     parser.cap_n = cg_cap_start
   end
@@ -778,7 +1034,7 @@ function generator.generate_cfn_code(body, cmt_id, context)
   cap_push(parser, CAP_FN_OPEN, cmt_fns[$ID$], parser.pos, 0)
   $BODY$
   if parser.success then
-    cap_push(parser, CAP_FN_CLOSE, nil, parser.pos, 0)
+    cap_push_close(parser, CAP_FN_CLOSE, nil, parser.pos, fn_cap_start)
   else
     parser.cap_n = fn_cap_start
   end
@@ -801,6 +1057,102 @@ $ERR$]], {
   })
 end
 
+-- Precedence climbing (pgen.prec): the loop lives in its own function in
+-- the precs table, called recursively with a minimum level for right
+-- operands. The functions are collected in context.prec_functions.
+function generator.generate_prec_code(pattern, context)
+  local id = #context.prec_functions + 1
+  -- reserve the id before generating children, which may hold nested precs
+  context.prec_functions[id] = false
+  context.features.prec = true
+
+  local remember, restore = position_ops(pattern, context)
+  local space = pattern.space and pattern[2]
+  local first_op = space and 3 or 2
+  local space_code = space and generator.generate_pattern_code(space, context) or ""
+
+  local levels = {}
+  local level_count = #pattern.right
+  for level = level_count, 1, -1 do
+    table.insert(levels, template_code([[
+    if not level and min_level <= $LEVEL$ and not parser.throw_label then -- level $LEVEL$ ($ASSOC$)
+      $REMEMBER$
+      $SPACE$
+      if parser.success then
+        local op_start = parser.pos
+        $OPS$
+        if parser.success then
+          local op_end = parser.pos
+          $SPACE$
+          if parser.success then
+            cap_wrap(parser, prec_base, prec_start)
+            cap_push(parser, CAP_STR, nil, op_start, op_end - op_start)
+            precs[$ID$](parser, $NEXT$)
+            if parser.success then
+              cap_push_close(parser, CAP_TBL_CLOSE, nil, parser.pos, prec_base)
+              level = $LEVEL$
+            else
+              cap_unwrap(parser, prec_base)
+            end
+          end
+        end
+      end
+      if not level and not parser.throw_label then
+        $RESTORE$
+        parser.success = true
+      end
+    end]], {
+      ID = id,
+      LEVEL = level,
+      NEXT = pattern.right[level] and level or level + 1,
+      ASSOC = pattern.right[level] and "right" or "left",
+      REMEMBER = remember,
+      RESTORE = restore,
+      SPACE = space_code,
+      OPS = generator.generate_pattern_code(pattern[first_op + level - 1], context)
+    }))
+  end
+
+  context.prec_functions[id] = template_code([[precs[$ID$] = function(parser, min_level)
+  local prec_base = parser.cap_n
+  local prec_start = parser.pos
+  local depth = parser.depth + 1
+  parser.depth = depth
+  if depth > MAX_DEPTH then
+    error("pgen: max recursion depth (" .. MAX_DEPTH .. ") exceeded at position " .. (parser.pos + 1))
+  end
+
+  $OPERAND$
+
+  -- Extend the operand while an operator at min_level or tighter follows,
+  -- trying the tightest level first as nested per-level rules would
+  while parser.success do
+    local level
+$LEVELS$
+    if not level then
+      break
+    end
+  end
+
+  if not parser.success then
+    -- a labeled failure past an operator leaves operand tables behind
+    parser.cap_n = prec_base
+  end
+  parser.depth = depth - 1
+  return parser.success
+end
+]], {
+    ID = id,
+    OPERAND = generator.generate_pattern_code(pattern[1], context),
+    LEVELS = table.concat(levels, "\n")
+  })
+
+  return template_code([[precs[$ID$](parser, 1) -- precedence climbing, $N$ levels]], {
+    ID = id,
+    N = level_count
+  })
+end
+
 -- All indenter operations are transactional: pushes/pops are recorded on
 -- the trail and undone when the parser backtracks past them
 function generator.generate_indenter_code(pattern, context)
@@ -966,9 +1318,9 @@ end]], {
     })
   end
 
-  -- byte() returns nil at end of input, matching no branch, so the else arm
-  -- covers both an unexpected byte and end of input
-  return template_code([[$PREAMBLE$local tb = byte(parser.input, parser.pos + 1)
+  -- tb is false at the end of the parse window, matching no branch, so the
+  -- else arm covers both an unexpected byte and end of input
+  return template_code([[$PREAMBLE$local tb = parser.pos < parser.input_len and byte(parser.input, parser.pos + 1)
 $BRANCHES$
 else
   parser.success = false
@@ -988,7 +1340,49 @@ end
 function generator.generate_rule_function(name, pattern, context)
   local memo_check, memo_store, start_decl = "", "", ""
   local memo_id = context.memo_ids[name]
-  if memo_id then
+  local replay_id = context.replay_ids[name]
+  if replay_id then
+    start_decl = "local start = parser.pos\n  "
+    memo_check = template_code([[
+  -- Capture-producing rule free of other state: a single-slot memo replays
+  -- the log entries it appended when called again at the same position
+  if parser.replay_pos[$ID$] == start + 1 then
+    if parser.replay_end[$ID$] == -1 then
+      parser.success = false
+      return false
+    end
+    replay(parser, $ID$)
+    parser.success = true
+    return true
+  end
+  local replay_base = parser.cap_n
+]], {ID = replay_id})
+    memo_store = template_code([[
+  replay_store(parser, $ID$, start, replay_base)
+]], {ID = replay_id})
+  elseif memo_id and context.packrat then
+    start_decl = "local start = parser.pos\n  "
+    memo_check = template_code([[
+  -- Position-pure rule: its packrat memo slot for this position answers
+  -- every repeated call
+  local memo_size = parser.memo_size
+  local memo_key = $ID$ * memo_size + start % memo_size
+  if parser.memo_pos[memo_key] == start + 1 then
+    local memo_end = parser.memo_end[memo_key]
+    if memo_end == -1 then
+      parser.success = false
+      return false
+    end
+    parser.pos = memo_end
+    parser.success = true
+    return true
+  end
+]], {ID = memo_id})
+    memo_store = [[
+  parser.memo_pos[memo_key] = start + 1
+  parser.memo_end[memo_key] = parser.success and parser.pos or -1
+]]
+  elseif memo_id then
     start_decl = "local start = parser.pos\n  "
     memo_check = template_code([[
   -- Position-pure rule: a single-slot memo short-circuits the repeated
@@ -1057,25 +1451,30 @@ local function cap_push(parser, kind, aux, start, len)
   parser.cap_size[n] = len
 end
 
+-- Append the close entry of a bracket whose open entry was pushed with the
+-- log at base. Bracket entries have no length, so both entries of the pair
+-- hold their distance apart in cap_size instead, letting skips and backward
+-- scans jump over the whole subtree. The distance is relative, so it
+-- survives moving the pair (cap_select, capture replay, cap_wrap).
+local function cap_push_close(parser, kind, aux, start, base)
+  local n = parser.cap_n + 1
+  parser.cap_n = n
+  parser.cap_kind[n] = kind
+  parser.cap_aux[n] = aux
+  parser.cap_start[n] = start
+  local link = n - base - 1
+  parser.cap_size[n] = link
+  parser.cap_size[base + 1] = link
+end
+
 -- Advance past one complete log item (a single entry, or a whole bracketed
 -- range including anything nested), returning the index after it
 local function cap_skip(parser, i)
-  local ck = parser.cap_kind
-  local kind = ck[i]
-  i = i + 1
+  local kind = parser.cap_kind[i]
   if kind == CAP_TBL_OPEN or kind == CAP_GROUP_OPEN or kind == CAP_FN_OPEN then
-    local depth = 1
-    while depth > 0 do
-      kind = ck[i]
-      if kind == CAP_TBL_OPEN or kind == CAP_GROUP_OPEN or kind == CAP_FN_OPEN then
-        depth = depth + 1
-      elseif kind == CAP_TBL_CLOSE or kind == CAP_GROUP_CLOSE or kind == CAP_FN_CLOSE then
-        depth = depth - 1
-      end
-      i = i + 1
-    end
+    i = i + parser.cap_size[i]  -- jump to the close entry
   end
-  return i
+  return i + 1
 end
 
 local cap_eval
@@ -1131,6 +1530,18 @@ function cap_eval(parser, i, out)
     out.n = out.n + 1
     out[out.n] = parser.cap_start[i] + 1
     return i + 1
+  elseif kind == CAP_SPAN then
+    -- inclusive bounds, so subject:sub(start, stop) is the text
+    local start = parser.cap_start[i]
+    out[out.n + 1] = start + 1
+    out[out.n + 2] = start + parser.cap_size[i]
+    out.n = out.n + 2
+    return i + 1
+  elseif kind == CAP_CONVERT then
+    local start = parser.cap_start[i]
+    out.n = out.n + 1
+    out[out.n] = parser.cap_aux[i](sub(parser.input, start + 1, start + parser.cap_size[i]))
+    return i + 1
   elseif kind == CAP_VALUE then
     out.n = out.n + 1
     out[out.n] = parser.values[parser.cap_aux[i]]
@@ -1194,6 +1605,123 @@ function cap_eval(parser, i, out)
 end
 ]==]
 
+local CONVERT_HELPERS = [==[
+-- Cnum and Cunescape conversions, applied to the captured text when the
+-- log is materialized. They follow the C target's rules exactly.
+local find, match, gsub, format = string.find, string.match, string.gsub, string.format
+local char, concat = string.char, table.concat
+
+-- Decimal numbers only (no hex, no surrounding space); nil otherwise
+local function convert_num(text)
+  local mantissa, rest = match(text, "^[+-]?(%d*%.?%d*)(.*)$")
+  if not find(mantissa, "%d") or (rest ~= "" and not find(rest, "^[eE][+-]?%d+$")) then
+    return nil
+  end
+  -- tonumber reads the locale's decimal point (before Lua 5.3): when that
+  -- isn't '.', try again with it in place of the '.'
+  return tonumber(text) or tonumber((gsub(text, "%.", match(format("%.1f", 0.5), "0(.)5"))))
+end
+
+-- cp as UTF-8, including the 5 and 6 byte forms of Lua's "\u{XXX}"
+local function utf8_char(cp)
+  if cp < 0x80 then
+    return char(cp)
+  end
+  local bytes, first_max = "", 0x3f
+  repeat
+    bytes = char(0x80 + cp % 0x40) .. bytes
+    cp = floor(cp / 0x40)
+    first_max = floor(first_max / 2)
+  until cp <= first_max
+  return char(0x100 - 2 * (first_max + 1) + cp) .. bytes
+end
+
+-- Decode the escapes of text with unescape(text, k), which decodes the
+-- escape at the backslash at k, returning its value and the index past
+-- it, or nil when it is malformed: then the backslash is kept as it is
+local function unescape_with(text, unescape)
+  local k = find(text, "\\", 1, true)
+  if not k then
+    return text
+  end
+  local out, from = {}, 1
+  while k do
+    out[#out + 1] = sub(text, from, k - 1)
+    local value, after = unescape(text, k)
+    if value then
+      out[#out + 1] = value
+      from = after
+    else
+      out[#out + 1] = "\\"
+      from = k + 1
+    end
+    k = find(text, "\\", from, true)
+  end
+  out[#out + 1] = sub(text, from)
+  return concat(out)
+end
+
+local JSON_ESCAPES = {
+  ['"'] = '"', ["\\"] = "\\", ["/"] = "/",
+  b = "\b", f = "\f", n = "\n", r = "\r", t = "\t"
+}
+
+local function unescape_json(text, k)
+  local c = sub(text, k + 1, k + 1)
+  if JSON_ESCAPES[c] then
+    return JSON_ESCAPES[c], k + 2
+  elseif c ~= "u" or not find(text, "^%x%x%x%x", k + 2) then
+    return nil
+  end
+  local cp = tonumber(sub(text, k + 2, k + 5), 16)
+  local after = k + 6
+  if cp >= 0xD800 and cp <= 0xDBFF and find(text, "^\\u[Dd][C-Fc-f]%x%x", after) then
+    cp = 0x10000 + (cp - 0xD800) * 0x400 + tonumber(sub(text, after + 2, after + 5), 16) - 0xDC00
+    after = after + 6
+  elseif cp >= 0xD800 and cp <= 0xDFFF then
+    cp = 0xFFFD  -- lone surrogate
+  end
+  return utf8_char(cp), after
+end
+
+local function convert_json(text)
+  return unescape_with(text, unescape_json)
+end
+
+local LUA_ESCAPES = {
+  a = "\a", b = "\b", f = "\f", n = "\n", r = "\r", t = "\t", v = "\v",
+  ["\\"] = "\\", ['"'] = '"', ["'"] = "'"
+}
+
+local function unescape_lua(text, k)
+  local c = sub(text, k + 1, k + 1)
+  if LUA_ESCAPES[c] then
+    return LUA_ESCAPES[c], k + 2
+  elseif c == "\n" or c == "\r" then
+    -- \r\n and \n\r are one line break
+    local d = sub(text, k + 2, k + 2)
+    return "\n", (d == "\n" or d == "\r") and d ~= c and k + 3 or k + 2
+  elseif c == "x" then
+    local hex = match(text, "^%x%x", k + 2)
+    return hex and char(tonumber(hex, 16)), k + 4
+  elseif c == "z" then
+    -- skips the whitespace that follows
+    return "", find(text, "[^ \t\n\v\f\r]", k + 2) or #text + 1
+  elseif c == "u" then
+    local hex = match(text, "^{(%x+)}", k + 2)
+    local cp = hex and tonumber(hex, 16)
+    return cp and cp <= 0x7FFFFFFF and utf8_char(cp), k + 4 + (hex and #hex or 0)
+  end
+  local digits = match(text, "^%d%d?%d?", k + 1)
+  local value = digits and tonumber(digits)
+  return value and value <= 255 and char(value), k + 1 + (digits and #digits or 0)
+end
+
+local function convert_lua(text)
+  return unescape_with(text, unescape_lua)
+end
+]==]
+
 local CAP_SELECT_HELPER = [==[
 -- Reduce the log after base to only the nth capture value (group captures
 -- don't count), or to a single nil when there are fewer than n values
@@ -1238,16 +1766,7 @@ local function cap_match_back(parser, name)
     local kind = ck[i]
     if kind == CAP_TBL_CLOSE or kind == CAP_GROUP_CLOSE or kind == CAP_FN_CLOSE then
       local close = i
-      local depth = 1
-      while depth > 0 do
-        i = i - 1
-        local k2 = ck[i]
-        if k2 == CAP_TBL_CLOSE or k2 == CAP_GROUP_CLOSE or k2 == CAP_FN_CLOSE then
-          depth = depth + 1
-        elseif k2 == CAP_TBL_OPEN or k2 == CAP_GROUP_OPEN or k2 == CAP_FN_OPEN then
-          depth = depth - 1
-        end
-      end
+      i = i - cz[close]  -- back to the open entry
       if kind == CAP_GROUP_CLOSE and ca[i] == name then
         local text
         local inner = i + 1
@@ -1279,8 +1798,6 @@ end
 ]==]
 
 local RUN_CMT_HELPER = [==[
-local floor = math.floor
-
 -- Run a match-time capture: materialize the inner captures, call the
 -- callback with (subject, pos, ...captures), and interpret its results per
 -- lpeg semantics: position/true = success, false/nil = failure, extra
@@ -1341,6 +1858,101 @@ local function run_cmt(parser, fn, start_pos, cap_base)
 end
 ]==]
 
+local COMMIT_HELPER = [==[
+-- Commit point of a pgen.Commit repetition during parse_stream: call the
+-- consumer with the values of the log entries after cap_base, then drop
+-- them along with the Cmt values after values_base they referenced.
+-- Nothing can backtrack past a commit (analyze.check_commits), so the
+-- entries are never needed again.
+local function commit(parser, cap_base, values_base)
+  local out = {n = 0}
+  local i = cap_base + 1
+  while i <= parser.cap_n do
+    if parser.cap_kind[i] == CAP_GROUP_OPEN then
+      -- named groups only matter inside Ct, as at the top level
+      i = cap_skip(parser, i)
+    else
+      i = cap_eval(parser, i, out)
+    end
+  end
+  parser.cap_n = cap_base
+  local values = parser.values
+  for k = values_base + 1, parser.values_n do values[k] = nil end
+  parser.values_n = values_base
+
+  -- iterations without values aren't passed on; consumer errors propagate
+  -- (abort the parse)
+  if out.n > 0 then
+    parser.commit(unpack(out, 1, out.n))
+  end
+end
+]==]
+
+local REPLAY_HELPERS = [==[
+-- Capture-replay memo for rules whose only state is the capture log
+-- entries they append: a single slot per rule holding the result at one
+-- position and a copy of the appended entries (at most MEMO_CAPS), which a
+-- hit splices back into the log. Records the outcome of rule id, called at
+-- start with the log at base; a segment too long to save leaves the slot
+-- as it was.
+local function replay_store(parser, id, start, base)
+  local count = parser.success and parser.cap_n - base or 0
+  if count > MEMO_CAPS then
+    return
+  end
+  local saved = parser.replay_caps[id]
+  if not saved then
+    saved = {}
+    parser.replay_caps[id] = saved
+  end
+  local ck, ca, cs, cz = parser.cap_kind, parser.cap_aux, parser.cap_start, parser.cap_size
+  local j = 0
+  for i = base + 1, base + count do
+    saved[j + 1], saved[j + 2], saved[j + 3], saved[j + 4] = ck[i], ca[i], cs[i], cz[i]
+    j = j + 4
+  end
+  parser.replay_pos[id] = start + 1
+  parser.replay_end[id] = parser.success and parser.pos or -1
+  parser.replay_n[id] = count
+end
+
+-- Replay the memoized match of rule id: append its saved entries to the
+-- log and move to its end position
+local function replay(parser, id)
+  local saved = parser.replay_caps[id]
+  for j = 1, parser.replay_n[id] * 4, 4 do
+    cap_push(parser, saved[j], saved[j + 1], saved[j + 2], saved[j + 3])
+  end
+  parser.pos = parser.replay_end[id]
+end
+]==]
+
+local PREC_HELPERS = [==[
+-- An operator's table must enclose the left operand's entries, which are
+-- already in the log by the time the operator matches: insert the open
+-- entry in front of them (after index base), shifting them up. Links are
+-- relative, so the shifted brackets stay linked; the new open entry is
+-- linked by the cap_push_close that ends its table.
+local function cap_wrap(parser, base, start)
+  local ck, ca, cs, cz = parser.cap_kind, parser.cap_aux, parser.cap_start, parser.cap_size
+  for i = parser.cap_n, base + 1, -1 do
+    ck[i + 1], ca[i + 1], cs[i + 1], cz[i + 1] = ck[i], ca[i], cs[i], cz[i]
+  end
+  parser.cap_n = parser.cap_n + 1
+  ck[base + 1], ca[base + 1], cs[base + 1], cz[base + 1] = CAP_TBL_OPEN, nil, start, 0
+end
+
+-- Undo cap_wrap when the right operand fails
+local function cap_unwrap(parser, base)
+  local ck, ca, cs, cz = parser.cap_kind, parser.cap_aux, parser.cap_start, parser.cap_size
+  local n = parser.cap_n - 1
+  for i = base + 1, n do
+    ck[i], ca[i], cs[i], cz[i] = ck[i + 1], ca[i + 1], cs[i + 1], cz[i + 1]
+  end
+  parser.cap_n = n
+end
+]==]
+
 local IND_HELPERS = [==[
 -- Rewind the indenter trail to a previous length, undoing pushes and pops
 local function ind_trail_rewind(parser, index)
@@ -1460,27 +2072,73 @@ local function generate_cmt_infrastructure(cmt_codes)
   return table.concat(lines, "\n")
 end
 
--- Generate the character set tables collected during rule generation
+-- Generate the class run tables collected during rule generation: 1 for
+-- members, 2 for stop bytes that record the furthest failure
+local function generate_classes_code(class_list)
+  if #class_list == 0 then
+    return ""
+  end
+
+  local lines = {"-- Class run lookup tables (byte -> 1 member, 2 recording stop byte)"}
+  for i, class in ipairs(class_list) do
+    local entries = {}
+    for b = 0, 255 do
+      local code = class:byte(b + 1)
+      if code ~= 0 then
+        entries[#entries + 1] = "[" .. b .. "] = " .. code
+      end
+    end
+    lines[#lines + 1] = template_code("classes[$IDX$] = { $ENTRIES$ } -- $DISPLAY$", {
+      IDX = i,
+      ENTRIES = table.concat(entries, ", "),
+      DISPLAY = common.describe_class(class)
+    })
+  end
+  lines[#lines + 1] = ""
+
+  return table.concat(lines, "\n")
+end
+
+-- Generate the reserved word sets for pgen.Ident
+local function generate_reserved_code(reserved_list)
+  if #reserved_list == 0 then
+    return ""
+  end
+
+  local lines = {"-- Reserved word sets (word -> true)"}
+  for i, words in ipairs(reserved_list) do
+    local entries = {}
+    for j, word in ipairs(words) do
+      entries[j] = "[" .. lua_string_literal(word) .. "] = true"
+    end
+    lines[#lines + 1] = template_code("reserved[$IDX$] = { $ENTRIES$ }", {
+      IDX = i,
+      ENTRIES = table.concat(entries, ", ")
+    })
+  end
+  lines[#lines + 1] = ""
+
+  return table.concat(lines, "\n")
+end
+
+-- Generate the character class tables collected during rule generation
 local function generate_sets_code(set_list)
   if #set_list == 0 then
     return ""
   end
 
-  local lines = {"-- Character set lookup tables (byte -> true)"}
+  local lines = {"-- Character class lookup tables (byte -> true)"}
   for i, set in ipairs(set_list) do
     local entries = {}
-    local seen = {}
-    for j = 1, #set do
-      local b = set:byte(j)
-      if not seen[b] then
-        seen[b] = true
+    for b = 0, 255 do
+      if set:byte(b + 1) == 1 then
         entries[#entries + 1] = "[" .. b .. "] = true"
       end
     end
     lines[#lines + 1] = template_code("sets[$IDX$] = { $ENTRIES$ } -- $DISPLAY$", {
       IDX = i,
       ENTRIES = table.concat(entries, ", "),
-      DISPLAY = lua_string_literal(set)
+      DISPLAY = common.describe_class(set)
     })
   end
   lines[#lines + 1] = ""
@@ -1488,37 +2146,65 @@ local function generate_sets_code(set_list)
   return table.concat(lines, "\n")
 end
 
-local function generate_parser_main(start_rule, context, indenters, memo_count)
+local function generate_parser_main(start_rule, context, indenters, memo_count, replay_count)
   local extra_fields = {}
+  local reset_lines = {}
 
   if context.errors then
     extra_fields[#extra_fields + 1] = 'error_message = "",'
+    reset_lines[#reset_lines + 1] = 'parser.error_message = ""'
+  end
+
+  if replay_count > 0 then
+    extra_fields[#extra_fields + 1] = "replay_pos = {}, replay_end = {}, replay_n = {}, replay_caps = {},"
+    reset_lines[#reset_lines + 1] = template_code([[local replay_pos = parser.replay_pos
+  for i = 1, $COUNT$ do replay_pos[i] = nil end]], {COUNT = replay_count})
   end
 
-  if memo_count > 0 then
+  if memo_count > 0 and context.packrat then
+    -- Packrat memo: memo_size slots per rule keyed by position modulo
+    -- memo_size, sized like the C target's tables (see MEMO_LIMIT). Fresh
+    -- tables per parse, so only visited positions cost memory.
+    extra_fields[#extra_fields + 1] = "memo_pos = {}, memo_end = {}, memo_size = 1,"
+    reset_lines[#reset_lines + 1] = [[local memo_size = 1
+  while memo_size <= parser.input_len and memo_size * 2 <= MEMO_LIMIT do
+    memo_size = memo_size * 2
+  end
+  parser.memo_size = memo_size
+  parser.memo_pos, parser.memo_end = {}, {}]]
+  elseif memo_count > 0 then
     extra_fields[#extra_fields + 1] = "memo_pos = {}, memo_end = {},"
+    reset_lines[#reset_lines + 1] = template_code([[local memo_pos = parser.memo_pos
+  for i = 1, $COUNT$ do memo_pos[i] = nil end]], {COUNT = memo_count})
   end
 
   if #indenters > 0 then
     local stacks = {}
     for _, ind in ipairs(indenters) do
       stacks[#stacks + 1] = "{ " .. ind.initial .. ", n = 1 }"
+      reset_lines[#reset_lines + 1] = template_code(
+        "parser.ind_stacks[$SIDX$].n, parser.ind_stacks[$SIDX$][1] = 1, $INITIAL$",
+        {SIDX = ind.id + 1, INITIAL = ind.initial})
     end
     extra_fields[#extra_fields + 1] = "ind_stacks = { " .. table.concat(stacks, ", ") .. " },"
     extra_fields[#extra_fields + 1] = "trail_id = {}, trail_op = {}, trail_val = {}, trail_n = 0,"
+    reset_lines[#reset_lines + 1] = "parser.trail_n = 0"
   end
 
   local extra = #extra_fields > 0 and
     ("\n    " .. table.concat(extra_fields, "\n    ")) or ""
+  local reset = #reset_lines > 0 and
+    ("\n  " .. table.concat(reset_lines, "\n  ")) or ""
 
   return template_code([[
-local function new_parser(input)
+local function new_parser()
   return {
-    input = input,
-    input_len = #input,
+    input = "",
+    input_len = 0,
     pos = 0, -- 0-based like the C target; converted at the API boundary
     success = true,
     throw_label = nil, -- label from T() or nil for ordinary failure
+    commit = nil, -- parse_stream's consumer
     throw_pos = 0,
     furthest_fail = 0,
     depth = 0,
@@ -1528,27 +2214,93 @@ local function new_parser(input)
   }
 end
 
-local function parse(input)
+-- Prepare a parser for a parse of input. Only per-parse state is reset: the
+-- capture log arrays keep their contents, truncated by cap_n.
+local function reset_parser(parser, input)
+  parser.input = input
+  parser.input_len = #input
+  parser.pos = 0
+  parser.success = true
+  parser.throw_label = nil
+  parser.throw_pos = 0
+  parser.furthest_fail = 0
+  parser.depth = 0
+  parser.cap_n = 0
+  -- drop the previous parse's Cmt values so they can be collected
+  local values = parser.values
+  for i = 1, parser.values_n do values[i] = nil end
+  parser.values_n = 0$RESET$
+end
+
+local function check_input(input)
   if type(input) == "number" then
     input = tostring(input)
   end
   if type(input) ~= "string" then
     error("Expected string argument for parsing")
   end
+  return input
+end
+
+local function check_position(value, default, arg)
+  if value == nil then
+    return default
+  end
+  local n = tonumber(value)
+  if not n then
+    error("bad argument #" .. arg .. " to 'parse' (number expected, got " .. type(value) .. ")", 3)
+  end
+  return floor(n)
+end
 
-  local parser = new_parser(input)
+-- Narrow a reset parser to the window given by the optional 1-based
+-- inclusive (init, stop) positions. Negative values count from the end of
+-- the subject and out-of-range values are clamped, as with string.sub.
+-- Matching starts at init and treats stop as the end of input, but
+-- positions stay absolute, so Cp, failure positions and Cmt see offsets
+-- into the whole subject.
+local function set_window(parser, init, stop)
+  local len = #parser.input
+  init = check_position(init, 1, 2)
+  stop = check_position(stop, len, 3)
+  if init < 0 then init = init + len + 1 end
+  if init < 1 then init = 1 end
+  if init > len + 1 then init = len + 1 end
+  if stop < 0 then stop = stop + len + 1 end
+  if stop > len then stop = len end
+  if stop < init - 1 then stop = init - 1 end
+  parser.pos = init - 1
+  parser.furthest_fail = parser.pos
+  parser.input_len = stop
+end
+
+-- Run the start rule over input[init..stop], leaving the capture log in
+-- the parser on success
+local function match(parser, input, init, stop)
+  reset_parser(parser, input)
+  set_window(parser, init, stop)
 
   rules[$START_RULE$](parser)
+end
+
+-- parse()'s results for a failed match: nil and error info
+local function failure(parser)
+  if parser.throw_label then
+    -- Labeled failure: return nil, label, position
+    return nil, parser.throw_label, parser.throw_pos + 1
+  end
+  -- Ordinary failure: return nil, message (pgen_errors builds only) and
+  -- the furthest input position a match attempt failed at (1-indexed)
+  return nil, $FAIL_MESSAGE$, parser.furthest_fail + 1
+end
 
-  -- Return nil and error info on failure
+-- Run the start rule over input[init..stop] and return parse()'s results:
+-- the captures, the position after the match when there are none, or nil
+-- plus failure info
+local function run(parser, input, init, stop)
+  match(parser, input, init, stop)
   if not parser.success then
-    if parser.throw_label then
-      -- Labeled failure: return nil, label, position
-      return nil, parser.throw_label, parser.throw_pos + 1
-    end
-    -- Ordinary failure: return nil, message (pgen_errors builds only) and
-    -- the furthest input position a match attempt failed at (1-indexed)
-    return nil, $FAIL_MESSAGE$, parser.furthest_fail + 1
+    return failure(parser)
   end
 
   -- Materialize the capture log into return values. Named groups produce
@@ -1577,13 +2329,383 @@ local function parse(input)
   return parser.pos + 1
 end
 
+local function parse(input, init, stop)
+  return run(new_parser(), check_input(input), init, stop)
+end
+
+-- Release a handle after its protected parse, applying the high-water
+-- policy, then pass the results through or rethrow the error unchanged
+local function release(handle, ok, ...)
+  handle.busy = false
+  local trim = handle.trim
+  if trim and #handle.parser.cap_kind > trim then
+    local parser = handle.parser
+    parser.cap_kind, parser.cap_aux, parser.cap_start, parser.cap_size = {}, {}, {}, {}
+  end
+  if not ok then
+    error((...), 0)
+  end
+  return ...
+end
+
+local handle_methods = {}
+
+-- handle:parse(input, [init], [stop]): same results as parse(), but
+-- reuses the handle's parser state and capture log arrays between parses
+function handle_methods:parse(input, init, stop)
+  input = check_input(input)
+  if self.busy then
+    -- the handle is in use further down the stack (parse called again from
+    -- one of its own Cmt callbacks)
+    error("pgen: parser handle is already parsing")
+  end
+  self.busy = true
+  return release(self, pcall(run, self.parser, input, init, stop))
+end
+
+local handle_mt = {__index = handle_methods}
+
+-- new([opts]): create a reusable parser handle. opts.trim optionally caps
+-- the capture log (in entries) retained between parses; without it the
+-- arrays stay at their high-water size.
+local function new(opts)
+  local trim = opts and opts.trim
+  if trim ~= nil and (type(trim) ~= "number" or not (trim >= 1 and trim < math.huge)) then
+    error("pgen: trim must be a positive number of entries")
+  end
+  return setmetatable({parser = new_parser(), trim = trim, busy = false}, handle_mt)
+end
+
+-- parse_to_buffer encodings: MessagePack, or pgen's native format, where
+-- each value is a tag byte (NATIVE_TAGS) followed for integers by a zigzag
+-- LEB128 varint, for floats by a little-endian IEEE 754 double, and for
+-- strings, arrays and maps by a LEB128 length and the contents. Values
+-- are written as string pieces into out.
+local char, concat = string.char, table.concat
+local spack = string.pack
+local mtype = math.type
+
+local NATIVE_NIL, NATIVE_FALSE, NATIVE_TRUE, NATIVE_INT, NATIVE_FLOAT = 0, 1, 2, 3, 4
+local NATIVE_TAGS = {str = 5, array = 6, map = 7}
+local MSGPACK_FIXED = {str = 0xa0, array = 0x90, map = 0x80}
+local MSGPACK_SIZED = {
+  str = {0xd9, 0xda, 0xdb}, array = {nil, 0xdc, 0xdd}, map = {nil, 0xde, 0xdf}
+}
+
+-- The low n bytes of integer v (two's complement), most significant first
+local function int_bytes(v, n)
+  if spack then
+    return spack(v < 0 and ">i" .. n or ">I" .. n, v)
+  end
+  local bytes = {}
+  for k = n, 1, -1 do
+    local b = v % 256
+    bytes[k] = b
+    v = (v - b) / 256
+  end
+  return char(unpack(bytes))
+end
+
+-- The IEEE 754 double n, most significant byte first
+local function double_bytes(n)
+  if spack then
+    return spack(">d", n)
+  end
+  local sign = 0
+  if n < 0 or (n == 0 and 1 / n < 0) then
+    sign, n = 0x80, -n
+  end
+  local mant, expo
+  if n ~= n then
+    mant, expo = 2^51, 0x7ff
+  elseif n == math.huge then
+    mant, expo = 0, 0x7ff
+  elseif n == 0 then
+    mant, expo = 0, 0
+  else
+    local m, e = math.frexp(n)  -- n = m * 2^e, 0.5 <= m < 1
+    expo = e + 1022
+    if expo <= 0 then
+      mant, expo = m * 2^(52 + expo), 0  -- subnormal
+    else
+      mant = (m * 2 - 1) * 2^52
+    end
+  end
+  local high = floor(mant / 2^48)
+  return char(sign + floor(expo / 16), expo % 16 * 16 + high) ..
+    int_bytes(mant - high * 2^48, 6)
+end
+
+local function varint(v)
+  local bytes = {}
+  while v >= 128 do
+    local b = v % 128
+    bytes[#bytes + 1] = b + 128
+    v = (v - b) / 128
+  end
+  bytes[#bytes + 1] = v
+  return char(unpack(bytes))
+end
+
+local function is_integer(v)
+  if mtype then
+    return mtype(v) == "integer"
+  end
+  -- every number is a double here: integral ones are written as integers
+  return v == floor(v) and v >= -2^63 and v < 2^63
+end
+
+local function encode_header(out, native, kind, count)
+  if native then
+    out[#out + 1] = char(NATIVE_TAGS[kind]) .. varint(count)
+  elseif count < (kind == "str" and 32 or 16) then
+    out[#out + 1] = char(MSGPACK_FIXED[kind] + count)
+  elseif kind == "str" and count < 256 then
+    out[#out + 1] = char(MSGPACK_SIZED.str[1]) .. int_bytes(count, 1)
+  elseif count < 65536 then
+    out[#out + 1] = char(MSGPACK_SIZED[kind][2]) .. int_bytes(count, 2)
+  else
+    out[#out + 1] = char(MSGPACK_SIZED[kind][3]) .. int_bytes(count, 4)
+  end
+end
+
+local function encode_int(out, native, v)
+  if native then
+    out[#out + 1] = char(NATIVE_INT) .. varint(v < 0 and -2 * v - 1 or 2 * v)
+  elseif v >= 0 and v < 128 then
+    out[#out + 1] = char(v)
+  elseif v < 0 and v >= -32 then
+    out[#out + 1] = char(v + 256)
+  elseif v >= 0 then
+    local n = v < 256 and 1 or v < 65536 and 2 or v < 4294967296 and 4 or 8
+    out[#out + 1] = char(n == 1 and 0xcc or n == 2 and 0xcd or n == 4 and 0xce or 0xcf) ..
+      int_bytes(v, n)
+  else
+    local n = v >= -128 and 1 or v >= -32768 and 2 or v >= -2147483648 and 4 or 8
+    out[#out + 1] = char(n == 1 and 0xd0 or n == 2 and 0xd1 or n == 4 and 0xd2 or 0xd3) ..
+      int_bytes(v, n)
+  end
+end
+
+-- Encode a capture value. A table whose keys are exactly 1..#t becomes an
+-- array, any other table a map. Tables may be cyclic, so nesting is
+-- limited like rule recursion.
+local function encode_value(out, native, v, depth)
+  local t = type(v)
+  if t == "nil" then
+    out[#out + 1] = char(native and NATIVE_NIL or 0xc0)
+  elseif t == "boolean" then
+    if native then
+      out[#out + 1] = char(v and NATIVE_TRUE or NATIVE_FALSE)
+    else
+      out[#out + 1] = char(v and 0xc3 or 0xc2)
+    end
+  elseif t == "number" then
+    if is_integer(v) then
+      encode_int(out, native, v)
+    elseif native then
+      out[#out + 1] = char(NATIVE_FLOAT) .. double_bytes(v):reverse()
+    else
+      out[#out + 1] = char(0xcb) .. double_bytes(v)
+    end
+  elseif t == "string" then
+    encode_header(out, native, "str", #v)
+    out[#out + 1] = v
+  elseif t == "table" then
+    if depth >= MAX_DEPTH then
+      error("pgen: max nesting depth (" .. MAX_DEPTH .. ") exceeded encoding a table")
+    end
+    local len, count, array = #v, 0, true
+    for k in pairs(v) do
+      count = count + 1
+      if array then
+        array = type(k) == "number" and k >= 1 and k <= len and k == floor(k)
+      end
+    end
+    if array and count == len then
+      encode_header(out, native, "array", len)
+      for k = 1, len do
+        encode_value(out, native, v[k], depth + 1)
+      end
+    else
+      encode_header(out, native, "map", count)
+      for k, item in pairs(v) do
+        encode_value(out, native, k, depth + 1)
+        encode_value(out, native, item, depth + 1)
+      end
+    end
+  else
+    error("pgen: can't encode a " .. t .. " value")
+  end
+end
+
+local BUFFER_FORMATS = {msgpack = false, native = true}
+
+-- parse_to_buffer(input, format, [init], [stop]): parse() with the
+-- captures encoded one after another into a string, as "msgpack" or
+-- "native". There is no capture log walk to save here: the values are
+-- built as for parse() and then encoded.
+local function parse_to_buffer(input, format, init, stop)
+  local native = BUFFER_FORMATS[format]
+  if native == nil then
+    error("bad argument #2 to 'parse_to_buffer' (invalid option '" .. tostring(format) .. "')")
+  end
+  local parser = new_parser()
+  local results = pack(run(parser, check_input(input), init, stop))
+  if not parser.success then
+    return unpack(results, 1, results.n)
+  end
+  local out = {}
+  for i = 1, results.n do
+    encode_value(out, native, results[i], 0)
+  end
+  return concat(out)
+end
+
+-- Events per handlers.batch call
+local EVENT_BATCH_SIZE = 256
+
+local cap_events
+
+-- Replay the capture group opened at i: the events of its first inner
+-- value, or the text it matched (as cap_eval_group). Returns the index
+-- past the group's close entry.
+local function cap_events_group(parser, i, emit)
+  local after = cap_skip(parser, i)
+  local close = after - 1
+  local j = i + 1
+  while j < close do
+    local n
+    j, n = cap_events(parser, j, emit, 1)
+    if n > 0 then
+      return after
+    end
+  end
+  emit("value", sub(parser.input, parser.cap_start[i] + 1, parser.cap_start[close]))
+  return after
+end
+
+-- Replay the log item at i as calls to emit(event, arg), as at most max
+-- values (all when nil); a table counts as one. Returns the index past the
+-- item and the number of values replayed.
+function cap_events(parser, i, emit, max)
+  local ck = parser.cap_kind
+  local kind = ck[i]
+  if kind == CAP_TBL_OPEN then
+    local close = i + parser.cap_size[i]
+    emit("open", parser.cap_start[i] + 1)
+    local j = i + 1
+    while j < close do
+      if ck[j] == CAP_GROUP_OPEN then
+        emit("field", parser.cap_aux[j])
+        j = cap_events_group(parser, j, emit)
+      else
+        j = cap_events(parser, j, emit)
+      end
+    end
+    emit("close", parser.cap_start[close] + 1)
+    return close + 1, 1
+  elseif kind == CAP_GROUP_OPEN then
+    return cap_events_group(parser, i, emit), 1
+  end
+  -- everything else is replayed as the values it evaluates to
+  local out = {n = 0}
+  local after = cap_eval(parser, i, out)
+  local n = out.n
+  if max and n > max then
+    n = max
+  end
+  for k = 1, n do
+    emit("value", out[k])
+  end
+  return after, n
+end
+
+-- parse_events(input, handlers, [init], [stop]): parse() with the captures
+-- replayed as calls to handlers.open/value/field/close, or batched to
+-- handlers.batch, instead of returned. Returns the position after the
+-- match, or parse()'s failure results.
+local function parse_events(input, handlers, init, stop)
+  if type(handlers) ~= "table" then
+    error("bad argument #2 to 'parse_events' (table expected, got " .. type(handlers) .. ")")
+  end
+  local parser = new_parser()
+  match(parser, check_input(input), init, stop)
+  if not parser.success then
+    return failure(parser)
+  end
+
+  local emit
+  local batch = handlers.batch
+  local list, n = {}, 0
+  if batch then
+    emit = function(event, arg)
+      list[2 * n + 1], list[2 * n + 2] = event, arg
+      n = n + 1
+      if n == EVENT_BATCH_SIZE then
+        n = 0
+        batch(list, EVENT_BATCH_SIZE)
+      end
+    end
+  else
+    emit = function(event, arg)
+      local handler = handlers[event]
+      if handler then
+        handler(arg)
+      end
+    end
+  end
+
+  local i = 1
+  while i <= parser.cap_n do
+    if parser.cap_kind[i] == CAP_GROUP_OPEN then
+      i = cap_skip(parser, i)
+    else
+      i = cap_events(parser, i, emit)
+    end
+  end
+  if n > 0 then
+    batch(list, n)
+  end
+  return parser.pos + 1
+end
+
+-- parse_stream(input, consumer, [init], [stop]): parse() that calls
+-- consumer with the captures of each pgen.Commit iteration as it completes
+-- (see commit) instead of keeping them for the results. The consumer runs
+-- inside the parse, so it may yield when parse_stream runs in a coroutine.
+local function parse_stream(input, consumer, init, stop)
+  input = check_input(input)
+  if type(consumer) ~= "function" then
+    error("bad argument #2 to 'parse_stream' (function expected, got " .. type(consumer) .. ")")
+  end
+  local parser = new_parser()
+  parser.commit = consumer
+  return run(parser, input, init, stop)
+end
+
+-- Tables are plain Lua tables here, so parse_lazy is parse, and expand and
+-- materialize (which take apart the C target's lazy proxies) return their
+-- argument
+local function identity(value)
+  return value
+end
+
 return {
-  parse = parse
+  parse = parse,
+  new = new,
+  parse_lazy = parse,
+  parse_to_buffer = parse_to_buffer,
+  parse_events = parse_events,
+  parse_stream = parse_stream,
+  expand = identity,
+  materialize = identity
 }
 ]], {
     START_RULE = lua_string_literal(tostring(start_rule)),
     FAIL_MESSAGE = context.errors and "parser.error_message" or "nil",
-    EXTRA_FIELDS = extra
+    EXTRA_FIELDS = extra,
+    RESET = reset
   })
 end
 
@@ -1591,6 +2713,7 @@ end
 function generator.generate(grammar, parser_name, options)
   options = options or {}
   local pgen_version = options.pgen_version or "unknown"
+  local packrat, memo_caps = common.check_memo_options(options)
 
   local max_depth = 5000
   if options.max_depth then
@@ -1612,36 +2735,30 @@ function generator.generate(grammar, parser_name, options)
   -- which would loop forever at parse time
   local analyze = require("pgen.analyze")
   analyze.check_loops(rules)
+  analyze.check_commits(rules, start_rule)
 
-  -- Assign single-slot memo ids (1-based for Lua arrays) to position-pure
-  -- rules, sorted for deterministic output
-  local memo_ids = {}
-  local memo_count = 0
-  do
-    local purity = analyze.pure_rules(rules)
-    local pure_names = {}
-    for name, pure in pairs(purity) do
-      if pure then
-        table.insert(pure_names, name)
-      end
-    end
-    table.sort(pure_names)
-    for i, name in ipairs(pure_names) do
-      memo_ids[name] = i
-    end
-    memo_count = #pure_names
-  end
+  -- Assign memo ids (1-based for Lua arrays) to position-pure rules and
+  -- capture-replay ids to the other memoizable rules
+  local memo_ids, memo_count, replay_ids, replay_count =
+    common.assign_memo_ids(rules, memo_caps, 1)
 
   local context = {
     analyze = analyze,
     rules = rules,
     stateful_rules = analyze.stateful_rules(rules),
     memo_ids = memo_ids,
+    replay_ids = replay_ids,
+    packrat = packrat,
     errors = options.pgen_errors and true or false,
     has_indenters = #indenters > 0,
     set_index = {},
     set_list = {},
+    class_index = {},
+    class_list = {},
+    reserved_index = {},
+    reserved_list = {},
     dispatch_inits = {},
+    prec_functions = {},
     features = {}
   }
 
@@ -1661,7 +2778,9 @@ function generator.generate(grammar, parser_name, options)
 --   local result = $PARSER_NAME$.parse("your input string")
 
 local select, type, error, pcall, tostring = select, type, error, pcall, tostring
+local setmetatable, tonumber = setmetatable, tonumber
 local byte, sub = string.byte, string.sub
+local floor = math.floor
 local unpack = table.unpack or unpack
 local pack = table.pack or function(...) return {n = select("#", ...), ...} end
 
@@ -1679,6 +2798,8 @@ local CAP_STR, CAP_CONST, CAP_NIL, CAP_POS, CAP_VALUE = 1, 2, 3, 4, 5
 local CAP_TBL_OPEN, CAP_TBL_CLOSE = 6, 7
 local CAP_GROUP_OPEN, CAP_GROUP_CLOSE = 8, 9
 local CAP_FN_OPEN, CAP_FN_CLOSE = 10, 11
+local CAP_SPAN = 12
+local CAP_CONVERT = 13  -- Cnum/Cunescape; aux: the conversion function
 
 local rules = {}]], {
       PGEN_VERSION = pgen_version,
@@ -1690,9 +2811,34 @@ local rules = {}]], {
   if #context.set_list > 0 then
     prelude_lines[#prelude_lines + 1] = "local sets = {}"
   end
+  if #context.class_list > 0 then
+    prelude_lines[#prelude_lines + 1] = "local classes = {}"
+  end
+  if #context.reserved_list > 0 then
+    prelude_lines[#prelude_lines + 1] = "local reserved = {}"
+  end
+  if replay_count > 0 then
+    prelude_lines[#prelude_lines + 1] = template_code([[
+-- Capture log entries a capture-replay memo entry holds at most (the
+-- memo_caps compile option)
+local MEMO_CAPS = $MEMO_CAPS$]], {MEMO_CAPS = memo_caps})
+  end
+  if packrat and memo_count > 0 then
+    local limit = math.floor(options.memo_limit or 64 * 1024 * 1024)
+    prelude_lines[#prelude_lines + 1] = template_code([[
+-- Packrat memo slots per rule: the memo_limit compile option ($LIMIT$
+-- bytes) counted in 16-byte slots, as in the C target
+local MEMO_LIMIT = $SLOTS$]], {
+      LIMIT = limit,
+      SLOTS = math.max(1, math.floor(limit / (memo_count * 16)))
+    })
+  end
   if #context.dispatch_inits > 0 then
     prelude_lines[#prelude_lines + 1] = "local disp = {}"
   end
+  if #context.prec_functions > 0 then
+    prelude_lines[#prelude_lines + 1] = "local precs = {}"
+  end
   if #cmt_codes > 0 then
     prelude_lines[#prelude_lines + 1] = "local cmt_fns = {}"
   end
@@ -1707,6 +2853,10 @@ local rules = {}]], {
     CORE_HELPERS
   }
 
+  if context.features.convert then
+    chunks[#chunks + 1] = CONVERT_HELPERS
+  end
+
   if context.features.cap_select then
     chunks[#chunks + 1] = CAP_SELECT_HELPER
   end
@@ -1716,12 +2866,23 @@ local rules = {}]], {
   if context.features.run_cmt then
     chunks[#chunks + 1] = RUN_CMT_HELPER
   end
+  if context.features.commit then
+    chunks[#chunks + 1] = COMMIT_HELPER
+  end
+  if replay_count > 0 then
+    chunks[#chunks + 1] = REPLAY_HELPERS
+  end
+  if context.features.prec then
+    chunks[#chunks + 1] = PREC_HELPERS
+  end
   if context.has_indenters then
     chunks[#chunks + 1] = IND_HELPERS
   end
 
   chunks[#chunks + 1] = generate_cmt_infrastructure(cmt_codes)
   chunks[#chunks + 1] = generate_sets_code(context.set_list)
+  chunks[#chunks + 1] = generate_classes_code(context.class_list)
+  chunks[#chunks + 1] = generate_reserved_code(context.reserved_list)
 
   if #context.dispatch_inits > 0 then
     chunks[#chunks + 1] = "-- FIRST-byte dispatch tables\n" ..
@@ -1729,7 +2890,11 @@ local rules = {}]], {
   end
 
   chunks[#chunks + 1] = table.concat(rule_chunks, "\n")
-  chunks[#chunks + 1] = generate_parser_main(start_rule, context, indenters, memo_count)
+  if #context.prec_functions > 0 then
+    chunks[#chunks + 1] = "-- Precedence climbing functions\n" ..
+      table.concat(context.prec_functions, "\n")
+  end
+  chunks[#chunks + 1] = generate_parser_main(start_rule, context, indenters, memo_count, replay_count)
 
   return table.concat(chunks, "\n")
 end
@@ -1,6 +1,12 @@
 local optimize = {}
 local types = require("pgen.types")
 
+-- Pattern tables overload __len for lookahead on Lua 5.2+, so use the raw
+-- array length when inspecting their children
+local raw_length = rawlen or function(value)
+  return #value
+end
+
 -- Flatten nested choices: choice(choice(a,b), c) → {a, b, c}
 local function flatten_choices(pattern)
   if pattern.type ~= "choice" then
@@ -170,6 +176,120 @@ function optimize.trie_optimization(grammar)
   end)
 end
 
+-- Replace unbounded repetitions of a single-byte class (S" \t"^0,
+-- R("az", "09")^1, (P(1) - S"\r\n")^0) with a class run node, which the
+-- generators match with a scanning loop instead of stepping through the
+-- body once per byte. The class is stored as analyze.class_key's string
+-- encoding, so identical classes share one table in the generated code.
+function optimize.class_run_optimization(grammar)
+  local pgen = require("pgen")
+  local visitor = require("pgen.visitor")
+  local analyze = require("pgen.analyze")
+
+  return visitor.visit_grammar(grammar, function(node, replace)
+    if node.type ~= "repeat" or node[2] < 0 then return end
+
+    local class = analyze.byte_class(node[1])
+    if not class then return end
+
+    replace(pgen._make({
+      type = "class_run",
+      class = analyze.class_key(class),
+      min = node[2]
+    }))
+    return visitor.SKIP_CHILDREN
+  end)
+end
+
+-- Merge choices of single-byte classes (S"+-" + R"09" + P"_") into one
+-- char_class node, matched with a single bitmap test instead of one test
+-- per alternative. Only choices that never record the furthest failure
+-- are merged, so error positions don't change.
+function optimize.char_class_optimization(grammar)
+  local pgen = require("pgen")
+  local visitor = require("pgen.visitor")
+  local analyze = require("pgen.analyze")
+
+  return visitor.visit_grammar(grammar, function(node, replace)
+    if node.type ~= "choice" then return end
+
+    local class = analyze.byte_class(node)
+    if not class or next(class.records) or class.record_eof then return end
+
+    replace(pgen._make({
+      type = "char_class",
+      class = analyze.class_key(class)
+    }))
+    return visitor.SKIP_CHILDREN
+  end)
+end
+
+-- Fuse a keyword with the identifier boundary check after it: a literal or
+-- trie followed by a negated single-byte class (P"and" * -V"IdentChar",
+-- where IdentChar is a class rule) becomes one keyword node, which tests
+-- the byte after the match directly instead of setting up a predicate with
+-- its own backtrack snapshot. Classes that record the furthest failure
+-- themselves aren't fused, so error positions don't change.
+function optimize.keyword_boundary_optimization(grammar)
+  local pgen = require("pgen")
+  local visitor = require("pgen.visitor")
+  local analyze = require("pgen.analyze")
+
+  -- resolve rule references to the class they match, if any
+  local function boundary_class(pattern, seen)
+    if type(pattern) ~= "table" then return nil end
+    if pattern.type == types.V then
+      local name = pattern.value
+      if seen[name] then return nil end
+      seen[name] = true
+      return boundary_class(grammar[name], seen)
+    end
+    local class = analyze.byte_class(pattern)
+    if not class or next(class.records) or class.record_eof then return nil end
+    return class
+  end
+
+  local function is_keyword(node)
+    if type(node) ~= "table" then return false end
+    if node.type == "literal_trie" then return true end
+    return node.type == types.P and type(node.value) == "string" and #node.value > 0
+  end
+
+  return visitor.visit_grammar(grammar, function(node, replace)
+    if node.type ~= "sequence" then return end
+
+    local children = {}
+    local fused = false
+    local i = 1
+    while node[i] ~= nil do
+      local child, after = node[i], node[i + 1]
+      local class = is_keyword(child) and type(after) == "table" and
+        after.type == "negate" and boundary_class(after[1], {})
+      if class then
+        table.insert(children, pgen._make({
+          type = "keyword",
+          class = analyze.class_key(class),
+          child
+        }))
+        fused = true
+        i = i + 2
+      else
+        table.insert(children, child)
+        i = i + 1
+      end
+    end
+
+    if not fused then return end
+    if #children == 1 then
+      replace(children[1])
+    else
+      local sequence = visitor.copy_node(node)
+      for j = 1, raw_length(node) do sequence[j] = children[j] end
+      replace(sequence)
+    end
+  end)
+end
+
 -- Replace a sufficiently wide ordered choice with a byte dispatcher. The
 -- dispatcher only removes alternatives whose FIRST set proves they cannot
 -- match; all remaining alternatives retain their original PEG order.
@@ -278,6 +398,9 @@ end
 -- Main entry point: apply all optimization passes
 function optimize.optimize_grammar(grammar)
   grammar = optimize.trie_optimization(grammar)
+  grammar = optimize.class_run_optimization(grammar)
+  grammar = optimize.char_class_optimization(grammar)
+  grammar = optimize.keyword_boundary_optimization(grammar)
   grammar = optimize.dispatch_choice_optimization(grammar)
   grammar = optimize.capture_table_optimization(grammar)
   -- Future: add more optimization passes here
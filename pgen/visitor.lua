@@ -69,7 +69,7 @@ function visitor.visit_pattern(pattern, visitor_fn)
     if new_value ~= pattern.value then
       return visitor.copy_node(pattern, {value = new_value}), false
     end
-  elseif t == "sequence" or t == "choice" or t == "dispatch_choice" then
+  elseif t == "sequence" or t == "choice" or t == "dispatch_choice" or t == "prec" then
     local changed = false
     local new_children = {}
     for i, child in ipairs(pattern) do
@@ -87,7 +87,7 @@ function visitor.visit_pattern(pattern, visitor_fn)
       end
       return new_pattern, false
     end
-  elseif t == "repeat" or t == "negate" then
+  elseif t == "repeat" or t == "negate" or t == "keyword" then
     local new_child, stopped = visitor.visit_pattern(pattern[1], visitor_fn)
     if stopped then
       return pattern, true
@@ -9,9 +9,9 @@ local parser = argparse()
   :description("pgen: Lua Pattern Generator for C")
   :epilog("Example: pgen_cli.lua -o my_parser.c -n my_parser grammar.lua -s my_parser.so")
 
-parser:option("--target", "Code generation target: c (default) or lua (self-contained pure Lua module, no C compiler needed). Inferred as lua when the output file ends in .lua")
+parser:option("--target", "Code generation target: c (default), c-api (standalone C parser with no Lua dependency) or lua (self-contained pure Lua module, no C compiler needed). Inferred as lua when the output file ends in .lua")
   :argname("TARGET")
-  :choices({"c", "lua"})
+  :choices({"c", "c-api", "lua"})
 
 parser:flag("-v --version", "Show the pgen version and exit")
   :action(function()
@@ -28,6 +28,9 @@ parser:option("-o --output", "Output source file (.c, or .lua for the lua target
 parser:option("-s --shared", "Output shared object file")
   :argname("FILE")
 
+parser:option("--header", "With the c-api target, also write the parser's public declarations to FILE")
+  :argname("FILE")
+
 parser:option("-n --name", "Parser name")
   :argname("NAME")
   :default("parser")
@@ -38,6 +41,21 @@ parser:flag("--pgen-errors", "Generate error messages on failed parse paths (war
 parser:flag("--no-optimize", "Disable grammar optimization passes")
   :default(false)
 
+parser:option("--memo", "Memoization of position-pure rules: slot (default, one entry per rule) or packrat (an entry per input position, linear time)")
+  :argname("MODE")
+  :choices({"slot", "packrat"})
+
+parser:option("--memo-limit", "Cap on the packrat memo tables in bytes (default 64 MiB)")
+  :argname("BYTES")
+  :convert(tonumber)
+
+parser:option("--memo-caps", "Capture log entries a memo entry for a capture-producing rule may hold (default 64, 0 disables memoizing those rules)")
+  :argname("N")
+  :convert(tonumber)
+
+parser:flag("--intern", "Intern the strings of all C captures through a cache, so repeated tokens reuse one Lua string")
+  :default(false)
+
 parser:flag("--json", "Output grammar as JSON instead of generating C code")
   :default(false)
 
@@ -121,8 +139,13 @@ if not target then
   end
 end
 
-if target == "lua" and args.shared then
-  print("Error: --shared cannot be combined with the lua target")
+if target ~= "c" and args.shared then
+  print("Error: --shared builds a Lua module and needs the c target")
+  os.exit(1)
+end
+
+if args.header and target ~= "c-api" then
+  print("Error: --header is only supported by the c-api target")
   os.exit(1)
 end
 
@@ -131,6 +154,10 @@ local output, err = pgen.compile(result, {
   parser_name = args.name,
   pgen_errors = args.pgen_errors,
   optimize = not args.no_optimize,
+  memo = args.memo,
+  memo_limit = args.memo_limit,
+  memo_caps = args.memo_caps,
+  intern = args.intern,
   target = target
 })
 
@@ -139,6 +166,17 @@ if not output then
   os.exit(1)
 end
 
+if args.header then
+  local c_api = require "pgen.generator_c_api"
+  local file = io.open(args.header, "w")
+  if not file then
+    print("Error: Could not open header file: " .. args.header)
+    os.exit(1)
+  end
+  file:write(c_api.generate_public_declarations(args.name))
+  file:close()
+end
+
 -- If shared file option is provided, shell out to gcc to create shared object
 if args.shared then
   local cc = os.getenv("PGEN_CC") or "gcc"
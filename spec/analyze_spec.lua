@@ -183,6 +183,54 @@ describe("position purity analysis", function()
   end)
 end)
 
+describe("capture replay analysis", function()
+  local analyze = require "pgen.analyze"
+  local T, Cmb, Cmt, Cg, Ct, Cc, Cp = pgen.T, pgen.Cmb, pgen.Cmt, pgen.Cg,
+    pgen.Ct, pgen.Cc, pgen.Cp
+
+  it("accepts rules that only append capture log entries", function()
+    local r = analyze.replayable_rules{
+      item = Ct(Cg(C(V"word"), "name") * Cp() * Cc(true)),
+      word = pgen.R"az"^1,
+    }
+    assert.is_true(r.item)
+    assert.is_true(r.word)
+  end)
+
+  it("rejects match-time state through rule references", function()
+    local ind = pgen.indenter{}
+    local r = analyze.replayable_rules{
+      top = C(V"checked") + V"plain",
+      checked = Cmt(P"a", "return true"),
+      backref = Cg(C(P"x"), "eq") * Cmb"eq",
+      labeled = C(P"a") + T"expected_a",
+      indented = ind.check * C(P"a"),
+      plain = C(P"b"),
+    }
+    assert.is_false(r.top)
+    assert.is_false(r.checked)
+    assert.is_false(r.backref)
+    assert.is_false(r.labeled)
+    assert.is_false(r.indented)
+    assert.is_true(r.plain)
+  end)
+
+  it("emits replay slots for capturing rules only", function()
+    local output = pgen.compile({
+      "start",
+      start = V"space" * V"word",
+      space = S" \t"^0,
+      word = C(pgen.R"az"^1),
+    }, {optimize = false})
+    assert.matches("PGEN_REPLAY_COUNT 2", output)
+    assert.matches("pgen_replay%(parser, 1%)", output)
+    assert.falsy(pgen.compile({
+      "start",
+      start = C(P"a"),
+    }, {memo_caps = 0}):match("PGEN_REPLAY_COUNT"))
+  end)
+end)
+
 describe("FIRST-byte analysis", function()
   local analyze = require "pgen.analyze"
 
@@ -224,3 +272,38 @@ describe("FIRST-byte analysis", function()
     assert.is_true(first.dynamic.unknown)
   end)
 end)
+
+describe("byte class analysis", function()
+  local analyze = require "pgen.analyze"
+  local R = pgen.R
+
+  it("accepts single-byte patterns and their choices", function()
+    local class = analyze.byte_class(S" \t" + R"az" + P"_")
+    assert.is_true(class.bytes[string.byte(" ")])
+    assert.is_true(class.bytes[string.byte("q")])
+    assert.is_true(class.bytes[string.byte("_")])
+    assert.is_nil(class.bytes[string.byte("A")])
+    assert.is_false(class.record_eof)
+    assert.same({}, class.records)
+  end)
+
+  it("records the furthest failure at excluded bytes", function()
+    local class = analyze.byte_class(P(1) - S"\r\n")
+    assert.is_nil(class.bytes[10])
+    assert.is_true(class.bytes[0])
+    assert.is_true(class.records[10])
+    assert.is_true(class.records[13])
+    assert.is_nil(class.records[0])
+    assert.is_true(class.record_eof)
+  end)
+
+  it("rejects patterns that match more or less than one byte", function()
+    assert.is_nil(analyze.byte_class(P"ab"))
+    assert.is_nil(analyze.byte_class(P(2)))
+    assert.is_nil(analyze.byte_class(S"ab"^0))
+    assert.is_nil(analyze.byte_class(V"name"))
+    assert.is_nil(analyze.byte_class(C(S"ab")))
+    assert.is_nil(analyze.byte_class(-P"x" * P"ab"))
+    assert.is_nil(analyze.byte_class(-P"xy" * P(1)))
+  end)
+end)
@@ -0,0 +1,36 @@
+local pgen = require "pgen"
+
+describe("NUL bytes", function()
+  local parser = pgen.require("spec.parsers.binary_frame")
+
+  it("does not truncate input at embedded NULs", function()
+    assert.same({"a\0b\0"}, {parser.parse("raw:a\0b\0")})
+    assert.same({"\0"}, {parser.parse("raw:\0")})
+  end)
+
+  it("matches NUL in literals, sets and ranges", function()
+    local input = "frame:PG\0" .. "1" .. "\1abc\0" .. "\0\5x\0" .. "\2\0"
+    assert.same({{
+      {"\1", "abc"},
+      {"\0", "\5x"},
+      {"\2", ""},
+    }}, {parser.parse(input)})
+  end)
+
+  it("matches a literal NUL followed by a digit exactly", function()
+    assert.same({{}}, {parser.parse("frame:PG\0" .. "1")})
+    assert.is_nil(parser.parse("frame:PG\1"))
+    assert.is_nil(parser.parse("frame:PG\0" .. "2"))
+  end)
+
+  it("fails on bytes outside the record payload class", function()
+    assert.is_nil(parser.parse("frame:PG\0" .. "1" .. "\1a\10\0"))
+    assert.is_nil(parser.parse("frame:PG\0" .. "1" .. "\3a\0"))
+  end)
+
+  it("treats NUL like any other byte when parsing with a handle", function()
+    local handle = parser.new()
+    assert.same({"x\0y"}, {handle:parse("raw:x\0y")})
+    assert.same({{{"\0", ""}}}, {handle:parse("frame:PG\0" .. "1" .. "\0\0")})
+  end)
+end)
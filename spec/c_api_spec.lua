@@ -0,0 +1,171 @@
+-- The c-api target (target = "c-api") generates a plain C parser with no
+-- Lua dependency. These specs build each parser into a small driver
+-- program, compiled without any Lua flags, that prints the result and the
+-- capture log.
+local pgen = require "pgen"
+
+describe("c-api target", function()
+  local P, R, V, C, Cc, Cp, Ct, Cg, Cmb, Cmt, Cfn, T =
+    pgen.P, pgen.R, pgen.V, pgen.C, pgen.Cc, pgen.Cp, pgen.Ct, pgen.Cg,
+    pgen.Cmb, pgen.Cmt, pgen.Cfn, pgen.T
+
+  local grammar = {
+    "start",
+    start = V"nested" + Ct(V"entry" * (P"," * V"entry")^0) * (-P(1) + T"trailing"),
+    nested = P"(" * V"nested" * P")" + P"x",
+    entry = Ct(Cg(C(R"az"^1), "key") * P"=" * V"value"),
+    value = C(R"09"^1) +
+            P"yes" * Cc(true, "y") +
+            P"@" * Cp() +
+            P"<" * Cg(C(R"az"^1), "tag") * P">" * Cmb"tag",
+  }
+
+  local driver = [[
+
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+  static char buf[4096];
+  FILE *f = fopen(argv[1], "rb");
+  size_t len = fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+
+  api_test_result result;
+  int status = api_test_parse(buf, len, &result);
+  printf("%d %d %s\n", status, (int)result.pos, result.label ? result.label : "-");
+  if (status == API_TEST_ERROR) {
+    printf("%s\n", result.message);
+  }
+  for (size_t i = 0; i < result.cap_len; i++) {
+    api_test_capture *cap = &result.caps[i];
+    printf("%d %d %d %d\n", cap->kind, cap->aux, (int)cap->start, (int)cap->len);
+  }
+  api_test_result_free(&result);
+
+  for (size_t i = 0; i < api_test_constant_count; i++) {
+    const api_test_constant *c = &api_test_constants[i];
+    printf("const %d %s %g\n", c->type, c->str ? c->str : "-", c->num);
+  }
+  for (int i = 0; api_test_group_names[i]; i++) {
+    printf("group %s\n", api_test_group_names[i]);
+  }
+  return 0;
+}
+]]
+
+  local function compile_driver(options)
+    options = options or {}
+    options.target = "c-api"
+    options.parser_name = "api_test"
+    local code = pgen.compile(grammar, options)
+    assert.falsy(code:match("%$[A-Z_]+%$"))
+    assert.falsy(code:match("#include <lua"))
+
+    local source = os.tmpname() .. ".c"
+    local exe = os.tmpname()
+    local f = assert(io.open(source, "w"))
+    f:write(code, driver)
+    f:close()
+
+    local cc = os.getenv("PGEN_CC") or "gcc"
+    local proc = assert(io.popen(("%s -std=c99 -o %s %s 2>&1"):format(cc, exe, source)))
+    local output = proc:read("*a")
+    local ok = proc:close()
+    os.remove(source)
+    assert(ok, output)
+    return exe
+  end
+
+  local function run(exe, input)
+    local input_file = os.tmpname()
+    local f = assert(io.open(input_file, "wb"))
+    f:write(input)
+    f:close()
+    local proc = assert(io.popen(exe .. " " .. input_file))
+    local lines = {}
+    for line in proc:lines() do
+      table.insert(lines, line)
+    end
+    proc:close()
+    os.remove(input_file)
+    return lines
+  end
+
+  local exe
+  setup(function()
+    exe = compile_driver()
+  end)
+
+  teardown(function()
+    if exe then os.remove(exe) end
+  end)
+
+  it("returns the flat capture log", function()
+    assert.same({
+      "0 11 -",
+      "5 0 0 0",   -- TBL_OPEN (list)
+      "5 0 0 0",   -- TBL_OPEN (entry)
+      "7 0 0 0",   -- GROUP_OPEN "key"
+      "0 0 0 2",   -- STR "ab"
+      "8 0 2 0",   -- GROUP_CLOSE
+      "0 0 3 2",   -- STR "12"
+      "6 0 5 0",   -- TBL_CLOSE
+      "5 0 6 0",
+      "7 0 6 0",
+      "0 0 6 1",   -- STR "c"
+      "8 0 7 0",
+      "1 1 0 0",   -- CONST true
+      "1 0 0 0",   -- CONST "y"
+      "6 0 11 0",
+      "6 0 11 0",
+      "const 0 y 0",
+      "const 2 - 1",
+      "group key",
+      "group tag",
+    }, run(exe, "ab=12,c=yes"))
+  end)
+
+  it("reports positions and backreferences", function()
+    local lines = run(exe, "a=@,b=<ok>ok")
+    assert.same("0 12 -", lines[1])
+    assert.same("3 0 3 0", lines[7])  -- POS at offset 3
+    assert.same({"7 1 7 0", "0 0 7 2", "8 1 9 0"}, {lines[13], lines[14], lines[15]})
+  end)
+
+  it("returns an empty log for a match without captures", function()
+    local lines = run(exe, "((x))")
+    assert.same("0 5 -", lines[1])
+    assert.same("const 0 y 0", lines[2])
+  end)
+
+  it("reports labeled failures", function()
+    assert.same("1 4 trailing", run(exe, "ab=1;")[1])
+  end)
+
+  it("reports the furthest failure position", function()
+    assert.same("1 3 -", run(exe, "ab=")[1])
+  end)
+
+  it("aborts with an error past the recursion limit", function()
+    local limited = compile_driver({max_depth = 20})
+    local lines = run(limited, ("("):rep(50) .. "x" .. (")"):rep(50))
+    os.remove(limited)
+    assert.same("2 0 -", lines[1])
+    assert.truthy(lines[2]:match("max recursion depth %(20%) exceeded"))
+  end)
+
+  it("rejects Lua callbacks", function()
+    assert.has_error(function()
+      pgen.compile({"start", start = Cmt(P"a", "return true")}, {target = "c-api"})
+    end, "The c-api target does not support Cmt or Cfn: their callbacks are Lua code")
+    assert.has_error(function()
+      pgen.compile({"start", start = Cfn(C(P"a"), "return tostring")}, {target = "c-api"})
+    end, "The c-api target does not support Cmt or Cfn: their callbacks are Lua code")
+  end)
+
+  it("can't be loaded with pgen.require", function()
+    assert.has_error(function()
+      pgen.require("spec.parsers.range", {target = "c-api"})
+    end)
+  end)
+end)
@@ -0,0 +1,49 @@
+local pgen = require "pgen"
+
+describe("capture replay memoization", function()
+  local replayed, plain, small
+
+  setup(function()
+    replayed = pgen.require("spec.parsers.capture_replay")
+    plain = pgen.require("spec.parsers.capture_replay", {memo_caps = 0})
+    -- too small for most operands: only short segments are saved
+    small = pgen.require("spec.parsers.capture_replay", {memo_caps = 3})
+  end)
+
+  it("produces the same captures as matching again", function()
+    local inputs = {
+      "a", "12", "7l", "a+b", "a-3", "f(x)+g(y,z-1)", "f(g(h(1)))-x;y+z",
+      "f(a+b", "a+", "", "f(x)(y)"
+    }
+    for _, input in ipairs(inputs) do
+      assert.same({plain.parse(input)}, {replayed.parse(input)})
+      assert.same({plain.parse(input)}, {small.parse(input)})
+    end
+  end)
+
+  it("replays positions from the original match", function()
+    assert.same({{{name = "abc", 4}}}, {replayed.parse("abc")})
+    assert.same({{{"sub", {name = "ab", 3}, {name = "c", 5}}}}, {replayed.parse("ab-c")})
+  end)
+
+  it("replays nested segments", function()
+    -- every level re-parses its operand for the add and sub alternatives,
+    -- each replaying the segments saved by the levels inside it
+    local input = ("f("):rep(8) .. "x" .. (")"):rep(8)
+    assert.same({plain.parse(input)}, {replayed.parse(input)})
+    assert.same({plain.parse(input)}, {small.parse(input)})
+  end)
+
+  it("is reset between parses", function()
+    local handle = replayed.new()
+    assert.same({handle:parse("a+b")}, {plain.parse("a+b")})
+    assert.same({handle:parse("c-d")}, {plain.parse("c-d")})
+    assert.same({handle:parse("a-b", 3)}, {plain.parse("a-b", 3)})
+  end)
+
+  it("rejects a negative entry cap", function()
+    assert.has_error(function()
+      pgen.compile(require("spec.parsers.capture_replay"), {memo_caps = -1})
+    end)
+  end)
+end)
@@ -0,0 +1,38 @@
+local pgen = require "pgen"
+
+describe("character classes", function()
+  local parser, unoptimized
+
+  setup(function()
+    parser = pgen.require("spec.parsers.char_class")
+    unoptimized = pgen.require("spec.parsers.char_class", {optimize = false})
+  end)
+
+  it("matches sets, ranges and merged choices", function()
+    assert.same({{"+", "7", "_", "ab12", "Z"}}, {parser.parse("+,7,_,ab12,Z")})
+    assert.is_nil(parser.parse("+,*"))
+  end)
+
+  it("matches bytes above 0x7f", function()
+    for _, p in ipairs({parser, unoptimized}) do
+      assert.same({{"\200", "\195\169", "\255", "\254"}}, {p.parse("\200,\195\169,\255,\254")})
+      assert.same({{"\201", "\202\203", "\202", "\204"}}, {p.parse("\201,\202\203,\202,\204")})
+      assert.is_nil(p.parse("\195A"))
+      assert.is_nil(p.parse("\253"))
+    end
+  end)
+
+  it("matches the same as the unmerged choice", function()
+    for _, input in ipairs({"1", "1,", "a,+,9", "q,\128", "abcde", ""}) do
+      assert.same({unoptimized.parse(input)}, {parser.parse(input)})
+    end
+  end)
+
+  it("shares one bitmap per distinct class", function()
+    local code = pgen.compile({"start",
+      start = pgen.S"ab" * pgen.S"ba" * pgen.R"ab" * (pgen.P"a" + pgen.P"b") * pgen.S"xy"
+    })
+    assert.truthy(code:match("pgen_bitmaps%[2%]%[32%]"))
+    assert.falsy(code:match("switch %(parser"))
+  end)
+end)
@@ -0,0 +1,63 @@
+local pgen = require "pgen"
+
+describe("class runs", function()
+  local parser, unoptimized
+
+  setup(function()
+    parser = pgen.require("spec.parsers.class_run")
+    unoptimized = pgen.require("spec.parsers.class_run", {optimize = false})
+  end)
+
+  it("replaces class repetitions with scanning loops", function()
+    local grammar = require("spec.parsers.class_run")
+    assert.truthy(pgen.compile(grammar):match("Class run: %[\\x09\\x20%]%^0"))
+    assert.truthy(pgen.compile(grammar, {target = "lua"}):match("class run %[%^\\x0a\\x0d%]%^0"))
+    assert.falsy(pgen.compile(grammar, {optimize = false}):match("Class run"))
+  end)
+
+  it("matches the same as stepping through the repetition", function()
+    local inputs = {
+      "a", "abc 1 2.5", "  x\t\t12 # note\n\ny 3",
+      "name 'quoted text' 7", "z '' 1", "w \200\201\255 8",
+      "a 1.", "a 'open", "a b", "a #\r\nb", "", "1"
+    }
+    for _, input in ipairs(inputs) do
+      assert.same({unoptimized.parse(input)}, {parser.parse(input)})
+    end
+  end)
+
+  it("scans runs longer than a vector", function()
+    -- runs that stop in the first, middle and last lane of a 16 and 32
+    -- byte block, past the scalar prefix
+    for _, len in ipairs({16, 17, 31, 32, 33, 47, 48, 64, 65, 100, 1000}) do
+      local digits = ("1234567890"):rep(100):sub(1, len)
+      local spaces = (" \t"):rep(len):sub(1, len)
+      local comment = ("comment text "):rep(100):sub(1, len)
+      local input = "n" .. spaces .. digits .. spaces .. "'" .. comment .. "'" ..
+        spaces .. ("\200"):rep(len) .. " #" .. comment .. "\n" .. ("x"):rep(len)
+      assert.same({{{"n", digits, comment, ("\200"):rep(len)}, comment, {("x"):rep(len)}}}, {parser.parse(input)})
+
+      -- the run's stop byte decides the failure
+      local bad = "n " .. digits .. "x"
+      assert.same({unoptimized.parse(bad)}, {parser.parse(bad)})
+    end
+  end)
+
+  it("matches bytes above 0x7f", function()
+    assert.same({{{"w", "\200\201\255", "8"}}}, {parser.parse("w \200\201\255 8")})
+    assert.same({{{"w", "\255"}}}, {parser.parse("w\t\255")})
+  end)
+
+  it("reports the furthest failure where the repetition stopped", function()
+    for _, input in ipairs({"a '" .. ("q"):rep(40), "a '" .. ("q"):rep(40) .. "\n'", "a 1.x", "a b"}) do
+      local result = {parser.parse(input)}
+      assert.same({unoptimized.parse(input)}, result)
+      assert.is_nil(result[1])
+    end
+  end)
+
+  it("fails a one-or-more run without a member", function()
+    assert.same({{{"a", "1"}, {"b"}}}, {parser.parse("a 1\nb")})
+    assert.is_nil(parser.parse("a .5"))
+  end)
+end)
@@ -35,4 +35,33 @@ describe("capture match back (Cmb) parser", function()
     local result = parser.parse("3:done")
     assert.same({maybe = "", "done"}, result)
   end)
+
+  it("skips nested captures to find the group", function()
+    assert.same({tag = "b", {"1"}, "2"}, parser.parse("5:<a><b>1</b> 2</a>"))
+    assert.is_nil(parser.parse("5:<a><b>1</a> 2</b>"))
+  end)
+
+  it("skips other groups holding tables to find the group", function()
+    assert.truthy(parser.parse("6:ab=1,2,3;ab"))
+    assert.is_nil(parser.parse("6:ab=1,2;ba"))
+  end)
+
+  it("skips large nested captures", function()
+    local depth = 100
+    local input = {"5:"}
+    for i = 1, depth do
+      table.insert(input, "<" .. ("t"):rep(i % 7 + 1) .. ">")
+      table.insert(input, ("1 "):rep(50))
+    end
+    for i = depth, 1, -1 do
+      table.insert(input, "</" .. ("t"):rep(i % 7 + 1) .. ">")
+    end
+    local result = parser.parse(table.concat(input))
+    for _ = 1, depth - 1 do
+      assert.same(51, #result)
+      result = result[51]
+    end
+    assert.same(50, #result)
+    assert.is_nil(parser.parse(table.concat(input):sub(1, -3) .. "x>"))
+  end)
 end)
@@ -0,0 +1,48 @@
+local pgen = require "pgen"
+
+describe("Cmt_c", function()
+  if os.getenv("PGEN_TARGET") == "lua" then
+    it("is rejected by the lua target", function()
+      assert.has_error(function()
+        pgen.compile(require("spec.parsers.cmt_c"), {target = "lua"})
+      end, "The lua target does not support Cmt_c: its predicate is C code")
+    end)
+    return
+  end
+
+  local parser = pgen.require("spec.parsers.cmt_c")
+
+  it("continues at the position the predicate returns", function()
+    assert.same({{"[[a]]", "[==[b]]c]=]]==]", "x"}},
+      {parser.parse("[[a]] [==[b]]c]=]]==] x")})
+  end)
+
+  it("fails when the predicate fails", function()
+    assert.is_nil(parser.parse("[=[a]]"))
+    assert.same({{"0", "255", "x"}}, {parser.parse("0 255 x")})
+    local result, _, pos = parser.parse("12 256")
+    assert.is_nil(result)
+    assert.same(7, pos)
+  end)
+
+  it("treats stop as the end of input", function()
+    assert.same({{"[[a]]"}}, {parser.parse("[[a]] [[b]]", 1, 5)})
+    assert.is_nil(parser.parse("[[a]]", 1, 4))
+  end)
+
+  it("shares the C function between identical predicates", function()
+    local P, C, Cmt_c = pgen.P, pgen.C, pgen.Cmt_c
+    local code = pgen.compile({
+      "start",
+      start = Cmt_c(P"a", "return pos;") * Cmt_c(P"b", "return pos;") *
+        Cmt_c(C"c", "return caps[0].len == 1 ? pos : PGEN_CMT_FAIL;")
+    })
+    assert.truthy(code:find("pgen_cmt_c_1(", 1, true))
+    assert.falsy(code:find("pgen_cmt_c_2(", 1, true))
+  end)
+
+  it("compiles for the c-api target", function()
+    local code = pgen.compile(require("spec.parsers.cmt_c"), {target = "c-api"})
+    assert.truthy(code:find("pgen_run_native_cmt", 1, true))
+  end)
+end)
@@ -0,0 +1,130 @@
+local pgen = require "pgen"
+
+describe("Commit", function()
+  local parser = pgen.require("spec.parsers.commit")
+
+  local input = "v1\na 1 x\n# skipped\nb !\nc\n= 3\n"
+
+  local function collect(...)
+    local records = {}
+    local results = {parser.parse_stream(input, function(...)
+      table.insert(records, {...})
+    end, ...)}
+    return records, results
+  end
+
+  it("matches like a repetition in parse", function()
+    assert.same({
+      "v1",
+      {
+        {name = "a", 1, "x"},
+        {name = "b", "bang"},
+        {name = "c"},
+      },
+      "3"
+    }, {parser.parse(input)})
+  end)
+
+  it("hands each record to the consumer in parse_stream", function()
+    local records, results = collect()
+    assert.same({
+      {{name = "a", 1, "x"}},
+      {{name = "b", "bang"}},
+      {{name = "c"}},
+    }, records)
+    -- committed records are no longer part of the results
+    assert.same({"v1", {}, "3"}, results)
+  end)
+
+  it("streams many records", function()
+    local lines = {"v2"}
+    for i = 1, 10000 do
+      lines[#lines + 1] = "r " .. i
+    end
+    local count, sum = 0, 0
+    local header, rest = parser.parse_stream(table.concat(lines, "\n") .. "\n", function(record)
+      count = count + 1
+      sum = sum + record[1]
+    end)
+    assert.same("v2", header)
+    assert.same({}, rest)
+    assert.same(10000, count)
+    assert.same(10000 * 10001 / 2, sum)
+  end)
+
+  it("respects init and stop", function()
+    local records, results = collect(1, 9)
+    assert.same({{{name = "a", 1, "x"}}}, records)
+    assert.same({"v1", {}}, results)
+  end)
+
+  it("keeps records handed out before a failure", function()
+    local records = {}
+    local result, _, pos = parser.parse_stream("v1\na\nb\n!\n", function(record)
+      table.insert(records, record.name)
+    end)
+    assert.is_nil(result)
+    assert.same(8, pos)
+    assert.same({"a", "b"}, records)
+  end)
+
+  it("propagates consumer errors", function()
+    assert.has_error(function()
+      parser.parse_stream(input, function() error("stop here") end)
+    end)
+  end)
+
+  it("requires a consumer function", function()
+    assert.has_error(function()
+      parser.parse_stream(input, {})
+    end)
+  end)
+
+  it("rejects commits a failure could backtrack over", function()
+    local P, V, C, Ct, Commit = pgen.P, pgen.V, pgen.C, pgen.Ct, pgen.Commit
+    local message = "Commit may be backtracked over"
+
+    local ok, err = pcall(pgen.compile, {
+      "start",
+      start = Ct(Commit(C"a")) * P"!" + P"b",
+    })
+    assert.falsy(ok)
+    assert.truthy(err:find(message, 1, true))
+
+    -- through a rule referenced from a repetition
+    ok, err = pcall(pgen.compile, {
+      "start",
+      start = (V"list" * P";")^1,
+      list = Ct(Commit(C"a")),
+    })
+    assert.falsy(ok)
+    assert.truthy(err:find("Rule 'list'", 1, true))
+
+    -- nested in another Commit's iteration
+    ok, err = pcall(pgen.compile, {
+      "start",
+      start = Commit(Ct(Commit(C"a")) * P";"),
+    })
+    assert.falsy(ok)
+    assert.truthy(err:find(message, 1, true))
+
+    assert.truthy(pgen.compile({
+      "start",
+      start = V"head" * Ct(Commit(V"item", 1)),
+      head = P"#",
+      item = C"a" * P";",
+    }))
+  end)
+
+  if os.getenv("PGEN_TARGET") == "lua" then
+    it("can yield from the consumer", function()
+      local co = coroutine.wrap(function()
+        return select(2, parser.parse_stream(input, coroutine.yield))
+      end)
+      assert.same({name = "a", 1, "x"}, co())
+      assert.same({name = "b", "bang"}, co())
+      assert.same({name = "c"}, co())
+      assert.same({}, co())
+    end)
+  end
+end)
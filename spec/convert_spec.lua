@@ -0,0 +1,123 @@
+local pgen = require "pgen"
+
+describe("conversion captures", function()
+  local parser = pgen.require("spec.parsers.convert")
+
+  local function parse(input)
+    return (assert(parser.parse(input)))
+  end
+
+  local function parse_all(input)
+    local function pack(...)
+      return {n = select("#", ...), ...}
+    end
+    return pack(parser.parse(input))
+  end
+
+  describe("Cnum", function()
+    it("converts integers and floats", function()
+      assert.same({n = 5, 12, -7, 1.5, -1500, 0.5}, parse_all("n:12 n:-7 n:1.5 n:-1.5e3 n:+.5"))
+      assert.same(100, parse("n:1E2"))
+      assert.same(1, parse("n:" .. ("0"):rep(80) .. "1"))
+    end)
+
+    it("keeps integers and floats apart like tonumber", function()
+      if not math.type then
+        return
+      end
+      assert.same("integer", math.type(parse("n:12")))
+      assert.same("integer", math.type(parse("n:-9223372036854775808")))
+      assert.same("float", math.type(parse("n:12.0")))
+      assert.same("float", math.type(parse("n:1e2")))
+      assert.same("float", math.type(parse("n:9223372036854775808")))
+      assert.same(tonumber("9223372036854775808"), parse("n:9223372036854775808"))
+    end)
+
+    it("captures nil for text that isn't a decimal number", function()
+      assert.same({n = 7}, parse_all("n:abc n:1e n:. n:- n:0x10 n:1.2.3 n:1e+"))
+      assert.same({n = 3, 1, nil, 2}, parse_all("n:1 n:inf n:2"))
+    end)
+
+    it("converts the same under a locale with a decimal comma", function()
+      local numeric = os.setlocale(nil, "numeric")
+      local comma
+      for _, name in ipairs({"de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8"}) do
+        if os.setlocale(name, "numeric") then
+          comma = name
+          break
+        end
+      end
+      if not comma then
+        return
+      end
+      local ok, err = pcall(function()
+        assert.same({n = 3, 1.5, -0.25, nil}, parse_all("n:1.5 n:-2.5e-1 n:1,5"))
+        assert.same(1.5, parse("n:" .. ("0"):rep(80) .. "1.5"))
+      end)
+      os.setlocale(numeric, "numeric")
+      assert(ok, err)
+    end)
+  end)
+
+  describe("Cunescape json", function()
+    it("decodes escapes", function()
+      assert.same('a"b\\c/d\b\f\n\r\t', parse([["a\"b\\c\/d\b\f\n\r\t"]]))
+    end)
+
+    it("decodes \\u escapes as UTF-8", function()
+      assert.same("A\195\169\226\130\172", parse([["A\u00e9\u20AC"]]))
+      assert.same("\240\159\152\128", parse([["\ud83d\ude00"]]))
+      -- lone surrogates
+      assert.same("\239\191\189x\239\191\189", parse([["\ud800x\udc00"]]))
+    end)
+
+    it("keeps malformed escapes", function()
+      assert.same("\\q\\u12g\\x", parse([["\q\u12g\x"]]))
+    end)
+
+    it("returns text without escapes as it is", function()
+      assert.same({n = 2, "plain", ""}, parse_all([["plain" ""]]))
+    end)
+  end)
+
+  describe("Cunescape lua", function()
+    it("decodes escapes", function()
+      assert.same("\a\b\f\n\r\t\v\\\"'", parse([['\a\b\f\n\r\t\v\\\"\'']]))
+      assert.same("AB\0A\255", parse([['\65\066\0\x41\255']]))
+      assert.same("\0019", parse([['\0019']]))
+    end)
+
+    it("decodes escaped line breaks", function()
+      assert.same("a\nb\nc\nd", parse("'a\\\nb\\\r\nc\\\n\rd'"))
+    end)
+
+    it("skips whitespace after \\z", function()
+      assert.same("ab", parse("'a\\z  \n\t b'"))
+    end)
+
+    it("decodes \\u{XXX} as UTF-8", function()
+      assert.same("H\226\130\172\244\143\191\191", parse([['\u{48}\u{20AC}\u{10FFFF}']]))
+      assert.same("\253\191\191\191\191\191", parse([['\u{7FFFFFFF}']]))
+    end)
+
+    it("keeps malformed escapes", function()
+      assert.same("\\256\\xg\\u{80000000}\\u{}\\q", parse([['\256\xg\u{80000000}\u{}\q']]))
+    end)
+  end)
+
+  it("converts inside tables and Cmt arguments", function()
+    assert.same({n = 2, {12, "\n"}, 6}, parse_all("t:12,\\n m:3"))
+  end)
+
+  it("logs plain strings for the c-api target", function()
+    local P, Cnum, Cunescape = pgen.P, pgen.Cnum, pgen.Cunescape
+    local code = pgen.compile({
+      "start",
+      start = Cnum(P"1") * Cunescape(P"a") * Cunescape(P"b", "lua")
+    }, {target = "c-api"})
+    assert.falsy(code:find("pgen_cap_push(parser, PGEN_CAP_NUM", 1, true))
+    assert.falsy(code:find("pgen_cap_push(parser, PGEN_CAP_JSON_STR", 1, true))
+    assert.falsy(code:find("pgen_cap_push(parser, PGEN_CAP_LUA_STR", 1, true))
+    assert.truthy(code:find("pgen_cap_push(parser, PGEN_CAP_STR", 1, true))
+  end)
+end)
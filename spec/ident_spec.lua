@@ -0,0 +1,81 @@
+local pgen = require "pgen"
+
+describe("pgen.Ident", function()
+  local parser
+
+  setup(function()
+    parser = pgen.require("spec.parsers.ident")
+  end)
+
+  it("matches identifiers that aren't reserved", function()
+    assert.same({{"foo", "_bar9", "ends", "iff", "x"}}, {parser.parse("i:foo _bar9.ends iff x")})
+    assert.same({{"a1", "Do", "fore"}}, {parser.parse("i:a1 Do fore")})
+  end)
+
+  it("rejects reserved words at the identifier's start", function()
+    assert.same({nil, nil, 7}, {parser.parse("i:foo if")})
+    assert.same({nil, nil, 3}, {parser.parse("i:elseif")})
+    assert.is_nil(parser.parse("i:9a"))
+  end)
+
+  it("matches the same names as the keyword predicate", function()
+    local names = {
+      "a", "an", "and", "andy", "b", "break", "breaks", "do", "d", "else",
+      "elseif", "elsei", "end", "en", "endx", "for", "fo", "function", "functions",
+      "if", "i", "in", "inx", "local", "loca", "_", "__end", "AND", "x9", "in9"
+    }
+    for _, name in ipairs(names) do
+      assert.same((parser.parse("p:" .. name)), (parser.parse("i:" .. name)))
+    end
+  end)
+
+  it("works without reserved words", function()
+    assert.same({"and"}, {parser.parse("n:and")})
+  end)
+
+  it("requires single-byte classes", function()
+    assert.has_error(function()
+      pgen.Ident{start = pgen.P"ab", rest = pgen.R"az"}
+    end, "Ident start must match one byte from a fixed set")
+    assert.has_error(function()
+      pgen.Ident{start = pgen.R"az"}
+    end, "Ident rest must match one byte from a fixed set")
+  end)
+
+  it("looks reserved words up with a perfect hash", function()
+    local code = pgen.compile(require("spec.parsers.ident"))
+    assert.truthy(code:match("static bool pgen_reserved_1%(const char %*s, size_t len%)"))
+    assert.falsy(code:match("pgen_reserved_2"))
+  end)
+
+  it("separates reserved words whose hashes collide under one seed", function()
+    local common = require "pgen.codegen_common"
+    local words = {"ab", "bA", "qxexb", "reyes"}
+    local hash = common.reserved_perfect_hash(words)
+    local found = {}
+    for slot = 0, hash.size - 1 do
+      if hash.slots[slot] then
+        table.insert(found, hash.slots[slot])
+      end
+    end
+    table.sort(found)
+    assert.same(words, found)
+
+    local collide = pgen.require("spec.parsers.ident_collide")
+    assert.same({"aa", "ba", "reyex"}, collide.parse("aa ba reyex"))
+    for _, word in ipairs(words) do
+      assert.is_nil(collide.parse(word))
+      assert.is_nil(collide.parse("x " .. word))
+    end
+  end)
+
+  it("gives up on reserved words no seed separates", function()
+    local common = require "pgen.codegen_common"
+    local reserved_hash = common.reserved_hash
+    common.reserved_hash = function() return 7 end
+    local ok, err = pcall(common.reserved_perfect_hash, {"a", "b"})
+    common.reserved_hash = reserved_hash
+    assert.falsy(ok)
+    assert.truthy(err:find("no perfect hash found for the 2 reserved words", 1, true))
+  end)
+end)
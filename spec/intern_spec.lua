@@ -0,0 +1,58 @@
+local pgen = require "pgen"
+
+describe("interned captures", function()
+  local parser = pgen.require("spec.parsers.intern")
+
+  it("captures repeated strings", function()
+    assert.same({
+      {name = "a", "x"},
+      {name = "b", "y"},
+      {name = "a", "x"},
+      {name = "a", ""},
+    }, parser.parse("<a>x</a> <b>y</b> <a>x</a> <a></a>"))
+  end)
+
+  it("captures more distinct strings than the cache holds", function()
+    local input, expected = {}, {}
+    for i = 1, 3000 do
+      -- long enough to go through the cache on Lua 5.2+
+      local name = ("n"):rep(40) .. (i % 1500)
+      input[#input + 1] = ("<%s>%d</%s>"):format(name, i, name)
+      expected[#expected + 1] = {name = name, tostring(i)}
+    end
+    assert.same(expected, parser.parse(table.concat(input, " ")))
+  end)
+
+  it("captures repeated strings long enough for the cache", function()
+    local name, text = ("k"):rep(50), ("v"):rep(45)
+    local element = ("<%s>%s</%s>"):format(name, text, name)
+    assert.same({{name = name, text}, {name = name, text}, {name = name, "x"}},
+      parser.parse(element .. element .. ("<%s>x</%s>"):format(name, name)))
+  end)
+
+  it("captures strings too long to intern", function()
+    local text = ("long text "):rep(20)
+    assert.same({{name = "p", text}, {name = "p", text}},
+      parser.parse(("<p>%s</p><p>%s</p>"):format(text, text)))
+  end)
+
+  it("fails backreferences to interned groups", function()
+    assert.is_nil(parser.parse("<a>x</b>"))
+  end)
+
+  it("only generates the cache when used", function()
+    local grammar = {"start", start = pgen.C(pgen.P"a")}
+    assert.falsy(pgen.compile(grammar):match("#define PGEN_INTERN 1"))
+    assert.truthy(pgen.compile(grammar, {intern = true}):match("#define PGEN_INTERN 1"))
+    assert.truthy(pgen.compile({"start", start = pgen.C(pgen.P"a", {intern = true})})
+      :match("PGEN_CAP_INTERN, start_pos"))
+    assert.falsy(pgen.compile(grammar, {intern = true, target = "c-api"}):match("PGEN_CAP_INTERN, start_pos"))
+  end)
+
+  it("applies the intern option to every capture", function()
+    local interned = pgen.require("spec.parsers.json_parser", {intern = true})
+    local plain = pgen.require("spec.parsers.json_parser")
+    local input = '{"a": [1, "b", {"a": "b"}], "c": true}'
+    assert.same({plain.parse(input)}, {interned.parse(input)})
+  end)
+end)
@@ -0,0 +1,34 @@
+local pgen = require "pgen"
+
+describe("keyword boundaries", function()
+  local parser, unoptimized
+
+  setup(function()
+    parser = pgen.require("spec.parsers.keyword")
+    unoptimized = pgen.require("spec.parsers.keyword", {optimize = false})
+  end)
+
+  it("fuses keywords with identifier boundary checks", function()
+    local code = pgen.compile(require("spec.parsers.keyword"))
+    assert.truthy(code:match("Keyword followed by not %[0%-9A%-Z_a%-z%]"))
+    assert.truthy(code:match("Negate %(only match"))
+    assert.falsy(pgen.compile(require("spec.parsers.keyword"), {optimize = false}):match("Keyword followed by"))
+  end)
+
+  it("matches keywords only at identifier boundaries", function()
+    assert.same({{{"local", "x"}, {"if"}, "iffy", {"end"}, "end_", {"do"}, "done"}},
+      {parser.parse("local x if iffy end end_ do done")})
+    assert.same({{"localx"}}, {parser.parse("localx")})
+    assert.same({{{"then"}}}, {parser.parse("then")})
+  end)
+
+  it("matches the same as the unfused predicates", function()
+    local inputs = {
+      "local", "local ", "local x", "localx y", "local if", "if in then",
+      "in1", "local 1", "then_", "x y z", "1", "local\nlocal"
+    }
+    for _, input in ipairs(inputs) do
+      assert.same({unoptimized.parse(input)}, {parser.parse(input)})
+    end
+  end)
+end)
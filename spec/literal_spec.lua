@@ -0,0 +1,59 @@
+local pgen = require "pgen"
+
+describe("literal comparisons", function()
+  local parser, reference
+
+  setup(function()
+    parser = pgen.require("spec.parsers.literal")
+    -- the Lua target compares with string.sub and walks tries a byte at a
+    -- time, so it's the reference for results and failure positions
+    reference = pgen.require("spec.parsers.literal", {target = "lua"})
+  end)
+
+  local digits = "0123456789abcdefgh"
+
+  it("matches literals of every length", function()
+    for len = 1, 17 do
+      local literal = digits:sub(1, len)
+      assert.same({literal}, {parser.parse("l" .. literal .. ";")})
+    end
+  end)
+
+  it("fails at every byte of a literal like the reference", function()
+    for len = 1, 17 do
+      local literal = digits:sub(1, len)
+      for i = 1, len do
+        local input = "l" .. literal:sub(1, i - 1) .. "!" .. literal:sub(i + 1) .. ";"
+        assert.same({reference.parse(input)}, {parser.parse(input)})
+        input = "l" .. literal:sub(1, i)
+        assert.same({reference.parse(input)}, {parser.parse(input)})
+      end
+    end
+  end)
+
+  it("walks unbranched trie paths", function()
+    for _, word in ipairs({"function", "for", "local", "lo", "return", "repeat"}) do
+      assert.same({word}, {parser.parse("k" .. word .. ";")})
+      for i = 1, #word do
+        for _, input in ipairs({
+          "k" .. word:sub(1, i - 1) .. "!" .. word:sub(i + 1) .. ";",
+          "k" .. word:sub(1, i),
+          "k" .. word:sub(1, i) .. ";"
+        }) do
+          assert.same({reference.parse(input)}, {parser.parse(input)})
+        end
+      end
+    end
+  end)
+
+  it("only waits for more input while the path still matches", function()
+    local streaming = pgen.require("spec.parsers.literal", {target = "c"})
+    local handle = streaming.new()
+    assert.same({nil, "need more input"}, {handle:feed("kfunc")})
+    assert.same({"function"}, {handle:feed("tion;")})
+
+    assert.is_nil(handle:feed("kfux"))
+    assert.same({nil, "need more input"}, {handle:feed("kretu")})
+    assert.is_nil(handle:feed("x"))
+  end)
+end)
@@ -0,0 +1,71 @@
+local pgen = require "pgen"
+
+describe("packrat memoization", function()
+  local slot, packrat, capped
+
+  setup(function()
+    slot = pgen.require("spec.parsers.packrat")
+    packrat = pgen.require("spec.parsers.packrat", {memo = "packrat"})
+    -- room for a single slot per rule: every position shares it
+    capped = pgen.require("spec.parsers.packrat", {memo = "packrat", memo_limit = 1})
+  end)
+
+  local function nested(depth, op)
+    return ("("):rep(depth) .. "1" .. (op or "") .. (")"):rep(depth)
+  end
+
+  it("matches like the single-slot memo", function()
+    local inputs = {
+      "1", "1+2", "12-3+4", "(1+2)-(3)", "((1)", "1+", "(1+(2-(3)))+4",
+      nested(6), nested(6, "+"), ""
+    }
+    for _, input in ipairs(inputs) do
+      assert.same({slot.parse(input)}, {packrat.parse(input)})
+      assert.same({slot.parse(input)}, {capped.parse(input)})
+    end
+  end)
+
+  it("parses in linear time", function()
+    -- 3^60 term calls without a memo entry per position
+    local input = nested(60)
+    assert.same({#input + 1}, {packrat.parse(input)})
+    assert.same({#input + 1}, {packrat.parse(input .. ")")})
+    assert.is_nil(packrat.parse(input:sub(1, -2)))
+    assert.same({#input + 1}, {packrat.new():parse(input)})
+  end)
+
+  it("resets the memo between parses", function()
+    local handle = packrat.new()
+    assert.same({4}, {handle:parse("1+2")})
+    assert.same({4}, {handle:parse("(3)")})
+    assert.same({2}, {handle:parse("9+", 1, 1)})
+    assert.same({slot.parse("(4")}, {handle:parse("(4")})
+  end)
+
+  it("memoizes windows of a subject and trimmed handles", function()
+    local subject = ("1+"):rep(1000) .. nested(40)
+    for _, handle in ipairs({packrat.new(), packrat.new({trim = 2})}) do
+      for i = 1, 200 do
+        local init = i * 7
+        local stop = init + i % 13
+        local expected = {slot.parse(subject:sub(init, stop))}
+        -- positions are absolute: the end on success, the failure position
+        -- otherwise
+        local at = expected[1] and 1 or 3
+        expected[at] = expected[at] + init - 1
+        assert.same(expected, {handle:parse(subject, init, stop)})
+      end
+      assert.same({#subject + 1}, {handle:parse(subject)})
+      assert.same({4}, {handle:parse("1+2")})
+    end
+  end)
+
+  it("rejects unknown memo modes", function()
+    assert.has_error(function()
+      pgen.compile(require("spec.parsers.packrat"), {memo = "full"})
+    end)
+    assert.has_error(function()
+      pgen.compile(require("spec.parsers.packrat"), {memo = "packrat", memo_limit = 0})
+    end)
+  end)
+end)
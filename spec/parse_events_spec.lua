@@ -0,0 +1,83 @@
+local pgen = require "pgen"
+
+describe("parse_events", function()
+  local parser = pgen.require("spec.parsers.buffer")
+
+  local function recorder()
+    local events = {}
+    local handlers = {}
+    for _, name in ipairs({"open", "value", "field", "close"}) do
+      handlers[name] = function(arg)
+        table.insert(events, {name, arg})
+      end
+    end
+    return handlers, events
+  end
+
+  it("replays the captures as events", function()
+    local handlers, events = recorder()
+    assert.same(22, parser.parse_events("(point 1 @ab *cd) x .", handlers))
+    assert.same({
+      {"open", 1},
+      {"open", 1},
+      {"field", "tag"},
+      {"value", "point"},
+      {"value", 1},
+      {"value", 11},
+      {"value", 12},
+      {"value", "cd"},
+      {"value", 2},
+      {"close", 18},
+      {"value", "x"},
+      {"value", 22},
+      {"close", 22},
+    }, events)
+  end)
+
+  it("skips events without a handler", function()
+    local words = 0
+    parser.parse_events("(a b) c (d (e 1))", {
+      value = function(v)
+        if type(v) == "string" then words = words + 1 end
+      end
+    })
+    assert.same(5, words)  -- the tags a, d and e, and b and c
+  end)
+
+  it("delivers events in batches", function()
+    local input = ("(w 1) "):rep(300)
+    local handlers, expected = recorder()
+    parser.parse_events(input, handlers)
+
+    local events, calls = {}, 0
+    assert.same(#input + 1, parser.parse_events(input, {
+      batch = function(list, n)
+        calls = calls + 1
+        assert.truthy(n <= 256)
+        for i = 1, n do
+          table.insert(events, {list[2 * i - 1], list[2 * i]})
+        end
+      end
+    }))
+    assert.same(expected, events)
+    assert.same(math.ceil(#expected / 256), calls)
+  end)
+
+  it("returns parse() failure results", function()
+    local handlers, events = recorder()
+    assert.same({parser.parse("a (b")}, {parser.parse_events("a (b", handlers)})
+    assert.same({}, events)
+  end)
+
+  it("takes a window of the subject", function()
+    local handlers, events = recorder()
+    assert.same(4, parser.parse_events("a b c", handlers, 3, 3))
+    assert.same({{"open", 3}, {"value", "b"}, {"close", 4}}, events)
+  end)
+
+  it("propagates handler errors", function()
+    assert.has_error(function()
+      parser.parse_events("a", {value = function() error("stop") end})
+    end)
+  end)
+end)
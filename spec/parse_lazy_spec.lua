@@ -0,0 +1,84 @@
+-- parse_lazy returns table captures as proxies that build each level on
+-- first access with the C target; the Lua target returns plain tables, so
+-- the specs that don't look at the proxies themselves run against both
+describe("parse_lazy", function()
+  local pgen = require "pgen"
+  local parser
+
+  setup(function()
+    parser = pgen.require("spec.parsers.lazy")
+  end)
+
+  local input = "(a 1 (b name: c (d)) #(x y z) e)"
+
+  it("reads like the result of parse", function()
+    local doc = parser.parse_lazy(input)
+    assert.same(5, #doc)
+    assert.same("a", doc[1])
+    assert.same(2, doc[2])
+    assert.same("b", doc[3][1])
+    assert.same("c", doc[3].name)
+    assert.same("d", doc[3][2][1])
+    assert.same("table:3", doc[4])
+    assert.same("e", doc[5])
+    assert.is_nil(doc[6])
+  end)
+
+  it("materializes to the same tables as parse", function()
+    assert.same(parser.parse(input), parser.materialize(parser.parse_lazy(input)))
+    assert.same("a", parser.materialize("a"))
+  end)
+
+  it("iterates a level with expand", function()
+    local level = parser.expand(parser.parse_lazy(input)[3])
+    local keys = {}
+    for k in pairs(level) do
+      table.insert(keys, tostring(k))
+    end
+    table.sort(keys)
+    assert.same({"1", "2", "name"}, keys)
+    assert.same("d", parser.materialize(level[2])[1])
+  end)
+
+  it("keeps match-time values after the parse", function()
+    local doc = parser.parse_lazy("(7 (8))")
+    collectgarbage()
+    assert.same(14, doc[1])
+    assert.same(16, doc[2][1])
+  end)
+
+  it("reads like parse with grammars that use memo and indenter state", function()
+    local indent = pgen.require("spec.parsers.indent")
+    local text = "1:a:\n  b:\n    c\nd"
+    assert.same(indent.parse(text), indent.materialize(indent.parse_lazy(text)))
+    local replay = pgen.require("spec.parsers.capture_replay", {memo = "packrat"})
+    local statements = ("a+b;f(c-1,d);"):rep(10) .. "z"
+    local doc = replay.parse_lazy(statements)
+    collectgarbage()
+    assert.same({replay.parse(statements)}, {replay.materialize(doc)})
+  end)
+
+  it("returns parse failures unchanged", function()
+    assert.same({parser.parse("(a")}, {parser.parse_lazy("(a")})
+    assert.same({parser.parse("(a) b")}, {parser.parse_lazy("(a) b")})
+    assert.same({"a"}, parser.materialize(parser.parse_lazy("(a) b", 1, 3)))
+  end)
+
+  if os.getenv("PGEN_TARGET") ~= "lua" then
+    it("builds each level once", function()
+      local doc = parser.parse_lazy(input)
+      assert.same("userdata", type(doc))
+      assert.same("userdata", type(doc[3]))
+      assert.equal(doc[3], doc[3])
+      assert.same("table", type(parser.expand(doc)))
+      assert.equal(parser.expand(doc), parser.expand(doc))
+    end)
+
+    it("outlives the subject string and other proxies", function()
+      local inner = parser.parse_lazy("(" .. ("(x) "):rep(100) .. ")")[50]
+      collectgarbage()
+      collectgarbage()
+      assert.same({"x"}, parser.materialize(inner))
+    end)
+  end
+end)
@@ -0,0 +1,165 @@
+local pgen = require "pgen"
+
+-- Decoders for the subset of MessagePack parse_to_buffer writes, and for
+-- pgen's native format, producing plain Lua values to compare with parse()
+local function read_uint(s, pos, n)
+  local v = 0
+  for i = pos, pos + n - 1 do
+    v = v * 256 + s:byte(i)
+  end
+  return v
+end
+
+local function read_int(s, pos, n)
+  local v = read_uint(s, pos, n)
+  if v >= 2^(8 * n - 1) then
+    v = v - 2^(8 * n)
+  end
+  return v
+end
+
+local function read_double(bytes)
+  local b1, b2 = bytes:byte(1, 2)
+  local sign = b1 >= 128 and -1 or 1
+  local expo = (b1 % 128) * 16 + math.floor(b2 / 16)
+  local mant = (b2 % 16) * 2^48 + read_uint(bytes, 3, 6)
+  if expo == 0 then
+    return sign * mant * 2^-1074
+  end
+  return sign * (1 + mant / 2^52) * 2^(expo - 1023)
+end
+
+local decode_msgpack, decode_native
+
+local function read_items(decode, s, pos, count, map)
+  local t = {}
+  for i = 1, count do
+    local k, v
+    if map then
+      k, pos = decode(s, pos)
+    else
+      k = i
+    end
+    v, pos = decode(s, pos)
+    t[k] = v
+  end
+  return t, pos
+end
+
+function decode_msgpack(s, pos)
+  local b = s:byte(pos)
+  if b < 0x80 then return b, pos + 1 end
+  if b >= 0xe0 then return b - 256, pos + 1 end
+  if b >= 0xa0 and b < 0xc0 then
+    local len = b - 0xa0
+    return s:sub(pos + 1, pos + len), pos + 1 + len
+  end
+  if b >= 0x90 and b < 0xa0 then return read_items(decode_msgpack, s, pos + 1, b - 0x90) end
+  if b >= 0x80 and b < 0x90 then return read_items(decode_msgpack, s, pos + 1, b - 0x80, true) end
+  if b == 0xc0 then return nil, pos + 1 end
+  if b == 0xc2 then return false, pos + 1 end
+  if b == 0xc3 then return true, pos + 1 end
+  if b == 0xcb then return read_double(s:sub(pos + 1, pos + 8)), pos + 9 end
+  local uint = {[0xcc] = 1, [0xcd] = 2, [0xce] = 4, [0xcf] = 8}
+  if uint[b] then return read_uint(s, pos + 1, uint[b]), pos + 1 + uint[b] end
+  local int = {[0xd0] = 1, [0xd1] = 2, [0xd2] = 4, [0xd3] = 8}
+  if int[b] then return read_int(s, pos + 1, int[b]), pos + 1 + int[b] end
+  local str = {[0xd9] = 1, [0xda] = 2, [0xdb] = 4}
+  if str[b] then
+    local len = read_uint(s, pos + 1, str[b])
+    local start = pos + 1 + str[b]
+    return s:sub(start, start + len - 1), start + len
+  end
+  local sized = {[0xdc] = 2, [0xdd] = 4, [0xde] = 2, [0xdf] = 4}
+  if sized[b] then
+    local count = read_uint(s, pos + 1, sized[b])
+    return read_items(decode_msgpack, s, pos + 1 + sized[b], count, b >= 0xde)
+  end
+  error("unexpected MessagePack byte " .. b)
+end
+
+local function read_varint(s, pos)
+  local v, scale = 0, 1
+  while true do
+    local b = s:byte(pos)
+    pos = pos + 1
+    v = v + (b % 128) * scale
+    if b < 128 then return v, pos end
+    scale = scale * 128
+  end
+end
+
+function decode_native(s, pos)
+  local tag = s:byte(pos)
+  pos = pos + 1
+  if tag == 0 then return nil, pos end
+  if tag == 1 then return false, pos end
+  if tag == 2 then return true, pos end
+  if tag == 4 then return read_double(s:sub(pos, pos + 7):reverse()), pos + 8 end
+  local n
+  n, pos = read_varint(s, pos)
+  if tag == 3 then return n % 2 == 0 and n / 2 or -(n + 1) / 2, pos end
+  if tag == 5 then return s:sub(pos, pos + n - 1), pos + n end
+  if tag == 6 then return read_items(decode_native, s, pos, n) end
+  if tag == 7 then return read_items(decode_native, s, pos, n, true) end
+  error("unexpected native tag " .. tag)
+end
+
+local function decode_all(decode, s)
+  local values, pos = {}, 1
+  while pos <= #s do
+    values[#values + 1], pos = decode(s, pos)
+  end
+  return values
+end
+
+describe("parse_to_buffer", function()
+  local parser = pgen.require("spec.parsers.buffer")
+
+  it("writes MessagePack", function()
+    assert.same("\146\161a\1", parser.parse_to_buffer("a 1", "msgpack"))
+    assert.same("\145\203\63\248\0\0\0\0\0\0", parser.parse_to_buffer("1.5", "msgpack"))
+    assert.same("\145\209\255\56", parser.parse_to_buffer("-200", "msgpack"))
+  end)
+
+  it("writes the native format", function()
+    assert.same("\6\2\5\1a\3\2", parser.parse_to_buffer("a 1", "native"))
+    assert.same("\6\1\3\3", parser.parse_to_buffer("-2", "native"))
+    assert.same("\6\1\4\0\0\0\0\0\0\248\63", parser.parse_to_buffer("1.5", "native"))
+  end)
+
+  local inputs = {
+    "",
+    "a b c",
+    "(point 1 -2 (label yes no) @here .)",
+    "(x) (y (z 1.25 -300 70000 -70000 5000000000))",
+    "*ab *cde ~gone " .. ("w "):rep(15),
+    "~a ~b " .. ("w "):rep(15),
+    (" word"):rep(40) .. " " .. ("long"):rep(20),
+  }
+
+  for _, format in ipairs({"msgpack", "native"}) do
+    local decode = format == "msgpack" and decode_msgpack or decode_native
+
+    it("matches parse() results with " .. format, function()
+      for _, input in ipairs(inputs) do
+        assert.same({parser.parse(input)}, decode_all(decode, parser.parse_to_buffer(input, format)))
+      end
+    end)
+  end
+
+  it("returns parse() failure results", function()
+    assert.same({parser.parse("a (b")}, {parser.parse_to_buffer("a (b", "native")})
+    assert.same({parser.parse("a )", 1, 3)}, {parser.parse_to_buffer("a )", "msgpack", 1, 3)})
+  end)
+
+  it("takes a window of the subject", function()
+    assert.same("\6\1\5\1b", parser.parse_to_buffer("a b c", "native", 3, 3))
+  end)
+
+  it("rejects unknown formats", function()
+    assert.has_error(function()
+      parser.parse_to_buffer("a", "json")
+    end)
+  end)
+end)
@@ -0,0 +1,113 @@
+local pgen = require "pgen"
+
+describe("parser handles", function()
+  local parser
+
+  setup(function()
+    parser = pgen.require("spec.parsers.parser_handle")
+  end)
+
+  after_each(function()
+    _G.pgen_handle_hook = nil
+  end)
+
+  it("returns the same results as parse", function()
+    local handle = parser.new()
+    for _, input in ipairs({"a", "a,b", "a,[b,[c,d]],e", "a,", "level:abc"}) do
+      assert.same({parser.parse(input)}, {handle:parse(input)})
+    end
+  end)
+
+  it("can be reused many times", function()
+    local handle = parser.new()
+    for i = 1, 200 do
+      local items = {}
+      for j = 1, i % 17 + 1 do
+        items[j] = ("x"):rep(j)
+      end
+      assert.same({items}, {handle:parse(table.concat(items, ","))})
+    end
+  end)
+
+  it("reports failures like parse", function()
+    local handle = parser.new()
+    local result, message, pos = handle:parse("a,,b")
+    assert.is_nil(result)
+    assert.same({parser.parse("a,,b")}, {result, message, pos})
+    assert.same({{"a", "b"}}, {handle:parse("a,b")})
+  end)
+
+  it("accepts numbers like parse", function()
+    local handle = parser.new()
+    assert.same({parser.parse(12)}, {handle:parse(12)})
+  end)
+
+  it("rejects non-string input", function()
+    local handle = parser.new()
+    assert.has_error(function()
+      handle:parse({})
+    end)
+  end)
+
+  it("is reset after a parse aborted by an error", function()
+    local handle = parser.new()
+    local ok, err = pcall(handle.parse, handle, "boom:x")
+    assert.is_false(ok)
+    assert.matches("boom", err)
+    -- the aborted parse left 7 on the indenter stack
+    assert.same({"abc"}, {handle:parse("level:abc")})
+  end)
+
+  it("rejects re-entrant use from a callback", function()
+    local handle = parser.new()
+    _G.pgen_handle_hook = function()
+      return handle:parse("a")
+    end
+    local ok, err = pcall(handle.parse, handle, "hook:abc")
+    assert.is_false(ok)
+    assert.matches("already parsing", err)
+    -- and is usable again afterwards
+    assert.same({{"a"}}, {handle:parse("a")})
+  end)
+
+  it("allows a different handle inside a callback", function()
+    local handle, inner = parser.new(), parser.new()
+    _G.pgen_handle_hook = function(s, pos, word)
+      local result = inner:parse(word)
+      return result and #result == 1
+    end
+    assert.same({9}, {handle:parse("hook:abc")})
+  end)
+
+  describe("trim", function()
+    it("keeps parsing correctly after large inputs", function()
+      local handle = parser.new({trim = 4})
+      local items = {}
+      for i = 1, 500 do
+        items[i] = "w"
+      end
+      local big = table.concat(items, ",")
+      assert.same({items}, {handle:parse(big)})
+      assert.same({{"a", "b"}}, {handle:parse("a,b")})
+      assert.same({items}, {handle:parse(big)})
+    end)
+
+    it("must be a positive number", function()
+      assert.has_error(function()
+        parser.new({trim = 0})
+      end)
+      assert.has_error(function()
+        parser.new({trim = "big"})
+      end)
+      assert.has_error(function()
+        parser.new({trim = "12"})
+      end)
+      assert.has_error(function()
+        parser.new({trim = math.huge})
+      end)
+      assert.has_error(function()
+        parser.new({trim = 0/0})
+      end)
+    end)
+  end)
+end)
@@ -0,0 +1,19 @@
+local pgen = require "pgen"
+local P, R, S, V, C, Ct = pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct
+
+-- A small binary framing format with NUL bytes in literals, sets and
+-- ranges. The magic is a NUL followed by a digit, which must not be read
+-- back as a longer octal escape in the generated C.
+
+return {
+  "start",
+
+  start = P"frame:" * V"frame" +
+          P"raw:" * C(P(1)^0),
+
+  frame = P"PG\0" * P"1" * Ct(V"record"^0) * -P(1),
+
+  -- tag byte, payload of lowercase letters or \3-\9 control bytes, NUL
+  -- terminator
+  record = Ct(C(S"\0\1\2") * C(R("az", "\3\9")^0) * P"\0"),
+}
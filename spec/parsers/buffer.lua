@@ -0,0 +1,34 @@
+local pgen = require "pgen"
+local P, R, S, V, C, Cc, Cp, Ct, Cg, Cfn, Cspan =
+  pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Cc, pgen.Cp, pgen.Ct, pgen.Cg,
+  pgen.Cfn, pgen.Cspan
+
+-- S-expression-ish documents covering every kind of capture value
+return {
+  "document",
+
+  document = Ct(V"item"^0) * V"ws" * -1,
+
+  item = V"ws" * (V"node" + V"number" + V"flag" + V"word" + V"span" +
+                  V"pos" + V"pair" + V"drop"),
+
+  -- tagged nodes become tables with a named field
+  node = Ct(P"(" * Cg(C(R"az"^1), "tag") * V"item"^0 * V"ws" * P")"),
+
+  number = Cfn(C(P"-"^-1 * R"09"^1 * (P"." * R"09"^1)^-1),
+    "return function(s) return tonumber(s) end"),
+
+  flag = P"yes" * Cc(true) + P"no" * Cc(false),
+
+  word = C(R"az"^1),
+
+  span = P"@" * Cspan(R"az"^1),
+
+  pos = P"." * Cp(),
+
+  -- a transform returning two values, and one returning none
+  pair = P"*" * Cfn(C(R"az"^1), "return function(s) return s, #s end"),
+  drop = P"~" * Cfn(C(R"az"^1), "return function() end"),
+
+  ws = S" \n"^0
+}
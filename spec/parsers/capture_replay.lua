@@ -0,0 +1,21 @@
+-- Grammar for the capture-replay memo specs: every statement alternative
+-- re-parses the same capturing operand, and operands nest, so without a
+-- memo hit the operand is matched again at every backtrack
+local pgen = require "pgen"
+local P, R, S, V, C, Cc, Ct, Cp, Cg, Cn = pgen.P, pgen.R, pgen.S, pgen.V, pgen.C,
+  pgen.Cc, pgen.Ct, pgen.Cp, pgen.Cg, pgen.Cn
+
+return {
+  "stmts",
+
+  stmts = Ct(V"stmt" * (P";" * V"stmt")^0),
+
+  stmt = Ct(Cc("add") * V"operand" * P"+" * V"operand") +
+         Ct(Cc("sub") * V"operand" * P"-" * V"operand") +
+         V"operand",
+
+  operand = Ct(Cg(C(R"az"^1), "name") * Cp() * V"args"^-1) +
+            Ct(Cc("num") * Cn(C(R"09"^1) * C(S"lL"^-1), 1)),
+
+  args = P"(" * V"stmt" * (P"," * V"stmt")^0 * P")"
+}
@@ -0,0 +1,23 @@
+-- Grammar for the character class specs: sets, ranges and choices of them,
+-- including bytes above 0x7F
+local pgen = require "pgen"
+local P, R, S, V, C, Ct = pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct
+
+return {
+  "items",
+
+  items = Ct((V"item" * P",")^0 * V"item") * -P(1),
+
+  item = V"sign" + V"word" + V"high" + V"keyword",
+
+  -- a choice of single-byte classes, merged into one class test
+  sign = C(S"+-" + R"09" + P"_" + P"\200"),
+
+  word = C(R("az", "AZ") * R("az", "AZ", "09")^-3),
+
+  -- ranges and sets above 0x7F
+  high = C(R"\192\223" * R"\128\191") + C(S"\255\254"),
+
+  -- single-byte literals above 0x7F, as a literal and in a trie
+  keyword = C(P"\201") + C(P"\202\203" + P"\202" + P"\204")
+}
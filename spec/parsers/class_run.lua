@@ -0,0 +1,25 @@
+-- Grammar for the class run specs: repetitions of single-byte classes,
+-- which the optimizer turns into scanning loops
+local pgen = require "pgen"
+local P, R, S, V, C, Ct = pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct
+
+return {
+  "lines",
+
+  lines = Ct(V"line" * (S"\r\n"^1 * V"line")^0) * S"\r\n"^0 * -P(1),
+
+  space = S" \t"^0,
+
+  -- "name 12 3.5 \200\201 # comment"
+  line = V"space" * Ct(C(R("az", "AZ", "__")^1) *
+    (V"space" * (V"number" + V"high" + V"quoted"))^0) *
+    V"space" * V"comment"^-1,
+
+  number = C(R"09"^1 * (P"." * R"09"^1)^-1),
+
+  high = C(R"\128\255"^1),
+
+  quoted = P"'" * C((-S"'\n" * P(1))^0) * P"'",
+
+  comment = P"#" * C((P(1) - S"\r\n")^0)
+}
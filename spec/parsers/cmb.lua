@@ -1,5 +1,5 @@
 local pgen = require "pgen"
-local P, V, C, Ct, Cg, Cmb = pgen.P, pgen.V, pgen.C, pgen.Ct, pgen.Cg, pgen.Cmb
+local P, R, V, C, Ct, Cg, Cmb = pgen.P, pgen.R, pgen.V, pgen.C, pgen.Ct, pgen.Cg, pgen.Cmb
 
 return {
   "test",
@@ -7,7 +7,9 @@ return {
   test = P"1:" * V"basic_match" +
          P"2:" * V"lua_long_string" +
          P"3:" * V"empty_match" +
-         P"4:" * V"mismatch",
+         P"4:" * V"mismatch" +
+         P"5:" * V"element" +
+         P"6:" * V"labeled",
 
   -- Test 1: Basic backreference
   basic_match = Cg(P"a"^1, "as") * P":" * Cmb("as"),
@@ -24,4 +26,14 @@ return {
 
   -- Test 4: Mismatch test (should fail)
   mismatch = Cg(P"abc", "x") * Cmb("x"),
+
+  -- Test 5: Closing tags refer back past the captures of the element's
+  -- children, whose own "tag" groups are hidden inside its table
+  element = P"<" * Cg(C(R"az"^1), "tag") * P">" *
+            Ct((V"element" + C(R"09"^1) + P" ")^0) *
+            P"</" * Cmb("tag") * P">",
+
+  -- Test 6: Backreference past a differently named group holding a table
+  labeled = Cg(C(R"az"^1), "tag") * P"=" *
+            Cg(Ct((C(R"09"^1) * P","^-1)^1), "body") * P";" * Cmb("tag"),
 }
@@ -0,0 +1,44 @@
+local pgen = require "pgen"
+local P, R, S, V, C, Ct, Cspan, Cmt_c =
+  pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct, pgen.Cspan, pgen.Cmt_c
+
+return {
+  "document",
+
+  document = Ct((V"ws" * (V"long" + V"byte" + V"word"))^0) * V"ws" * -1,
+
+  -- Lua long brackets: the closing bracket must have as many = as the
+  -- opening one
+  long = C(Cmt_c(P"[" * Cspan(P"="^0) * P"[", [[
+  size_t level = caps[0].len;
+  for (size_t i = pos; i + level + 2 <= len; i++) {
+    if (input[i] != ']' || input[i + level + 1] != ']') {
+      continue;
+    }
+    size_t k = 1;
+    while (k <= level && input[i + k] == '=') {
+      k++;
+    }
+    if (k > level) {
+      return i + level + 2;
+    }
+  }
+  return PGEN_CMT_FAIL;
+]])),
+
+  -- decimal numbers from 0 to 255
+  byte = C(Cmt_c(C(R"09"^1), [[
+  unsigned value = 0;
+  for (size_t i = caps[0].start; i < caps[0].start + caps[0].len; i++) {
+    value = value * 10 + (unsigned)(input[i] - '0');
+    if (value > 255) {
+      return PGEN_CMT_FAIL;
+    }
+  }
+  return pos;
+]])),
+
+  word = C(R"az"^1),
+
+  ws = S" \n"^0
+}
@@ -0,0 +1,22 @@
+local pgen = require "pgen"
+local P, R, V, C, Ct, Cg, Cmt, Cfn, Commit =
+  pgen.P, pgen.R, pgen.V, pgen.C, pgen.Ct, pgen.Cg, pgen.Cmt, pgen.Cfn,
+  pgen.Commit
+
+-- Line-delimited records between a header and an optional footer, committed
+-- one record at a time
+return {
+  "document",
+
+  document = C(P"v" * R"09") * P"\n" * Ct(Commit(V"record")) * V"footer"^-1 * -1,
+
+  -- comment lines produce no values
+  record = P"#" * (P(1) - P"\n")^0 * P"\n" +
+    Ct(Cg(C(R"az"^1), "name") * (P" " * V"value")^0) * P"\n",
+
+  value = Cfn(C(R"09"^1), "return function(s) return tonumber(s) end") +
+    Cmt(P"!", "local subject, pos = ... return pos, 'bang'") +
+    C(R"az"^1),
+
+  footer = P"= " * C(R"09"^1) * P"\n"
+}
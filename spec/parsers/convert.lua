@@ -0,0 +1,21 @@
+local pgen = require "pgen"
+local P, R, S, V, Ct, Cmt, Cnum, Cunescape =
+  pgen.P, pgen.R, pgen.S, pgen.V, pgen.Ct, pgen.Cmt, pgen.Cnum, pgen.Cunescape
+
+-- Space separated tokens: n:TEXT is converted to a number (any TEXT, so
+-- the ones that aren't numbers capture nil), "..." is unescaped as a JSON
+-- string and '...' as a Lua string. t: and m: put conversions in a table
+-- and a Cmt's arguments.
+return {
+  "document",
+
+  document = (V"ws" * V"token")^0 * V"ws" * -1,
+
+  token = P"n:" * Cnum((1 - S" \n")^1) +
+          P'"' * Cunescape((P"\\" * 1 + (1 - S'"\\'))^0) * P'"' +
+          P"'" * Cunescape((P"\\" * 1 + (1 - S"'\\"))^0, "lua") * P"'" +
+          P"t:" * Ct(Cnum(R"09"^1) * P"," * Cunescape(P"\\n")) +
+          P"m:" * Cmt(Cnum(R"09"^1), "local subject, pos, n = ... return pos, n * 2"),
+
+  ws = S" \n"^0
+}
@@ -0,0 +1,23 @@
+-- Grammar for the pgen.Ident specs: "i:" selects the Ident construct and
+-- "p:" the keyword predicate it replaces
+local pgen = require "pgen"
+local P, R, S, V, C, Ct = pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct
+
+local start = R("az", "AZ", "__")
+local rest = R("az", "AZ", "09", "__")
+local reserved = {"and", "break", "do", "else", "elseif", "end", "for", "function", "if", "in", "local"}
+
+local keyword = P"elseif" + P"else" + P"and" + P"break" + P"do" + P"end" +
+  P"for" + P"function" + P"if" + P"in" + P"local"
+
+return {
+  "start",
+
+  start = P"i:" * Ct(V"ident" * (S" ." * V"ident")^0) * -P(1) +
+    P"p:" * Ct(V"predicate" * (S" ." * V"predicate")^0) * -P(1) +
+    P"n:" * C(pgen.Ident{start = start, rest = rest}) * -P(1),
+
+  ident = C(pgen.Ident{start = start, rest = rest, reserved = reserved}),
+
+  predicate = C(-(keyword * -rest) * start * rest^0)
+}
@@ -0,0 +1,16 @@
+-- Reserved words that collided for every seed under a 16-bit hash whose
+-- seed only offset it: "ab"/"bA" and "reyes"/"qxexb"
+local pgen = require "pgen"
+local R, S, V, C, Ct = pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct
+
+return {
+  "start",
+
+  start = Ct(V"ident" * (S" " * V"ident")^0) * -pgen.P(1),
+
+  ident = C(pgen.Ident{
+    start = R("az", "AZ"),
+    rest = R("az", "AZ"),
+    reserved = {"ab", "bA", "reyes", "qxexb"}
+  })
+}
@@ -0,0 +1,15 @@
+local pgen = require "pgen"
+local P, R, S, V, C, Ct, Cg, Cmb = pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct, pgen.Cg, pgen.Cmb
+
+-- Tag pairs like <name>text</name> with interned names, in a list
+return {
+  "document",
+
+  document = Ct(V"element"^0) * V"ws" * -1,
+
+  element = V"ws" * Ct(P"<" * Cg(C(R("az", "09")^1, {intern = true}), "name") * P">" *
+    C((P(1) - P"<")^0, {intern = true}) *
+    P"</" * Cmb"name" * P">"),
+
+  ws = S" \n"^0
+}
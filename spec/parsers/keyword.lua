@@ -0,0 +1,24 @@
+-- Grammar for the keyword boundary specs: keywords followed by a negated
+-- identifier character class, as a trie and as single literals
+local pgen = require "pgen"
+local P, R, S, V, C, Cc, Ct = pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Cc, pgen.Ct
+
+return {
+  "stmts",
+
+  stmts = Ct((V"space" * V"stmt")^0) * V"space" * -P(1),
+
+  space = S" \n"^0,
+
+  IdentChar = R("az", "AZ", "09") + P"_",
+
+  keyword = (P"local" + P"if" + P"in" + P"then" + P"end") * -V"IdentChar",
+
+  name = C(R("az", "AZ", "__") * V"IdentChar"^0) - V"keyword",
+
+  stmt = Ct(Cc"local" * P"local" * -V"IdentChar" * V"space" * V"name") +
+    Ct(C(V"keyword")) +
+    -- the boundary here isn't a class, so it stays a predicate
+    Ct(C(P"do") * -P"ne") +
+    V"name"
+}
@@ -0,0 +1,29 @@
+local pgen = require "pgen"
+local P, R, S, V, C, Ct, Cg, Cmt, Cfn =
+  pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct, pgen.Cg, pgen.Cmt, pgen.Cfn
+
+local ws = S" \n"^0
+
+-- Nested lists of words and numbers, with "name: word" fields. Cmt doubles
+-- numbers as a match-time value, and a #(...) list is passed to a Cfn
+-- callback that counts its items.
+return {
+  "document",
+
+  document = ws * V"value" * ws * -P(1),
+
+  value = V"list" + V"count" + V"field" + V"number" + C(R"az"^1),
+
+  list = Ct(P"(" * ws * (V"value" * ws)^0 * P")"),
+
+  count = Cfn(P"#" * V"list", [[return function(t)
+    return type(t) .. ":" .. #t
+  end]]),
+
+  field = P"name:" * ws * Cg(C(R"az"^1), "name"),
+
+  number = Cmt(C(R"09"^1), [[
+    local subject, pos, n = ...
+    return pos, tonumber(n) * 2
+  ]]),
+}
@@ -0,0 +1,22 @@
+-- Grammar for the literal comparison specs: literals of every length the C
+-- target compares a word at a time, and a trie with unbranched paths
+local pgen = require "pgen"
+local P, V, C = pgen.P, pgen.V, pgen.C
+
+local digits = "0123456789abcdefgh"
+local literals = P"l" * C(P(digits:sub(1, 17)))
+for len = 16, 1, -1 do
+  literals = literals + P"l" * C(P(digits:sub(1, len)))
+end
+
+return {
+  "start",
+
+  start = (V"literals" + V"keywords") * P";",
+
+  literals = literals,
+
+  -- "lo" is a prefix of "local"; "function", "return" and "repeat" have
+  -- unbranched paths after their first bytes
+  keywords = P"k" * C(P"function" + P"for" + P"local" + P"lo" + P"return" + P"repeat")
+}
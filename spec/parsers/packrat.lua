@@ -0,0 +1,16 @@
+-- Expression grammar whose alternatives re-parse the same operand: each
+-- level of nesting calls term three times at the same position, so without
+-- a memo entry per position parsing is exponential in the nesting depth.
+-- Both rules are position-pure and get memoized.
+local pgen = require "pgen"
+local P, R, V = pgen.P, pgen.R, pgen.V
+
+return {
+  "expr",
+
+  expr = V"term" * P"+" * V"expr" +
+         V"term" * P"-" * V"expr" +
+         V"term",
+
+  term = P"(" * V"expr" * P")" + R"09"^1
+}
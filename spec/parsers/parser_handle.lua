@@ -0,0 +1,20 @@
+local pgen = require "pgen"
+local P, R, V, C, Ct, Cmt = pgen.P, pgen.R, pgen.V, pgen.C, pgen.Ct, pgen.Cmt
+
+-- Exercises reusable parser handles (parser.new()): state left behind by
+-- one parse, including a parse aborted by a Lua error, must not leak into
+-- the next one
+
+local ind = pgen.indenter{}
+
+return {
+  "start",
+
+  start = P"hook:" * Cmt(C(R"az"^1), [[return _G.pgen_handle_hook(...)]]) +
+          P"boom:" * ind.cpush(7) * Cmt(P"x", [[error("boom")]]) +
+          P"level:" * ind.ctop("eq", 0) * C(R"az"^1) +
+          V"list" * -P(1),
+
+  list = Ct(V"item" * (P"," * V"item")^0),
+  item = C(R"az"^1) + P"[" * V"list" * P"]",
+}
@@ -0,0 +1,36 @@
+local pgen = require "pgen"
+local P, R, S, V, C, Ct, Cc = pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct, pgen.Cc
+
+local word_end = -R("az", "AZ", "09", "__")
+
+return {
+  "start",
+
+  start = V"ws" * V"exp" * V"ws" * -P(1),
+  ws = S" \t\n"^0,
+
+  -- Lua's binary operators, loosest first
+  exp = pgen.prec{
+    operand = V"unary",
+    space = V"ws",
+    levels = {
+      {P"or" * word_end},
+      {P"and" * word_end},
+      {"<=", ">=", "<", ">", "~=", "=="},
+      {"|"}, {"~"}, {"&"},
+      {"<<", ">>"},
+      {"..", assoc = "right"},
+      {"+", "-"},
+      {"*", "//", "/", "%"},
+      {"^", assoc = "right"},
+    },
+  },
+
+  unary = Ct(Cc("not") * P"not" * word_end * V"ws" * V"unary") +
+          Ct(Cc("neg") * P"-" * V"ws" * V"unary") +
+          V"value",
+
+  value = C(R"09"^1) +
+          C(R("az", "AZ", "__") * R("az", "AZ", "09", "__")^0) +
+          P"(" * V"ws" * V"exp" * V"ws" * P")",
+}
@@ -0,0 +1,20 @@
+local pgen = require "pgen"
+local P, R, S, V, C, Ct, Cspan = pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct, pgen.Cspan
+
+-- Key/value list where the keys are copied out and the values are only
+-- located: each entry is {key, value_start, value_stop}
+return {
+  "document",
+
+  document = P"1:" * V"entries" * -1 +
+             P"2:" * Cspan(R"az"^0) * -1 +
+             P"3:" * Cspan(P"abc" * P"!") + P"3:" * Cspan(P"ab") * P"c",
+
+  entries = V"ws" * Ct(V"entry"^0),
+
+  entry = Ct(C(R"az"^1) * V"ws" * P"=" * V"ws" * Cspan(V"value")) * V"ws",
+
+  value = P'"' * (P(1) - P'"')^0 * P'"' + R"09"^1,
+
+  ws = S(" \t\n")^0
+}
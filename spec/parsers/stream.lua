@@ -0,0 +1,49 @@
+-- Grammar for the streaming specs (handle:feed / handle:finish). Lines and
+-- blocks end in a delimiter, so their matches are final before the rest of
+-- the stream arrives; a tail runs to the end of the input.
+local pgen = require "pgen"
+local P, R, V, C, Ct, Cp, Cmt = pgen.P, pgen.R, pgen.V, pgen.C, pgen.Ct, pgen.Cp, pgen.Cmt
+
+return {
+  "record",
+
+  record = V"line" + V"block" + V"tail" + V"checked" + V"counted" +
+           V"fenced" + V"sized",
+
+  word = C(R("az", "09")^1),
+
+  -- "a b c\n"
+  line = Ct(V"word" * (P" " * V"word")^0) * P"\n" * Cp(),
+
+  -- "{a,b,c}"
+  block = P"{" * Ct(V"word" * (P"," * V"word")^0) * P"}",
+
+  -- "=abc": the word only ends at the end of input
+  tail = P"=" * V"word",
+
+  -- "!abc;"
+  checked = P"!" * Cmt(V"word", "return true") * P";",
+
+  -- "#abc;": counts the attempts to match it in the global stream_attempts
+  -- and keeps the subject it saw in stream_subject, collecting garbage each
+  -- time
+  counted = Cmt(P"#", [[
+    stream_attempts = (stream_attempts or 0) + 1
+    stream_subject = ...
+    collectgarbage()
+    return true
+  ]]) * V"word" * P";",
+
+  -- "%abc%%%": counts its attempts in stream_attempts as well, and ends in
+  -- a literal longer than one byte
+  fenced = Cmt(P"%", [[
+    stream_attempts = (stream_attempts or 0) + 1
+    return true
+  ]]) * V"word" * P"%%%",
+
+  -- "$" and the four bytes after it, whatever they are
+  sized = Cmt(P"$", [[
+    local _, pos = ...
+    return pos + 4
+  ]]) * Cp()
+}
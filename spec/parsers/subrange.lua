@@ -0,0 +1,22 @@
+local pgen = require "pgen"
+local P, R, V, C, Ct, Cp, Cmt = pgen.P, pgen.R, pgen.V, pgen.C, pgen.Ct, pgen.Cp, pgen.Cmt
+
+-- Exercises parse(subject, init, stop): matching is confined to the window
+-- while Cp, failure positions and Cmt keep seeing the whole subject
+
+return {
+  "start",
+
+  start = P"cmt:" * Cmt(C(R"az"^1), [[
+            local subject, pos, word = ...
+            return pos, #subject, word
+          ]]) +
+          P"jump:" * Cmt(R"az"^0, [[
+            local subject = ...
+            return #subject + 1
+          ]]) +
+          V"pairs" * -P(1),
+
+  pairs = Ct(V"pair" * (P"," * V"pair")^0),
+  pair = Ct(Cp() * C(R"az"^1) * P"=" * C(R"09"^1)),
+}
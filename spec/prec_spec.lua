@@ -0,0 +1,87 @@
+local pgen = require "pgen"
+local P, R, S, V, C, Ct, T = pgen.P, pgen.R, pgen.S, pgen.V, pgen.C, pgen.Ct, pgen.T
+
+describe("precedence climbing", function()
+  local parser
+
+  setup(function()
+    parser = pgen.require("spec.parsers.prec")
+  end)
+
+  it("nests left associative levels to the left", function()
+    assert.same({{{"1", "-", "2"}, "-", "3"}}, {parser.parse("1-2-3")})
+    assert.same({{{"a", "+", "b"}, "..", {"c", "+", "d"}}}, {parser.parse("a+b..c+d")})
+  end)
+
+  it("nests right associative levels to the right", function()
+    assert.same({{"2", "^", {"3", "^", "4"}}}, {parser.parse("2 ^ 3 ^ 4")})
+    assert.same({{"a", "..", {"b", "..", "c"}}}, {parser.parse("a..b..c")})
+  end)
+
+  it("binds tighter levels first", function()
+    assert.same({{{"1", "+", {"2", "*", "3"}}, "-", "4"}}, {parser.parse("1 + 2 * 3 - 4")})
+    assert.same({{"a", "or", {"b", "and", {"c", "<=", "d"}}}}, {parser.parse("a or b and c <= d")})
+    assert.same({{{"not", "a"}, "==", {"neg", "b"}}}, {parser.parse("not a == -b")})
+  end)
+
+  it("passes a lone operand's captures through", function()
+    assert.same({"x"}, {parser.parse("x")})
+    assert.same({{"x", "*", "y"}}, {parser.parse("(x * y)")})
+  end)
+
+  it("tries a level's operators in order", function()
+    assert.same({{"a", "<=", "b"}}, {parser.parse("a<=b")})
+    assert.same({{"a", "//", "b"}}, {parser.parse("a//b")})
+    assert.same({{"orx", "or", "y"}}, {parser.parse("orx or y")})
+  end)
+
+  it("fails on a dangling operator", function()
+    assert.same({nil, nil, 3}, {parser.parse("1+")})
+    assert.same({nil, nil, 8}, {parser.parse("1 + 2 *")})
+  end)
+
+  it("matches like nested per-level rules", function()
+    local ws = S" "^0
+    local value = C(R"09"^1) + P"(" * V"e1" * P")" + T"expected_value"
+    local ops = {{"+", "-"}, {"*"}, {"^"}}
+
+    local prec = pgen.prec{operand = value, space = ws, levels = ops, assoc = "right"}
+    local levels = {"e1", e4 = value}
+    for i, level in ipairs(ops) do
+      local op = P(level[1])
+      for j = 2, #level do op = op + P(level[j]) end
+      local tighter = V("e" .. (i + 1))
+      levels["e" .. i] = Ct(tighter * ws * C(op) * ws * V("e" .. i)) + tighter
+    end
+
+    local by_prec = pgen.require("spec.parsers.prec", {
+      transform = function() return {"e1", e1 = prec} end
+    })
+    local by_levels = pgen.require("spec.parsers.prec", {
+      transform = function() return levels end
+    })
+
+    for _, input in ipairs{"1", "1+2", "1 - 2 + 3", "1+2*3^4^5-6", "(1+2)*3",
+        "1 +", "1 + 2 *", "1 + )", "(1 + 2", "1 * ^ 2", "2^(3)", ""} do
+      assert.same({by_levels.parse(input)}, {by_prec.parse(input)})
+    end
+  end)
+
+  it("rejects operators that can match empty", function()
+    assert.has_error(function()
+      pgen.compile({
+        "e",
+        e = pgen.prec{operand = C(R"09"), levels = {{P"+"^-1}}},
+      })
+    end, "Rule 'e': prec operator may accept empty string (would loop forever)")
+  end)
+
+  it("validates its options", function()
+    assert.has_error(function()
+      pgen.prec{operand = V"x", levels = {}}
+    end)
+    assert.has_error(function()
+      pgen.prec{operand = V"x", levels = {{"+"}}, assoc = "none"}
+    end)
+  end)
+end)
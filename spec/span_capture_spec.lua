@@ -0,0 +1,28 @@
+describe("span_capture", function()
+  local pgen = require "pgen"
+  local parser = pgen.require("spec.parsers.span_capture")
+
+  it("captures the bounds of the match", function()
+    local input = '1:name = "pgen" count = 12'
+    local result = parser.parse(input)
+
+    assert.same({
+      {"name", 10, 15},
+      {"count", 25, 26},
+    }, result)
+    assert.same('"pgen"', input:sub(result[1][2], result[1][3]))
+    assert.same("12", input:sub(result[2][2], result[2][3]))
+  end)
+
+  it("returns both positions outside a table", function()
+    assert.same({3, 5}, {parser.parse("2:abc")})
+  end)
+
+  it("ends before the start for an empty match", function()
+    assert.same({3, 2}, {parser.parse("2:")})
+  end)
+
+  it("discards spans from failed alternatives", function()
+    assert.same({3, 4}, {parser.parse("3:abc")})
+  end)
+end)
@@ -0,0 +1,155 @@
+local pgen = require "pgen"
+
+-- handle:feed and handle:finish are C target features
+describe("streaming handles", function()
+  local parser
+
+  setup(function()
+    parser = pgen.require("spec.parsers.stream", {target = "c"})
+  end)
+
+  -- feed input one byte at a time, returning the first final result and
+  -- the number of bytes it took
+  local function feed_bytes(handle, input)
+    for i = 1, #input do
+      local result = {handle:feed(input:sub(i, i))}
+      if not (result[1] == nil and result[2] == "need more input") then
+        return result, i
+      end
+    end
+  end
+
+  it("needs more input until a match can't change", function()
+    local handle = parser.new()
+    assert.same({nil, "need more input"}, {handle:feed("ab c")})
+    assert.same({nil, "need more input"}, {handle:feed("d")})
+    assert.same({{"ab", "cd"}, 7}, {handle:feed("\n")})
+  end)
+
+  it("returns the same results as parse", function()
+    local handle = parser.new()
+    for _, input in ipairs({"a b c\n", "{a,bb,ccc}", "{a,b}x", "x y\nz"}) do
+      local result, used = feed_bytes(handle, input)
+      assert.same({parser.parse(input)}, result)
+      assert.same(input:find("[\n}]"), used)
+      handle:finish()
+    end
+  end)
+
+  it("keeps the input after a match for the next record", function()
+    local handle = parser.new()
+    assert.same({{"a"}, 3}, {handle:feed("a\nbc\n{d")})
+    -- positions are relative to the start of each match
+    assert.same({{"bc"}, 4}, {handle:feed("")})
+    assert.same({nil, "need more input"}, {handle:feed("")})
+    assert.same({{"d", "e"}}, {handle:feed(",e}")})
+  end)
+
+  it("reports failures and drops the failed input", function()
+    local handle = parser.new()
+    local result, message, pos = handle:feed("{a;")
+    assert.is_nil(result)
+    assert.same({parser.parse("{a;")}, {result, message, pos})
+    assert.same({{"b"}, 3}, {handle:feed("b\n")})
+  end)
+
+  it("finishes input whose match runs to the end", function()
+    local handle = parser.new()
+    assert.same({nil, "need more input"}, {handle:feed("=ab")})
+    assert.same({nil, "need more input"}, {handle:feed("cd")})
+    assert.same({"abcd"}, {handle:finish()})
+
+    -- the stream starts over after finish
+    assert.same({nil, "need more input"}, {handle:feed("=x")})
+    assert.same({"x"}, {handle:finish()})
+  end)
+
+  it("finishes incomplete input like parse", function()
+    local handle = parser.new()
+    handle:feed("a b")
+    assert.same({parser.parse("a b")}, {handle:finish()})
+    assert.same({parser.parse("")}, {handle:finish()})
+  end)
+
+  it("treats match-time captures before the end of the data as final", function()
+    local handle = parser.new()
+    assert.same({5}, {handle:feed("!ab;")})
+    -- run at the end of the data, the callback may be waiting for more
+    assert.same({nil, "need more input"}, {handle:feed("!ab")})
+    assert.same({5}, {handle:feed(";")})
+  end)
+
+  it("lets a match-time capture ask for input past the end", function()
+    local handle = parser.new()
+    assert.same({nil, "need more input"}, {handle:feed("$ab")})
+    -- matched up to the end of the data, it may be waiting for more
+    assert.same({nil, "need more input"}, {handle:feed("cd")})
+    assert.same({6}, {handle:feed("\n")})
+  end)
+
+  it("mixes with parse on the same handle", function()
+    local handle = parser.new()
+    handle:feed("{a,")
+    assert.same({{"x"}, 3}, {handle:parse("x\n")})
+    assert.same({{"a", "b"}}, {handle:feed("b}")})
+  end)
+
+  it("keeps captured text valid as the buffer moves", function()
+    local handle = parser.new()
+    local words = {}
+    for i = 1, 200 do
+      words[i] = ("w"):rep(i % 13 + 1) .. i
+    end
+    local input = table.concat(words, " ") .. "\n"
+    local result = feed_bytes(handle, input)
+    assert.same({words, #input + 1}, result)
+    assert.same({{"z"}}, {handle:feed("{z}")})
+  end)
+
+  it("keeps a handle nothing else references alive while it parses", function()
+    -- the Cmt collects garbage mid-parse, while the temporary handle is
+    -- only referenced by the running feed
+    assert.same({"abc"}, {parser.new():feed("#abc;")})
+  end)
+
+  it("passes match-time captures the data buffered so far", function()
+    local handle = parser.new()
+    handle:feed("#ab")
+    assert.same("#ab", stream_subject)
+    assert.same({"abc"}, {handle:feed("c;")})
+    assert.same("#abc;", stream_subject)
+  end)
+
+  it("returns a large record as soon as it is complete", function()
+    local handle = parser.new()
+    local record = "#" .. ("a"):rep(4998) .. ";"
+    assert.same({nil, "need more input"}, {handle:feed(record:sub(1, 4500))})
+    assert.same({("a"):rep(4998)}, {handle:feed(record:sub(4501))})
+  end)
+
+  it("only matches again once the last attempt's checks can decide", function()
+    local handle = parser.new()
+    stream_attempts = 0
+    assert.same({nil, "need more input"}, {handle:feed("%ab%")})
+    -- the closing literal needs two more bytes
+    assert.same({nil, "need more input"}, {handle:feed("%")})
+    assert.same(1, stream_attempts)
+    assert.same({"ab"}, {handle:feed("%")})
+    assert.same(2, stream_attempts)
+  end)
+
+  it("drops consumed input when a chunk needs the room", function()
+    local handle = parser.new()
+    local long = ("x"):rep(300)
+    assert.same({{long}, 302}, {handle:feed(long .. "\nyy")})
+    assert.same({nil, "need more input"}, {handle:feed(("z"):rep(300))})
+    assert.same({{"yy" .. ("z"):rep(300)}, 304}, {handle:feed("\n")})
+  end)
+
+  it("rejects non-string chunks", function()
+    local handle = parser.new()
+    assert.has_error(function()
+      handle:feed({})
+    end)
+  end)
+end)
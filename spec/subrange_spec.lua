@@ -0,0 +1,67 @@
+local pgen = require "pgen"
+
+describe("parse with init and stop", function()
+  local parser = pgen.require("spec.parsers.subrange")
+  local doc = "xx[a=1,bb=22]yy"
+
+  it("parses only the given window", function()
+    assert.same({{{4, "a", "1"}, {8, "bb", "22"}}}, {parser.parse(doc, 4, 12)})
+  end)
+
+  it("reports absolute positions", function()
+    local sub = doc:sub(4, 12)
+    local expected = parser.parse(sub)
+    local result = parser.parse(doc, 4, 12)
+    for i, pair in ipairs(expected) do
+      assert.same(pair[1] + 3, result[i][1])
+    end
+  end)
+
+  it("counts negative positions from the end", function()
+    assert.same({parser.parse(doc, 4, 12)}, {parser.parse(doc, -12, -4)})
+  end)
+
+  it("defaults to the whole subject", function()
+    assert.same({parser.parse("a=1")}, {parser.parse("a=1", nil, nil)})
+    assert.same({{{3, "b", "2"}}}, {parser.parse("a,b=2", 3)})
+  end)
+
+  it("treats stop as the end of input", function()
+    assert.is_nil(parser.parse(doc, 4, 13))
+    assert.same({{{1, "a", "1"}}}, {parser.parse("a=12", 1, 3)})
+  end)
+
+  it("reports failure positions in the subject", function()
+    local _, _, sub_pos = parser.parse("a=1,b")
+    local result, _, pos = parser.parse("--a=1,b--", 3, 7)
+    assert.is_nil(result)
+    assert.same(sub_pos + 2, pos)
+  end)
+
+  it("clamps out of range positions", function()
+    assert.same({parser.parse("a=1")}, {parser.parse("a=1", -100, 100)})
+    assert.is_nil(parser.parse("a=1", 10))
+    assert.is_nil(parser.parse("a=1", 3, 1))
+  end)
+
+  it("passes the whole subject to Cmt", function()
+    assert.same({11, "abc"}, {parser.parse("[[cmt:abc]]", 3, 9)})
+  end)
+
+  it("rejects Cmt positions past the window", function()
+    assert.same({9}, {parser.parse("jump:xyz")})
+    assert.is_nil(parser.parse("jump:xyz", 1, 7))
+  end)
+
+  it("rejects non-numeric positions", function()
+    assert.has_error(function() parser.parse(doc, "four") end)
+    assert.has_error(function() parser.parse(doc, 4, {}) end)
+  end)
+
+  it("works with parser handles", function()
+    local handle = parser.new()
+    assert.same({parser.parse(doc, 4, 12)}, {handle:parse(doc, 4, 12)})
+    assert.same({parser.parse(doc)}, {handle:parse(doc)})
+    assert.same({11, "abc"}, {handle:parse("[[cmt:abc]]", 3, 9)})
+  end)
+end)